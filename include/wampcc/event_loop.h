@@ -49,6 +49,10 @@ public:
   /** Post a timer function which is invoked after the elapsed time. */
   void dispatch(std::chrono::milliseconds, timer_fn fn);
 
+  /** Post a function object that is invoked once on the event thread, after
+   * the elapsed time. Allows for sub-millisecond delays. */
+  void dispatch_after(std::chrono::microseconds, std::function<void()> fn);
+
   /** Determine whether the current thread is the EV thread. */
   bool this_thread_is_ev() const;
 
@@ -58,7 +62,7 @@ private:
   void eventloop();
   void eventmain();
 
-  void dispatch(std::chrono::milliseconds, std::shared_ptr<event>);
+  void dispatch(std::chrono::steady_clock::duration, std::shared_ptr<event>);
 
   kernel* m_kernel;
   logger& __logger; /* name chosen for log macros */
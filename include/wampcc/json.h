@@ -8,6 +8,8 @@
 #ifndef __WAMPCC_JALSON_H__
 #define __WAMPCC_JALSON_H__
 
+#include <algorithm>
+#include <initializer_list>
 #include <limits>
 #include <map>
 #include <stdexcept>
@@ -62,7 +64,8 @@ typedef enum {
   eSTRING,
   eBOOL,
   eREAL,
-  eINTEGER
+  eINTEGER,
+  eBINARY
 } JSONType;
 
 /* Convert a JSONType to string representation */
@@ -145,18 +148,33 @@ public:
   virtual ~msgpack_error() throw() {}
 };
 
+class cbor_error : public json_error
+{
+public:
+  size_t error_offset;
+  cbor_error(const std::string& msg, size_t error_offset = 0);
+  virtual ~cbor_error() throw() {}
+};
+
 // ======================================================================
 //
 // Container types
 //
-// JSON container types are just the usual STL types.
+// JSON arrays and strings are just the usual STL types. JSON objects use a
+// flat, sorted container with a std::map like interface; see below.
+//
+// Binary is not a JSON type, but is supported by WAMP. It maps to msgpack bin
+// and CBOR byte strings, while for JSON it is carried as a string holding a
+// leading NUL followed by the base64 encoding of the bytes.
 //
 // ======================================================================
 
 class json_value;
+class json_object;
+class json_arena;
 typedef std::vector<json_value> json_array;
-typedef std::map<std::string, json_value> json_object;
 typedef std::string json_string;
+typedef std::vector<unsigned char> json_binary;
 
 // integer types used internally within jalson - platform widest
 typedef long long json_int_t;
@@ -195,6 +213,9 @@ public:
   json_value(const std::string&);
   json_value(const json_array&);
   json_value(const json_object&);
+  json_value(std::string&&);
+  json_value(json_array&&);
+  json_value(json_object&&);
 
   /* equality */
 
@@ -213,6 +234,8 @@ public:
   static json_value make_int(long long v = 0);
   static json_value make_uint(unsigned long long v = 0);
   static json_value make_double(double v = 0.0);
+  static json_value make_binary(const void*, size_t);
+  static json_value make_binary(json_binary);
 
   /* type query */
 
@@ -231,6 +254,8 @@ public:
 
   bool is_null() const { return type() == eNULL; }
 
+  bool is_binary() const { return type() == eBINARY; }
+
   bool is_number() const { return is_real() || is_integer(); }
   bool is_real() const { return type() == eREAL; }
   bool is_integer() const { return type() == eINTEGER; }
@@ -273,6 +298,9 @@ public:
   json_object& as_object() { return this->as<json_object>(); }
   const json_object& as_object() const { return this->as<json_object>(); }
 
+  json_binary& as_binary() { return this->as<json_binary>(); }
+  const json_binary& as_binary() const { return this->as<json_binary>(); }
+
   /* utility methods if self holds json_value::array */
   json_value& operator[](size_t i) { return this->as<json_array>()[i]; }
   const json_value& operator[](size_t i) const
@@ -285,10 +313,7 @@ public:
   json_array& insert_array(const std::string& key);
 
   /* utility methods if self holds json_value::object */
-  json_value& operator[](const std::string& k)
-  {
-    return this->as<json_object>()[k];
-  }
+  json_value& operator[](const std::string& k);
   json_object& append_object();
   json_array& append_array();
 
@@ -309,6 +334,17 @@ public:
   void swap(json_value&);
   void swap(json_value&&);
 
+  /* Make this value, and everything it contains, immutable and shared.
+   * Copies of a frozen value then share its storage through a reference
+   * count, rather than making a deep copy, and so are cheap to take, and safe
+   * to read concurrently from several threads.  Mutable access to a frozen
+   * container or string, such as through as_array() on a non-const value,
+   * first replaces it with a private, unfrozen copy of its top level; its
+   * children remain frozen until themselves accessed.  References obtained
+   * before freezing must not be used to modify the value afterwards. */
+  void freeze() { m_impl.freeze(); }
+  bool is_frozen() const { return m_impl.is_frozen(); }
+
   /* Apply a JSON Patch (IETF RFC 6902). Can throw bad_pointer and
    * bad_patch. Returns true if patch successfully applied. */
   bool patch(const json_array&);
@@ -339,6 +375,7 @@ private:
   static void ensure_type_is_json_container(json_array*) {}
   static void ensure_type_is_json_container(json_string*) {}
   static void ensure_type_is_json_container(json_object*) {}
+  static void ensure_type_is_json_container(json_binary*) {}
 
   internals::valueimpl m_impl;
 
@@ -346,8 +383,249 @@ private:
   friend json_object& append_object(json_array&);
   friend json_object& insert_object(json_object&, const std::string&);
   friend json_array& insert_array(json_object&, const std::string&);
+  friend class json_arena;
+};
+
+/* JSON object, held as a vector of key/value pairs sorted by key.  Most
+ * objects seen by WAMP are small options and details dicts, for which a flat
+ * vector is more compact and faster to search than a node based map, and
+ * takes a single allocation.  The interface follows std::map, and iteration is
+ * in key order.  However, as with std::vector, insert and erase invalidate
+ * iterators and references.
+ *
+ * Unlike std::map (which json_object replaced), value_type is
+ * std::pair<std::string, json_value>, without a const key, because the items
+ * of a vector must be assignable.  So the compiler no longer rejects a write
+ * through iter->first, but keys must not be modified in place: doing so
+ * breaks the ordering that find() and insert() rely on.  To rename a key,
+ * erase the item and insert it again. */
+class json_object
+{
+public:
+  typedef std::string key_type;
+  typedef json_value mapped_type;
+  typedef std::pair<std::string, json_value> value_type;
+  typedef std::vector<value_type> storage_type;
+  typedef storage_type::iterator iterator;
+  typedef storage_type::const_iterator const_iterator;
+  typedef storage_type::size_type size_type;
+
+  json_object() {}
+  json_object(std::initializer_list<value_type> items)
+  {
+    insert(items.begin(), items.end());
+  }
+  template <typename InputIt> json_object(InputIt first, InputIt last)
+  {
+    insert(first, last);
+  }
+
+  iterator begin() { return m_items.begin(); }
+  iterator end() { return m_items.end(); }
+  const_iterator begin() const { return m_items.begin(); }
+  const_iterator end() const { return m_items.end(); }
+  const_iterator cbegin() const { return m_items.cbegin(); }
+  const_iterator cend() const { return m_items.cend(); }
+
+  size_type size() const { return m_items.size(); }
+  bool empty() const { return m_items.empty(); }
+  void clear() { m_items.clear(); }
+  void reserve(size_type n) { m_items.reserve(n); }
+
+  iterator lower_bound(const std::string& key);
+  const_iterator lower_bound(const std::string& key) const;
+
+  iterator find(const std::string& key);
+  const_iterator find(const std::string& key) const;
+  size_type count(const std::string& key) const { return find(key) != end(); }
+
+  json_value& at(const std::string& key);
+  const json_value& at(const std::string& key) const;
+
+  json_value& operator[](const std::string& key);
+  json_value& operator[](std::string&& key);
+
+  std::pair<iterator, bool> insert(const value_type& v) { return insert(value_type(v)); }
+  std::pair<iterator, bool> insert(value_type&& v);
+  template <typename P> std::pair<iterator, bool> insert(P&& p)
+  {
+    return insert(value_type(std::forward<P>(p)));
+  }
+  template <typename InputIt> void insert(InputIt first, InputIt last)
+  {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  template <typename... Args> std::pair<iterator, bool> emplace(Args&&... args)
+  {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  size_type erase(const std::string& key);
+  iterator erase(iterator pos) { return m_items.erase(pos); }
+  iterator erase(const_iterator pos) { return m_items.erase(pos); }
+  iterator erase(const_iterator first, const_iterator last)
+  {
+    return m_items.erase(first, last);
+  }
+
+  void swap(json_object& other) { m_items.swap(other.m_items); }
+
+  bool operator==(const json_object& rhs) const { return m_items == rhs.m_items; }
+  bool operator!=(const json_object& rhs) const { return !(*this == rhs); }
+
+private:
+  /* capacity reserved on first insert, enough for typical WAMP dicts */
+  static const size_type initial_capacity = 8;
+
+  iterator insert_at(iterator pos, value_type&& v);
+
+  storage_type m_items;
 };
 
+inline json_object::iterator json_object::lower_bound(const std::string& key)
+{
+  return std::lower_bound(
+      m_items.begin(), m_items.end(), key,
+      [](const value_type& item, const std::string& k) { return item.first < k; });
+}
+
+inline json_object::const_iterator json_object::lower_bound(
+    const std::string& key) const
+{
+  return std::lower_bound(
+      m_items.begin(), m_items.end(), key,
+      [](const value_type& item, const std::string& k) { return item.first < k; });
+}
+
+inline json_object::iterator json_object::find(const std::string& key)
+{
+  iterator it = lower_bound(key);
+  return (it != m_items.end() && it->first == key) ? it : m_items.end();
+}
+
+inline json_object::const_iterator json_object::find(const std::string& key) const
+{
+  const_iterator it = lower_bound(key);
+  return (it != m_items.end() && it->first == key) ? it : m_items.end();
+}
+
+inline json_value& json_object::at(const std::string& key)
+{
+  iterator it = find(key);
+  if (it == m_items.end())
+    throw std::out_of_range("json_object::at");
+  return it->second;
+}
+
+inline const json_value& json_object::at(const std::string& key) const
+{
+  const_iterator it = find(key);
+  if (it == m_items.end())
+    throw std::out_of_range("json_object::at");
+  return it->second;
+}
+
+inline json_object::iterator json_object::insert_at(iterator pos, value_type&& v)
+{
+  if (m_items.capacity() == 0) {
+    size_t index = pos - m_items.begin();
+    m_items.reserve(initial_capacity);
+    pos = m_items.begin() + index;
+  }
+  return m_items.insert(pos, std::move(v));
+}
+
+inline std::pair<json_object::iterator, bool> json_object::insert(value_type&& v)
+{
+  iterator it = lower_bound(v.first);
+  if (it != m_items.end() && it->first == v.first)
+    return {it, false};
+  return {insert_at(it, std::move(v)), true};
+}
+
+inline json_value& json_object::operator[](const std::string& key)
+{
+  iterator it = lower_bound(key);
+  if (it != m_items.end() && it->first == key)
+    return it->second;
+  return insert_at(it, value_type(key, json_value()))->second;
+}
+
+inline json_value& json_object::operator[](std::string&& key)
+{
+  iterator it = lower_bound(key);
+  if (it != m_items.end() && it->first == key)
+    return it->second;
+  return insert_at(it, value_type(std::move(key), json_value()))->second;
+}
+
+inline json_object::size_type json_object::erase(const std::string& key)
+{
+  iterator it = find(key);
+  if (it == m_items.end())
+    return 0;
+  m_items.erase(it);
+  return 1;
+}
+
+inline json_value& json_value::operator[](const std::string& k)
+{
+  return this->as<json_object>()[k];
+}
+
+/* Monotonic allocator for the container nodes (the json_array, json_object
+ * and json_string instances) of a json_value tree.  Nodes are carved from
+ * large blocks instead of being allocated one at a time; a block is freed in a
+ * single step once the arena and every node taken from it have gone.  Nodes
+ * keep their block alive, so an arena backed value can safely be moved into
+ * longer lived storage, while copying a value makes ordinary heap copies.
+ *
+ * The arena itself is not thread safe and is intended to be used by a single
+ * decoder, typically for the lifetime of one message; the values it creates
+ * can be released on any thread. Storage owned by the nodes, such as vector
+ * elements and long string characters, still comes from the heap. */
+class json_arena
+{
+public:
+  static const size_t default_block_size = 4096;
+
+  explicit json_arena(size_t block_size = default_block_size);
+  ~json_arena();
+
+  json_arena(const json_arena&) = delete;
+  json_arena& operator=(const json_arena&) = delete;
+
+  json_value make_array();
+  json_value make_object();
+  json_value make_string();
+  json_value make_string(const char*, size_t);
+  json_value make_binary(const char*, size_t);
+
+private:
+  struct block;
+
+  template <typename T, typename... Args> T* create(Args&&...);
+  void* allocate(size_t);
+
+  /* destroy a node created by an arena, and release its block */
+  template <typename T> static void destroy(T*);
+  static void release(void*);
+  static void unref(block*);
+
+  block* m_block;
+  size_t m_block_size;
+
+  friend class internals::valueimpl;
+};
+
+template <typename T> void json_arena::destroy(T* p)
+{
+  p->~T();
+  release(p);
+}
+
 std::ostream& operator<<(std::ostream&, const json_value&);
 
 /** Make a copy of 'src' and add to the array, returning a reference to the
@@ -419,6 +697,12 @@ json_value json_get_copy(
 std::string json_encode(const json_value& src);
 std::string json_encode_any(const json_value& src);
 
+/* As json_encode, but append the encoding to 'dest', so that a caller can
+ * reuse one output buffer across many encodings. If 'compact' is set, no
+ * space is written after ',' and ':' separators. */
+void json_encode(const json_value& src, std::vector<char>& dest,
+                 bool compact = false);
+
 /* Decode into 'dest' out parameters, which on legacy C++ reduces the amount of
  * memory being copied.
  */
@@ -428,6 +712,73 @@ void json_decode(json_value& dest, const char*);
 json_value json_decode(const char*, size_t);
 json_value json_decode(const char*);
 
+/* Decode, allocating the container and string nodes of the result from
+ * 'arena'. */
+json_value json_decode(const char*, size_t, json_arena& arena);
+
+/* Prefix decoding, for callers that need only the leading items of a top level
+ * array, such as the envelope of a message.  The items that are not decoded
+ * are still fully validated, and are described by a json_encoded_items, which
+ * refers to their encoded bytes within the source buffer.
+ *
+ * A json_prefix_fn is called with the first item of the array, once decoded,
+ * and returns the number of leading items to decode, which must be at least
+ * one. */
+struct json_encoded_items
+{
+  const char* ptr = nullptr; /* first undecoded item, within the source */
+  size_t len = 0;            /* bytes from the first to end of the last item */
+  std::vector<JSONType> types; /* type of each undecoded item */
+
+  size_t count() const { return types.size(); }
+};
+
+typedef size_t (*json_prefix_fn)(const json_value& first);
+
+json_value json_decode_prefix(const char*, size_t, json_prefix_fn,
+                              json_encoded_items& rest,
+                              json_arena* arena = nullptr);
+
+/* Event (SAX style) decoding, for callers that read only a few fields of a
+ * large value and so want to avoid building a json_value.  The decoder calls
+ * one handler method per scalar, and brackets each container with a start and
+ * end call; each object member is preceded by a call of key().
+ *
+ * Each method returns true to continue decoding, or false to stop, in which
+ * case the remainder of the input is not validated. String, binary and key
+ * data are valid only for the duration of the call.  The default methods
+ * ignore their event. */
+class json_event_handler
+{
+public:
+  virtual ~json_event_handler() {}
+
+  virtual bool null_value() { return true; }
+  virtual bool bool_value(bool) { return true; }
+  virtual bool int_value(json_int_t) { return true; }
+  virtual bool uint_value(json_uint_t) { return true; }
+  virtual bool real_value(double) { return true; }
+  virtual bool string_value(const char*, size_t) { return true; }
+  virtual bool binary_value(const unsigned char*, size_t) { return true; }
+  virtual bool key(const char*, size_t) { return true; }
+  virtual bool start_object() { return true; }
+  virtual bool end_object() { return true; }
+  virtual bool start_array() { return true; }
+  virtual bool end_array() { return true; }
+};
+
+/* Decode JSON as a sequence of events.  Returns true if all of the input was
+ * decoded, or false if the handler stopped the decode.  Malformed input throws,
+ * as for json_decode. */
+bool json_decode_events(const char*, size_t, json_event_handler&);
+
+/* Generate the events for an already decoded value, so that a handler can be
+ * used whether or not a value is still encoded. Returns false if the handler
+ * stopped the walk. */
+bool json_emit_events(const json_value&, json_event_handler&);
+bool json_emit_events(const json_array&, json_event_handler&);
+bool json_emit_events(const json_object&, json_event_handler&);
+
 // implementation of inline methods
 inline json_array& json_value::append_array()
 {
@@ -451,12 +802,39 @@ inline json_array& json_value::insert_array(const std::string& key)
 
 /* Decode a msgpack byte stream */
 json_value json_msgpack_decode(const char*, size_t);
+json_value json_msgpack_decode(const char*, size_t, json_arena& arena);
+json_value json_msgpack_decode_prefix(const char*, size_t, json_prefix_fn,
+                                      json_encoded_items& rest,
+                                      json_arena* arena = nullptr);
+
+/* Decode a msgpack byte stream as a sequence of events; see
+ * json_decode_events. */
+bool json_msgpack_decode_events(const char*, size_t, json_event_handler&);
 
 /* Encode to msgpack.  Returned memory region is managed by unique_ptr. */
 typedef std::pair<char*, size_t> region;
 std::unique_ptr<region, void (*)(region*)> json_msgpack_encode(
     const json_value& src);
 
+/* Encode to msgpack, appending to 'dest'. */
+void json_msgpack_encode(const json_value& src, std::vector<char>& dest);
+
+/* Decode a CBOR (RFC 7049) byte stream */
+json_value json_cbor_decode(const char*, size_t);
+json_value json_cbor_decode(const char*, size_t, json_arena& arena);
+json_value json_cbor_decode_prefix(const char*, size_t, json_prefix_fn,
+                                   json_encoded_items& rest,
+                                   json_arena* arena = nullptr);
+
+/* Decode a CBOR byte stream as a sequence of events; see json_decode_events. */
+bool json_cbor_decode_events(const char*, size_t, json_event_handler&);
+
+/* Encode to CBOR */
+std::vector<char> json_cbor_encode(const json_value& src);
+
+/* Encode to CBOR, appending to 'dest'. */
+void json_cbor_encode(const json_value& src, std::vector<char>& dest);
+
 } // namespace
 
 #endif
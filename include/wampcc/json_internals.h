@@ -57,6 +57,12 @@ struct traits<json_array>
   static const JSONType  TYPEID=eARRAY;
 };
 
+template <>
+struct traits<json_binary>
+{
+  static const JSONType  TYPEID=eBINARY;
+};
+
 
 class valueimpl
 {
@@ -71,19 +77,30 @@ private:
     e_double,
     e_signed,
     e_unsigned,
+    e_binary,
   } JSONDetailedType;
 
+  /* How the node of a pointer type is owned */
+  typedef enum
+  {
+    e_heap = 0, /* allocated by new, owned by this value */
+    e_pooled,   /* created by a json_arena, owned by this value */
+    e_shared,   /* frozen, reference counted and shared between values */
+  } NodeStorage;
+
 public:
 
 
   struct Details /* POD */
   {
     JSONDetailedType type;
+    NodeStorage storage; /* pointer types only */
     union
     {
       json_array*         array;
       json_object*        object;
       json_string*        string;
+      json_binary*        binary;
       wampcc::json_uint_t uint;
       wampcc::json_int_t  sint;
       double              real;
@@ -115,6 +132,14 @@ public:
   explicit valueimpl(json_array*);
   explicit valueimpl(json_object*);
   explicit valueimpl(json_string*);
+  explicit valueimpl(json_binary*);
+
+  /* Take ownership of a node created by a json_arena */
+  struct PooledConstructor {};
+  template <typename T> valueimpl(T* p, PooledConstructor) : valueimpl(p)
+  {
+    details.storage = e_pooled;
+  }
 
   JSONType json_type() const
   {
@@ -128,6 +153,7 @@ public:
       case valueimpl::e_signed : return eINTEGER;
       case valueimpl::e_unsigned : return eINTEGER;
       case valueimpl::e_double : return eREAL;
+      case valueimpl::e_binary : return eBINARY;
       default: return eNULL;
     }
   }
@@ -149,6 +175,8 @@ private:
         json_object& as_type(json_object*)        { return *details.data.object;  }
   const json_string& as_type(json_string*) const  { return *details.data.string;  }
         json_string& as_type(json_string*)        { return *details.data.string;  }
+  const json_binary& as_type(json_binary*) const  { return *details.data.binary;  }
+        json_binary& as_type(json_binary*)        { return *details.data.binary;  }
 
 public:
 
@@ -165,7 +193,11 @@ public:
   {
     const JSONType templtype=traits<T>::TYPEID;
     if ( templtype == this->json_type() )
+    {
+      if (details.storage == e_shared)
+        unshare();
       return as_type((T*) NULL);
+    }
     else
       throw type_mismatch(this->json_type(), templtype);
   }
@@ -204,6 +236,14 @@ public:
 
   valueimpl::Details clone_details() const;
 
+  /* Convert the node, and recursively its children, to shared storage */
+  void freeze();
+
+  bool is_frozen() const { return details.storage == e_shared; }
+
+  /* Replace a shared node with a private copy, prior to mutable access */
+  void unshare();
+
 
   template<typename T>
   bool is_integer() const
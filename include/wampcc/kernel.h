@@ -118,12 +118,25 @@ struct config
 {
   size_t socket_max_pending_write_bytes;
 
-  /** User function which gets invoked on the callback thread as soon as it
-   * begins. */
+  /** Socket backlog above which the events of conflating subscriptions are
+   * held back, each replaced by any later event of the same topic or key,
+   * rather than adding to the backlog. Should be less than
+   * socket_max_pending_write_bytes, at which a connection is dropped. */
+  size_t socket_conflation_threshold_bytes;
+
+  /** Number of threads over which a router's topics are sharded, by hash of
+   * the topic URI, so that publications to different topics are made in
+   * parallel.  Publications to one topic are always made in order, on the
+   * thread of its shard.  Zero, the default, makes publications on the
+   * callback thread. */
+  size_t pubsub_shard_threads;
+
+  /** User function which gets invoked on the callback thread, and on each
+   * pubsub shard thread, as soon as it begins. */
   std::function<void()> event_loop_start_fn;
 
-  /** User function which gets invoked on the callback thread just before the
-   * thread completes. */
+  /** User function which gets invoked on the callback thread, and on each
+   * pubsub shard thread, just before the thread completes. */
   std::function<void()> event_loop_end_fn;
 
   ssl_config ssl;
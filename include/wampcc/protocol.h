@@ -12,7 +12,9 @@
 
 #include <vector>
 #include <cstddef>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 
 namespace wampcc {
@@ -128,9 +130,43 @@ class codec
 public:
   virtual ~codec() {}
   virtual json_value decode(const char* ptr, size_t msglen) = 0;
-  virtual std::vector<char> encode(const json_array&) = 0;
+
+  /* Encode a message, appending its bytes to 'dest'. Any bytes already in
+   * 'dest', such as space reserved for a frame header, are left untouched. */
+  virtual void encode(const json_array&, std::vector<char>& dest) = 0;
+
+  std::vector<char> encode(const json_array& src)
+  {
+    std::vector<char> dest;
+    encode(src, dest);
+    return dest;
+  }
+
+  /* Decode the leading items of a message, as chosen by 'prefix', leaving the
+   * remaining items encoded; see json_decode_prefix. */
+  virtual json_value decode_prefix(const char* ptr, size_t msglen,
+                                   json_prefix_fn prefix,
+                                   json_encoded_items& rest) = 0;
+
+  /* Encode a message formed of 'head' followed by the items of 'tail'. When
+   * the tail has the same serialisation as this codec its bytes are copied
+   * unchanged, otherwise it is first decoded. */
+  virtual void encode(const json_array& head, const encoded_args& tail,
+                      std::vector<char>& dest);
+
   virtual serialiser_type type() const = 0;
   virtual const char* name() const = 0;
+
+  /* Serialisation of each individual message, ie, ignoring any batching */
+  virtual serialiser_type base_type() const { return type(); }
+
+  /* Invoke 'fn' for each message held in a transport message. Unbatched
+   * serialisers carry exactly one message per transport message. */
+  virtual void for_each_message(const char* ptr, size_t len,
+                                const std::function<void(const char*, size_t)>& fn)
+  {
+    fn(ptr, len);
+  }
 };
 
 namespace protocol_constants {
@@ -143,6 +179,52 @@ namespace protocol_constants {
   static const int default_max_missed_pings = 2;
 }
 
+/* A message to be sent to many sessions, such as an EVENT delivered to each
+ * subscriber of a topic.  Each protocol encodes and frames the message on first
+ * use, and keeps the bytes here, so that further sessions of the same
+ * serialisation and frame format only write them.  Refers to, rather than
+ * copies, the message, and is not thread safe. */
+class prepared_message
+{
+public:
+  enum class frame_format { none, rawsocket, websocket };
+
+  prepared_message(const json_array& msg, const encoded_args* tail = nullptr)
+    : m_msg(msg),
+      m_tail(tail)
+  {}
+
+  prepared_message(const prepared_message&) = delete;
+  prepared_message& operator=(const prepared_message&) = delete;
+
+  const json_array& message() const { return m_msg; }
+  const encoded_args* tail() const { return m_tail; }
+
+  /* Bytes previously stored for a serialisation and frame format, or null. */
+  const std::vector<char>* find(serialiser_type, frame_format) const;
+
+  /* Store bytes for a serialisation and frame format. The returned reference
+   * remains valid for the life of this object. */
+  const std::vector<char>& store(serialiser_type, frame_format,
+                                 std::vector<char> bytes);
+
+  /* Number of encodings made, ie, stored */
+  size_t encodings() const { return m_entries.size(); }
+
+private:
+  struct entry
+  {
+    serialiser_type serialiser;
+    frame_format format;
+    std::vector<char> bytes;
+  };
+
+  const json_array& m_msg;
+  const encoded_args* m_tail;
+  std::list<entry> m_entries;
+};
+
+
 /* Base class for encoding & decoding of bytes on the wire. */
 class protocol
 {
@@ -180,6 +262,13 @@ public:
     std::function<void(std::unique_ptr<protocol>&)> upgrade_protocol;
     std::function<void(std::chrono::milliseconds)>  request_timer;
     std::function<void(std::chrono::milliseconds)> protocol_closed;
+    std::function<void()> request_flush;
+
+    /* If set, the arguments of CALL, PUBLISH and YIELD messages are not
+     * decoded, and such messages are instead delivered via this callback,
+     * with their arguments still encoded. */
+    std::function<void(json_array, json_uint_t,
+                       std::shared_ptr<const encoded_args>)> deferred_args_msg;
   };
 
   typedef std::function<void(json_array msg,  json_uint_t msgtype)> t_msg_cb;
@@ -204,6 +293,22 @@ public:
 
   virtual void send_msg(const json_array& j) = 0;
 
+  /* Send a message formed of 'head' followed by still encoded arguments */
+  virtual void send_msg(const json_array& head, const encoded_args& tail) = 0;
+
+  /* Send a message shared with other sessions, reusing any encoding already
+   * made for this protocol's serialisation and framing. By default the message
+   * is encoded afresh. */
+  virtual void send_msg(prepared_message&);
+
+  /* Send several prepared messages, in order.  Protocols which can, write them
+   * to the socket together, in a single write. */
+  virtual void send_msg(std::vector<prepared_message*>&);
+
+  /* Write out any messages held back for batching. Protocols which batch
+   * messages use the request_flush callback to have this invoked soon after. */
+  virtual void flush() {}
+
   connect_mode mode() const { return m_mode; }
 
 protected:
@@ -214,7 +319,13 @@ protected:
   std::string fd() const;
 
   void decode(const char* ptr, size_t msglen);
-  std::vector<char> encode(const json_array&);
+  void decode_message(const char* ptr, size_t msglen);
+
+  /* Encode a message into 'dest', after first reserving 'headroom' bytes at
+   * the front, into which the caller can write its frame header in place. The
+   * message is 'ja', followed by the items of 'tail', if provided. */
+  void encode(const json_array& ja, const encoded_args* tail,
+              std::vector<char>& dest, size_t headroom);
 
   kernel* m_kernel;
   logger& __logger;
@@ -224,6 +335,11 @@ protected:
   buffer m_buf;
   std::shared_ptr<codec> m_codec;
 
+  /* Reusable output buffer for encoding outbound messages. Messages can be
+   * sent from any thread, so access must be under m_encode_lock. */
+  std::vector<char> m_encode_buf;
+  std::mutex m_encode_lock;
+
 private:
   connect_mode m_mode;
 };
@@ -261,6 +377,10 @@ public:
   {
     throw std::runtime_error("selector_protocol cannot send");
   }
+  void send_msg(const json_array&, const encoded_args&) override
+  {
+    throw std::runtime_error("selector_protocol cannot send");
+  }
   bool initiate_close() override { return false; }
 
   static size_t buffer_size_required();
@@ -12,14 +12,20 @@
 #include "wampcc/utils.h"
 #include "wampcc/json.h"
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 
 namespace wampcc
 {
 
 struct logger;
 class managed_topic;
+class pattern_trie;
+class prepared_message;
 class wamp_session;
 class kernel;
 
@@ -33,36 +39,92 @@ public:
   t_publication_id publish(std::string realm, std::string uri,
                            json_object options, wamp_args);
 
+  /* Publish several publications to topics of a realm */
+  std::vector<t_publication_id> publish_batch(const std::string& realm,
+                                              std::vector<publish_item>&);
+
   uint64_t subscribe(wamp_session* ptr, t_request_id, std::string uri,
                      json_object& options);
 
   void unsubscribe(wamp_session*, t_request_id, t_subscription_id);
 
-  void session_closed(session_handle sh);
+  /* Configure the retention of the events published to a topic */
+  void set_event_history(const std::string& realm, const std::string& uri,
+                         event_history_options);
+
+  /* Retained events of a subscription, or of a topic, for the event history
+   * meta procedures */
+  json_array get_events(const std::string& realm, t_subscription_id,
+                        size_t limit);
+  json_array get_history(const std::string& realm, const std::string& uri,
+                         size_t limit);
+
+  void session_closed(std::shared_ptr<wamp_session>&);
 
   json_array get_topics(const std::string& realm) const;
 
+  /* Number of threads the topics are sharded over; zero if publications are
+   * made on the calling thread */
+  size_t shard_threads() const { return m_shard_threads; }
+
+  /* Shard that owns a topic */
+  size_t shard_of(const std::string& uri) const;
+
+  /* Invoke a function on the thread of a shard.  Functions dispatched to a
+   * shard are invoked in order.  Only valid if shard_threads() is non-zero. */
+  void dispatch(size_t shard, std::function<void()>);
+
 private:
   pubsub_man(const pubsub_man&);            // no copy
   pubsub_man& operator=(const pubsub_man&); // no assignment
 
-  managed_topic* find_topic(const std::string& topic, const std::string& realm,
-                            bool allow_create);
+  std::shared_ptr<managed_topic> find_topic(const std::string& topic,
+                                            const std::string& realm,
+                                            bool allow_create);
+
+
+  std::shared_ptr<managed_topic> find_pattern(const std::string& pattern,
+                                              const std::string& match,
+                                              const std::string& realm);
 
+  void reclaim(const std::shared_ptr<managed_topic>&);
 
-  t_publication_id update_topic(const std::string& topic, const std::string& realm,
-                                json_object options, wamp_args args);
+  t_publication_id untracked_publication_id(const std::string& topic);
+
+  void match_patterns(const std::string& realm, const std::string& topic,
+                      std::vector<std::shared_ptr<managed_topic>>&);
+
+  void update_topic(managed_topic*, t_publication_id,
+                    const std::vector<std::shared_ptr<managed_topic>>& patterns,
+                    const std::string& topic,
+                    json_object options, wamp_args args);
+
+  static void fan_out(managed_topic*, prepared_message&);
+
+  void apply_patch(managed_topic*, const json_object& options, wamp_args&);
+  void fold_patches(managed_topic*);
+
+  json_array get_events(managed_topic*, size_t limit);
 
   logger& __logger; /* name chosen for log macros */
 
   mutable std::mutex m_lock;
 
-  typedef std::map<std::string, std::unique_ptr<managed_topic>> topic_registry;
+  typedef std::map<std::string, std::shared_ptr<managed_topic>> topic_registry;
   typedef std::map<std::string, topic_registry> realm_to_topicreg;
-  typedef std::map<t_subscription_id, managed_topic*> subscriptionid_registry;
-  realm_to_topicreg m_topics;
+  typedef std::map<t_subscription_id, std::shared_ptr<managed_topic>> subscriptionid_registry;
+  typedef std::map<t_session_id, std::set<t_subscription_id>> session_registry;
+  typedef std::map<std::string, std::unique_ptr<pattern_trie>> realm_to_patterns;
   t_subscription_id m_next_subscription_id;
   subscriptionid_registry m_subscription_registry;
+  session_registry m_session_subscriptions;
+
+  mutable std::mutex m_pattern_lock;
+  realm_to_patterns m_patterns;
+
+  struct shard;
+  size_t m_shard_threads;
+  std::vector<std::unique_ptr<shard>> m_shards;
 };
 
 } // namespace wampcc
@@ -45,7 +45,8 @@ public:
   {
     e_INVALID = 0,
     e_JSON    = 1,
-    e_MSGPACK = 2
+    e_MSGPACK = 2,
+    e_CBOR    = 3
   };
 
   struct options : public protocol::options
@@ -86,8 +87,14 @@ public:
   bool initiate_close() override { return false; }
   const char* name() const override { return NAME; }
   void send_msg(const json_array& j) override;
+  void send_msg(const json_array&, const encoded_args&) override;
+  void send_msg(prepared_message&) override;
+  void send_msg(std::vector<prepared_message*>&) override;
 
 private:
+  void send_encoded(const json_array&, const encoded_args*);
+  const std::vector<char>& prepared_frame(prepared_message&);
+
   static const int FRAME_MSG_LEN_MASK       = 0x00FFFFFF;
   static const int FRAME_RESERVED_MASK      = 0xF8000000;
   static const int FRAME_MSG_TYPE_MASK      = 0x07000000;
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_SIMD_H
+#define WAMPCC_SIMD_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace wampcc
+{
+
+/* Byte-processing routines used on the IO thread for inbound websocket
+ * frames. Each routine has scalar, SSE2 and AVX2 implementations; the widest
+ * one supported by the running CPU is selected on first use. */
+
+/** Apply a websocket masking key to 'len' bytes at 'data', in place. The key
+ * is applied starting at key offset zero, i.e. 'data' must be the start of a
+ * frame payload. */
+void simd_unmask(char* data, size_t len, const uint8_t (&key)[4]);
+
+/** Check that 'len' bytes at 'data' form well-formed UTF-8 (RFC 3629), i.e. no
+ * overlong encodings, no surrogates and no code points above U+10FFFF. */
+bool simd_is_valid_utf8(const char* data, size_t len);
+
+/** Name of the implementation selected for this CPU, eg "avx2"; for logging. */
+const char* simd_impl_name();
+
+/** The implementations, which can also be called directly, eg to test each on
+ * a CPU that would select a wider one. */
+enum class simd_level
+{
+  scalar,
+  sse2,
+  avx2
+};
+
+/** Whether an implementation is built for this target and supported by the
+ * running CPU; the scalar one always is. */
+bool simd_supported(simd_level);
+
+/** As above, using the given implementation, which must be supported; throws
+ * std::runtime_error otherwise. */
+void simd_unmask(simd_level, char* data, size_t len, const uint8_t (&key)[4]);
+bool simd_is_valid_utf8(simd_level, const char* data, size_t len);
+
+} // namespace wampcc
+
+#endif
@@ -131,6 +131,7 @@ public:
     static constexpr bool default_tcp_no_delay_enable = true;
     static constexpr bool default_keep_alive_enable = true;
     static constexpr std::chrono::seconds default_keep_alive_delay = std::chrono::seconds(60);
+    static constexpr bool default_cork_enable = false;
 
     /* Individual options */
     bool tcp_no_delay_enable;
@@ -138,6 +139,14 @@ public:
     bool keep_alive_enable;
     std::chrono::seconds keep_alive_delay;
 
+    /* Outbound write coalescing ("cork"). When enabled, bytes passed to
+     * write() are appended to a single contiguous buffer, which is handed to
+     * the IO thread once per event-loop tick, or once cork_window has elapsed
+     * if that is non-zero. Many small messages written in quick succession
+     * are then sent with a single socket write. */
+    bool cork_enable;
+    std::chrono::microseconds cork_window;
+
     options();
   };
 
@@ -222,6 +231,10 @@ public:
   size_t bytes_read() const { return m_bytes_read; }
   size_t bytes_written() const { return m_bytes_written; }
 
+  /** Return the number of bytes handed to the operating system for writing
+   * that it has not yet accepted, ie, the backlog of a slow peer. */
+  size_t bytes_pending_write() const { return m_bytes_pending_write; }
+
   /** Return the node name, as provided during the connect / listen call. */
   const std::string& node() const;
 
@@ -288,6 +301,8 @@ protected:
   std::string m_service;
 
 private:
+  struct cork_buffer;
+
   void close_impl();
 
   static const char * to_string(tcp_socket::socket_state);
@@ -296,6 +311,9 @@ private:
   void on_write_cb(uv_write_t*, int);
   void close_once_on_io();
   void do_write();
+  void cork_write(std::pair<const char*, size_t>*, size_t);
+  bool take_corked();
+  void uncork();
   void begin_close(bool no_linger = false);
   void do_listen(const std::string&, const std::string&, addr_family,
                  std::shared_ptr<std::promise<uverr>>);
@@ -320,6 +338,10 @@ private:
 
   std::shared_ptr<tcp_socket> m_self;
 
+  /* Coalesced writes, when cork_enable is set. Shared with the deferred flush
+   * requests, which may outlive this object. */
+  std::shared_ptr<cork_buffer> m_cork;
+
   /* Handler for creating a new instance when a socket is accepted. */
   acceptor_fn_t m_accept_fn;
 
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_TYPED_ARGS_H
+#define WAMPCC_TYPED_ARGS_H
+
+#include "wampcc/types.h"
+#include "wampcc/json.h"
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace wampcc
+{
+
+/* Conversion between a C++ type and a json_value, used to bind the arguments
+ * of the typed forms of wamp_router::callable, wamp_session::provide and
+ * wamp_session::subscribe.  Conversions are provided for bool, the arithmetic
+ * types, std::string, std::vector and the json types.  An application binds
+ * its own type by specialising json_convert, providing:
+ *
+ *   static T from_json(const json_value&);
+ *   static json_value to_json(const T&);
+ *
+ * from_json should throw a wamp_error with WAMP_ERROR_INVALID_ARGUMENT when a
+ * value cannot be converted; see json_convert_error. */
+template <typename T, typename Enable = void>
+struct json_convert;
+
+inline wamp_error json_convert_error(const char* expected)
+{
+  return wamp_error(WAMP_ERROR_INVALID_ARGUMENT,
+                    std::string("argument type mismatch, expected ") + expected);
+}
+
+template <>
+struct json_convert<bool>
+{
+  static bool from_json(const json_value& jv)
+  {
+    if (!jv.is_bool())
+      throw json_convert_error("bool");
+    return jv.as_bool();
+  }
+  static json_value to_json(bool b) { return json_value::make_bool(b); }
+};
+
+template <typename T>
+struct json_convert<T, typename std::enable_if<std::is_integral<T>::value &&
+                                               !std::is_same<T, bool>::value>::type>
+{
+  static T from_json(const json_value& jv)
+  {
+    if (jv.is_int() && internals::is_integer<T>(jv.as_int()))
+      return (T) jv.as_int();
+    if (jv.is_uint() && internals::is_integer<T>(jv.as_uint()))
+      return (T) jv.as_uint();
+    throw json_convert_error("integer in range");
+  }
+  static json_value to_json(T v)
+  {
+    return std::is_signed<T>::value ? json_value::make_int(v)
+                                    : json_value::make_uint(v);
+  }
+};
+
+template <typename T>
+struct json_convert<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+  static T from_json(const json_value& jv)
+  {
+    if (jv.is_real())
+      return (T) jv.as_real();
+    if (jv.is_int())
+      return (T) jv.as_int();
+    if (jv.is_uint())
+      return (T) jv.as_uint();
+    throw json_convert_error("number");
+  }
+  static json_value to_json(T v) { return json_value::make_double(v); }
+};
+
+template <>
+struct json_convert<std::string>
+{
+  static std::string from_json(const json_value& jv)
+  {
+    if (!jv.is_string())
+      throw json_convert_error("string");
+    return jv.as_string();
+  }
+  static json_value to_json(const std::string& s)
+  {
+    return json_value::make_string(s);
+  }
+};
+
+template <>
+struct json_convert<json_value>
+{
+  static json_value from_json(const json_value& jv) { return jv; }
+  static json_value to_json(const json_value& jv) { return jv; }
+};
+
+template <>
+struct json_convert<json_array>
+{
+  static json_array from_json(const json_value& jv)
+  {
+    if (!jv.is_array())
+      throw json_convert_error("array");
+    return jv.as_array();
+  }
+  static json_value to_json(const json_array& ja) { return ja; }
+};
+
+template <>
+struct json_convert<json_object>
+{
+  static json_object from_json(const json_value& jv)
+  {
+    if (!jv.is_object())
+      throw json_convert_error("object");
+    return jv.as_object();
+  }
+  static json_value to_json(const json_object& jo) { return jo; }
+};
+
+template <typename T>
+struct json_convert<std::vector<T>>
+{
+  static std::vector<T> from_json(const json_value& jv)
+  {
+    if (!jv.is_array())
+      throw json_convert_error("array");
+    std::vector<T> dest;
+    dest.reserve(jv.as_array().size());
+    for (auto& item : jv.as_array())
+      dest.push_back(json_convert<T>::from_json(item));
+    return dest;
+  }
+  static json_value to_json(const std::vector<T>& src)
+  {
+    json_value jv = json_value::make_array();
+    json_array& ja = jv.as_array();
+    ja.reserve(src.size());
+    for (auto& item : src)
+      ja.push_back(json_convert<T>::to_json(item));
+    return jv;
+  }
+};
+
+
+namespace typed_args_detail
+{
+  template <size_t...> struct index_list {};
+
+  template <size_t N, size_t... Is>
+  struct make_index_list : make_index_list<N - 1, N - 1, Is...> {};
+
+  template <size_t... Is>
+  struct make_index_list<0, Is...> { typedef index_list<Is...> type; };
+
+  template <typename T>
+  using convert = json_convert<typename std::decay<T>::type>;
+}
+
+/* Invoke a function with its parameters converted from the items of a
+ * json_array, which must hold exactly one item per parameter.  The conversions
+ * are expanded at compile time, so a handler need not walk the array. */
+template <typename... Args>
+struct typed_args
+{
+  template <typename F>
+  static auto apply(F& fn, const json_array& ja)
+    -> decltype(fn(std::declval<Args>()...))
+  {
+    if (ja.size() != sizeof...(Args))
+      throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT,
+                       "expected " + std::to_string(sizeof...(Args)) +
+                       " arguments, received " + std::to_string(ja.size()));
+    return apply(fn, ja,
+                 typename typed_args_detail::make_index_list<sizeof...(Args)>::type());
+  }
+
+private:
+  template <typename F, size_t... Is>
+  static auto apply(F& fn, const json_array& ja,
+                    typed_args_detail::index_list<Is...>)
+    -> decltype(fn(std::declval<Args>()...))
+  {
+    (void) ja; /* unused when there are no parameters */
+    return fn(typed_args_detail::convert<Args>::from_json(ja[Is])...);
+  }
+};
+
+/* As typed_args, for a function signature, with the returned value converted
+ * to a json_array suitable for a RESULT or YIELD message. A void function
+ * gives an empty array. */
+template <typename Sig>
+struct typed_signature;
+
+template <typename R, typename... Args>
+struct typed_signature<R(Args...)>
+{
+  template <typename F>
+  static json_array invoke(F& fn, const json_array& ja)
+  {
+    return json_array{
+      typed_args_detail::convert<R>::to_json(typed_args<Args...>::apply(fn, ja))};
+  }
+};
+
+template <typename... Args>
+struct typed_signature<void(Args...)>
+{
+  template <typename F>
+  static json_array invoke(F& fn, const json_array& ja)
+  {
+    typed_args<Args...>::apply(fn, ja);
+    return json_array();
+  }
+};
+
+} // namespace wampcc
+
+#endif
@@ -10,8 +10,10 @@
 
 #include "wampcc/json.h"
 
+#include <chrono>
 #include <functional>
 #include <mutex>
+#include <stdexcept>
 #include <string>
 #include <memory>
 #include <stdint.h>
@@ -54,12 +56,16 @@ namespace wampcc
 #define WAMP_WAMPCRA "wampcra"
 #define WAMP_TICKET "ticket"
 #define WAMP_ACKNOWLEDGE "acknowledge"
+#define WAMP_GET_RETAINED "get_retained"
+#define WAMP_CONFLATE "conflate"
 #define WAMP_ANONYMOUS "anonymous"
 
 // Protocol defined services
 #define WAMP_REFLECTION_TOPIC_LIST "wamp.reflection.topic.list"
 #define WAMP_REFLECTION_PROCEDURE_LIST "wamp.reflection.procedure.list"
 #define WAMP_REFLECTION_ERROR_LIST "wamp.reflection.error.list"
+#define WAMP_SUBSCRIPTION_GET_EVENTS "wamp.subscription.get_events"
+#define WAMP_TOPIC_HISTORY_LAST "wamp.topic.history.last"
 
   enum msg_type
   {
@@ -100,18 +106,111 @@ typedef uint64_t t_registration_id;
 class wamp_session;
 typedef std::weak_ptr<wamp_session> session_handle;
 
+struct encoded_args;
+
 struct wamp_args
 {
   json_array  args_list;
   json_object args_dict;
 
-  bool operator==(const wamp_args& rhs) const {
-    return (args_list == rhs.args_list) && (args_dict == rhs.args_dict);
+  /* Arguments still in the encoding in which they were received, set only
+   * when a router forwards them without inspection; see
+   * wamp_session::options::defer_args_decode.  While set, args_list and
+   * args_dict are empty; decode() populates them. */
+  std::shared_ptr<const encoded_args> encoded;
+
+  /* Decode any still encoded arguments into args_list and args_dict. */
+  void decode();
+
+  /* Report the arguments to an event handler, as an array holding Arguments
+   * and, if present, ArgumentsKw.  Arguments still encoded are read without
+   * being decoded into args_list and args_dict, so a handler that needs only a
+   * few fields of a large payload avoids building it.  Returns false if the
+   * handler stopped early; see json_decode_events. */
+  bool decode_events(json_event_handler&) const;
+
+  /* Freeze each argument, so that copies of these args, such as those taken
+   * when an event or call is forwarded, share rather than copy the payload;
+   * see json_value::freeze. */
+  void freeze()
+  {
+    for (auto & item : args_list)
+      item.freeze();
+    for (auto & item : args_dict)
+      item.second.freeze();
   }
 
-  bool operator!=(const wamp_args& rhs) const {
-    return (args_list != rhs.args_list) || (args_dict != rhs.args_dict);
+  /* Compare the arguments by value; arguments still encoded are compared as
+   * if decoded. */
+  bool operator==(const wamp_args& rhs) const;
+
+  bool operator!=(const wamp_args& rhs) const { return !(*this == rhs); }
+};
+
+/* Retention of the events published to a topic; see
+ * wamp_router::set_event_history.  Events are retained up to max_events in
+ * number, and for up to max_age; a zero value places no limit of that kind,
+ * and if both are zero no events are retained. */
+struct event_history_options
+{
+  size_t max_events = 0;
+  std::chrono::milliseconds max_age {0};
+};
+
+/* One publication of a batch; see wamp_router::publish_batch and
+ * wamp_session::publish_batch. */
+struct publish_item
+{
+  std::string uri;
+  json_object options;
+  wamp_args args;
+};
+
+/* Represent a WAMP protocol error that is associated with an error URI.  Can
+   optionally contain an error reason, to provide context to the error.  The URI
+   component of this error shall be communicated to the peer.  The reason, if
+   present, can be communicated within an error details JSON object.
+*/
+class wamp_error : public std::runtime_error
+{
+public:
+
+  /* Construct an instance using a WAMP protocol error URI */
+  wamp_error(std::string error_uri, wamp_args wa = {})
+    : std::runtime_error(error_uri),
+      m_uri(std::move(error_uri)),
+      m_args(std::move(wa))
+  {  }
+
+  /* Construct an instance using a WAMP protocol error URI together with
+   * additional reason message */
+  wamp_error(std::string error_uri, std::string reason, wamp_args wa = {})
+    : std::runtime_error(std::string(error_uri).append(": ").append(reason)),
+      m_uri(std::move(error_uri)),
+      m_reason(std::move(reason)),
+      m_args(std::move(wa))
+  {
+    /* Note, an advantage of building the 'what' string during this constructor
+     * is that following successful construction, the object then behaves like a
+     * regular type.  If we were to defer the building of the what string to an
+     * overridden 'what' method, we would have synchronisation concerns. */
+  }
+
+  wamp_args& args() { return m_args; }
+  const wamp_args& args() const { return m_args; }
+  const std::string & reason() const {return m_reason;}
+  const std::string & error_uri() const { return m_uri; }
+
+  /* Obtain a json_object containing the error reason that is suitable for use
+   * with WAMP ERROR message */
+  json_object details() const {
+    return json_object { {WAMP_ERROR_REASON_KEY, m_reason} };
   }
+
+private:
+  std::string m_uri;
+  std::string m_reason;
+  wamp_args m_args;
 };
 
 /* Represent the mode of a socket or wamp connection */
@@ -121,17 +220,39 @@ enum class connect_mode
   passive
 };
 
-/* Bit-flags for message serialisation types supported by WAMP */
+/* Bit-flags for message serialisation types supported by WAMP. The batched
+ * variants pack several WAMP messages into one transport message, and are
+ * only available with websocket. */
 enum class serialiser_type
 {
   none = 0x00,
   json = 0x01,
-  msgpack = 0x02
+  msgpack = 0x02,
+  json_batched = 0x04,
+  msgpack_batched = 0x08,
+  cbor = 0x10
 };
 
 constexpr int all_serialisers =
   static_cast<int>(serialiser_type::json) |
-  static_cast<int>(serialiser_type::msgpack);
+  static_cast<int>(serialiser_type::msgpack) |
+  static_cast<int>(serialiser_type::json_batched) |
+  static_cast<int>(serialiser_type::msgpack_batched) |
+  static_cast<int>(serialiser_type::cbor);
+
+/* The Arguments and ArgumentsKw items of a received WAMP message, in their
+ * original encoding.  'bytes' holds the items wrapped as a complete encoded
+ * array, so that they can be decoded on their own, while the items themselves
+ * occupy [items_begin, items_end), so that they can be spliced unchanged into
+ * an outbound message of the same serialisation. */
+struct encoded_args
+{
+  serialiser_type serialiser; /* json, msgpack or cbor */
+  std::vector<char> bytes;
+  size_t items_begin;
+  size_t items_end;
+  size_t count; /* 1 for Arguments only, 2 when ArgumentsKw follows */
+};
 
 /* Bit-flags for supported protocols */
 enum class protocol_type
@@ -128,6 +128,20 @@ public:
   void publish(const std::string& realm, const std::string& uri,
                const json_object& options, wamp_args args);
 
+  /** Publish several items to internal topics.  The batch is dispatched to
+   * the event loop as a single task, and each subscriber's events are written
+   * to it together.  If pubsub is sharded over threads, the batch is split,
+   * and each shard's part is published as a batch on its thread. */
+  void publish_batch(const std::string& realm, std::vector<publish_item> items);
+
+  /** Retain the events subsequently published to a topic, up to a count or an
+   * age, so that they can be replayed to subscribers that pass the
+   * get_retained option, and queried with the wamp.subscription.get_events
+   * and wamp.topic.history.last meta procedures.  A default constructed
+   * event_history_options stops retention. */
+  void set_event_history(const std::string& realm, const std::string& uri,
+                         event_history_options options);
+
   /** Associate a callback function with a procedure uri.  The callback is
    * called when a CALL request is received for the procedure.  The callback
    * should reply to the caller with a RESULT or ERROR message. */
@@ -136,6 +150,25 @@ public:
                 on_call_fn,
                 void * user = nullptr);
 
+  /** As callable, but with the arguments of each CALL converted to the
+   * parameter types of the signature `Sig`, and the value returned by `fn`
+   * sent in the RESULT, eg, `callable<double(int, std::string)>(...)`.
+   * Arguments that do not convert are replied to with an ERROR; see
+   * json_convert. */
+  template <typename Sig, typename F>
+  void callable(const std::string& realm,
+                const std::string& uri,
+                F fn,
+                void * user = nullptr)
+  {
+    callable(realm, uri,
+             [fn](wamp_router&, wamp_session& caller, call_info info) mutable {
+               caller.result(info.request_id,
+                             typed_signature<Sig>::invoke(fn, info.args.args_list));
+             },
+             user);
+  }
+
 private:
   void rpc_registered_cb(const rpc_details&);
   void handle_inbound_call(wamp_session*,t_request_id,std::string&,
@@ -9,11 +9,14 @@
 #define WAMPCC_SESSION_H
 
 #include "wampcc/types.h"
+#include "wampcc/typed_args.h"
 #include "wampcc/protocol.h"
 #include "wampcc/error.h"
 #include "wampcc/json.h"
 #include "wampcc/tcp_socket.h"
 
+#include <atomic>
+#include <list>
 #include <map>
 #include <mutex>
 #include <memory>
@@ -381,54 +384,6 @@ struct invocation_info
 typedef std::function<void(wamp_session&,
                            invocation_info)> on_invocation_fn;
 
-/* Represent a WAMP protocol error that is associated with an error URI.  Can
-   optionally contain an error reason, to provide context to the error.  The URI
-   component of this error shall be communicated to the peer.  The reason, if
-   present, can be communicated within an error details JSON object.
-*/
-class wamp_error : public std::runtime_error
-{
-public:
-
-  /* Construct an instance using a WAMP protocol error URI */
-  wamp_error(std::string error_uri, wamp_args wa = {})
-    : std::runtime_error(error_uri),
-      m_uri(std::move(error_uri)),
-      m_args(std::move(wa))
-  {  }
-
-  /* Construct an instance using a WAMP protocol error URI together with
-   * additional reason message */
-  wamp_error(std::string error_uri, std::string reason, wamp_args wa = {})
-    : std::runtime_error(std::string(error_uri).append(": ").append(reason)),
-      m_uri(std::move(error_uri)),
-      m_reason(std::move(reason)),
-      m_args(std::move(wa))
-  {
-    /* Note, an advantage of building the 'what' string during this constructor
-     * is that following successful construction, the object then behaves like a
-     * regular type.  If we were to defer the building of the what string to an
-     * overridden 'what' method, we would have synchronisation concerns. */
-  }
-
-  wamp_args& args() { return m_args; }
-  const wamp_args& args() const { return m_args; }
-  const std::string & reason() const {return m_reason;}
-  const std::string & error_uri() const { return m_uri; }
-
-  /* Obtain a json_object containing the error reason that is suitable for use
-   * with WAMP ERROR message */
-  json_object details() const {
-    return json_object { {WAMP_ERROR_REASON_KEY, m_reason} };
-  }
-
-private:
-  std::string m_uri;
-  std::string m_reason;
-  wamp_args m_args;
-};
-
-
 /**
    Provides a WAMP session that supports both client and server roles.
 
@@ -501,8 +456,20 @@ public:
      * suppresses this check. */
     std::chrono::milliseconds max_pending_open;
 
+    /* Leave the arguments of inbound CALL, PUBLISH and YIELD messages encoded,
+     * so that a router can forward them to a peer of the same serialisation
+     * without decoding and re-encoding them.  The wamp_args delivered to the
+     * server_msg_handler then carry the encoded form; see
+     * wamp_args::decode.
+     *
+     * On a client session, the arguments of inbound EVENT messages are
+     * likewise left encoded, so that a subscriber can read them with
+     * wamp_args::decode_events, or decode them with wamp_args::decode. */
+    bool defer_args_decode;
+
     options()
-      : max_pending_open(30000) {}
+      : max_pending_open(30000),
+        defer_args_decode(false) {}
   };
 
   enum class mode {client, server};
@@ -632,6 +599,26 @@ public:
                        on_invocation_fn,
                        void * user = nullptr);
 
+  /** As provide, but with the arguments of each INVOCATION converted to the
+   * parameter types of the signature `Sig`, and the value returned by `fn`
+   * sent in the YIELD, eg, `provide<double(int, std::string)>(...)`.
+   * Arguments that do not convert are replied to with an ERROR; see
+   * json_convert. */
+  template <typename Sig, typename F>
+  t_request_id provide(const std::string& uri,
+                       json_object options,
+                       on_registered_fn registered_cb,
+                       F fn,
+                       void * user = nullptr)
+  {
+    return provide(uri, std::move(options), std::move(registered_cb),
+                   [fn](wamp_session& ws, invocation_info info) mutable {
+                     ws.yield(info.request_id,
+                              typed_signature<Sig>::invoke(fn, info.args.args_list));
+                   },
+                   user);
+  }
+
   /** Unregister a procedure. Allow a callee to request the unregister of a
    * previously registered procedure. The success or failure of the unregister
    * attempt is delivered via the callback function argument.*/
@@ -655,6 +642,25 @@ public:
                          on_event_fn,
                          void * user = nullptr);
 
+  /** As subscribe, but with the arguments of each EVENT converted to the types
+   * `T, Ts...` and passed to `fn`, eg, `subscribe<quote>(...)`.  Events with
+   * arguments that do not convert are logged and discarded; see
+   * json_convert. */
+  template <typename T, typename... Ts, typename F>
+  t_request_id subscribe(const std::string& uri,
+                         json_object options,
+                         on_subscribed_fn subscribed_cb,
+                         F fn,
+                         void * user = nullptr)
+  {
+    return subscribe(uri, std::move(options), std::move(subscribed_cb),
+                     [fn](wamp_session&, event_info info) mutable {
+                       info.args.decode();
+                       typed_args<T, Ts...>::apply(fn, info.args.args_list);
+                     },
+                     user);
+  }
+
   /** Unsubscribe a subscription. The subscription is identified via its WAMP
    * subscription ID.  The unsubscribed_cb callback is invoked upon success or
    * failure of the request. */
@@ -682,6 +688,14 @@ public:
                        on_published_fn = nullptr,
                        void * user = nullptr);
 
+  /** Publish several items, as for publish, with the PUBLISH messages written
+   * to the router together.  The response to each is delivered via the
+   * on_published_fn function, if not empty.  Returns the request ID of each
+   * item, in order. */
+  std::vector<t_request_id> publish_batch(std::vector<publish_item> items,
+                                          on_published_fn = nullptr,
+                                          void * user = nullptr);
+
   /** Allow a broker application to send an EVENT message. */
   void event(t_subscription_id, t_publication_id, json_object details, wamp_args args);
 
@@ -761,6 +775,11 @@ public:
   void result(t_request_id, json_object details, json_array, json_object);
   //@}
 
+  /** Reply to a CALL request with a RESULT message, taking the arguments
+   * from a wamp_args, which may still be encoded, such as those of a YIELD
+   * being forwarded by a router. */
+  void result_args(t_request_id, json_object details, wamp_args);
+
   //@{
   /** Reply to a CALL request with an ERROR message to indicate failure. */
   void call_error(t_request_id, std::string error);
@@ -871,12 +890,22 @@ private:
   void io_on_read(char*, size_t);
   void io_on_error(uverr);
   void decode_and_process(char*, size_t len);
-  void process_message(json_array&, json_uint_t);
+  void process_message(json_array&, json_uint_t,
+                       std::shared_ptr<const encoded_args> = {});
   void handle_exception();
 
   void update_state_for_outbound(const json_array& msg);
 
-  void send_msg(const json_array&);
+  void send_msg(const json_array&, const encoded_args* tail = nullptr);
+  void send_msg(prepared_message&);
+  void send_msg(std::vector<prepared_message*>&);
+
+  /* Conflation of the EVENTs of a subscription while the socket is backlogged;
+   * see the pubsub_man subscribe option "conflate". */
+  void conflate_subscription(t_subscription_id, std::string key);
+  void unconflate_subscription(t_subscription_id);
+  bool conflate(prepared_message&);
+  std::chrono::milliseconds drain_conflated();
 
   void upgrade_protocol(std::unique_ptr<protocol>&);
 
@@ -963,12 +992,12 @@ private:
   void process_inbound_subscribed(json_array &);
   void process_inbound_unsubscribed(json_array &);
   void process_inbound_published(json_array &);
-  void process_inbound_event(json_array &);
+  void process_inbound_event(json_array &, std::shared_ptr<const encoded_args>);
   void process_inbound_result(json_array &);
   void process_inbound_error(json_array &);
-  void process_inbound_call(json_array &);
-  void process_inbound_yield(json_array &);
-  void process_inbound_publish(json_array &);
+  void process_inbound_call(json_array &, std::shared_ptr<const encoded_args>);
+  void process_inbound_yield(json_array &, std::shared_ptr<const encoded_args>);
+  void process_inbound_publish(json_array &, std::shared_ptr<const encoded_args>);
   void process_inbound_subscribe(json_array &);
   void process_inbound_unsubscribe(json_array &);
   void process_inbound_goodbye(json_array &);
@@ -1028,6 +1057,24 @@ private:
 
   std::unique_ptr<protocol> m_proto;
 
+  /* An EVENT held back from a backlogged socket, until replaced by a later
+   * EVENT of the same conflation key, or until the backlog has cleared. */
+  struct conflated_event
+  {
+    std::string key;
+    json_array msg;
+    std::shared_ptr<const encoded_args> tail;
+  };
+
+  /* Conflated subscriptions, mapped to the ArgumentsKw field, if any, that
+   * further divides their events, and the held EVENTs in arrival order. */
+  std::mutex m_conflation_lock;
+  std::atomic<bool> m_has_conflation;
+  std::map<t_subscription_id, std::string> m_conflated_subscriptions;
+  std::list<conflated_event> m_conflated_events;
+  std::map<std::string, std::list<conflated_event>::iterator> m_conflated_index;
+  bool m_conflation_drain_scheduled = false;
+
   std::promise< void > m_promise_on_open;
 
   /* Track if session has been WELCOMEd. */
@@ -26,6 +26,7 @@
 #include "wampcc/socket_address.h"
 #include "wampcc/ssl_socket.h"
 #include "wampcc/tcp_socket.h"
+#include "wampcc/typed_args.h"
 #include "wampcc/types.h"
 #include "wampcc/wamp_router.h"
 #include "wampcc/wamp_session.h"
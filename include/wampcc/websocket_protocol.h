@@ -51,10 +51,17 @@ public:
   static constexpr const char* NAME = "websocket";
 
   static constexpr const int    HEADER_SIZE = 4; /* "GET " */
+  static constexpr const int    MAX_FRAME_HEADER_SIZE = 14;
   static constexpr const char*  MAGIC = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
   static constexpr const char* WAMPV2_JSON_SUBPROTOCOL = "wamp.2.json";
   static constexpr const char* WAMPV2_MSGPACK_SUBPROTOCOL = "wamp.2.msgpack";
+  static constexpr const char* WAMPV2_JSON_BATCHED_SUBPROTOCOL = "wamp.2.json.batched";
+  static constexpr const char* WAMPV2_MSGPACK_BATCHED_SUBPROTOCOL = "wamp.2.msgpack.batched";
+  static constexpr const char* WAMPV2_CBOR_SUBPROTOCOL = "wamp.2.cbor";
+
+  /* Batched messages are flushed early once a batch reaches this size */
+  static constexpr size_t MAX_BATCH_SIZE = 65536;
 
   static constexpr const char* RFC6455 = "13";
 
@@ -67,10 +74,14 @@ public:
 
   const char* name() const override { return NAME; }
   void send_msg(const json_array& j) override;
+  void send_msg(const json_array&, const encoded_args&) override;
+  void send_msg(prepared_message&) override;
+  void send_msg(std::vector<prepared_message*>&) override;
+  void flush() override;
 
 private:
 
-  void process_frame_bytes(buffer::read_pointer&);
+  bool process_frame_bytes(buffer::read_pointer&);
 
   const std::string& header_field(const char*) const;
 
@@ -82,6 +93,11 @@ private:
   void send_pong(const std::string& payload = {});
   void send_close(uint16_t, const std::string&);
   void send_impl(const websocketpp_msg&);
+  void send_data_frame(std::vector<char>&, size_t headroom);
+  void send_encoded(const json_array&, const encoded_args*);
+  const std::vector<char>& prepared_bytes(prepared_message&,
+                                          prepared_message::frame_format);
+  void append_batch(const std::vector<char>**, size_t);
 
   // TODO: add the mutex
   enum class state
@@ -107,6 +123,18 @@ private:
   std::chrono::time_point<std::chrono::steady_clock> m_last_pong;
 
   std::atomic<int> m_missed_pings;
+
+  /* Set while a fragmented data message is being assembled by websocketpp, in
+   * which case frames cannot take the unfragmented fast path. */
+  bool m_in_fragmented_msg;
+
+  /* Encoded messages awaiting flush, when using a batched serialiser. The
+   * front of the buffer is reserved for the frame header. */
+  std::vector<char> m_batch;
+  std::mutex m_batch_lock;
+
+  /* Source of masking keys for client frames; guarded by m_encode_lock */
+  std::mt19937 m_mask_rng;
 };
 
 
@@ -0,0 +1,632 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "cbor_serialiser.h"
+
+#include <cmath>
+#include <limits>
+
+#include <string.h>
+
+namespace wampcc
+{
+
+/* CBOR major types */
+static const uint8_t major_uint = 0;
+static const uint8_t major_negint = 1;
+static const uint8_t major_bytes = 2;
+static const uint8_t major_text = 3;
+static const uint8_t major_array = 4;
+static const uint8_t major_map = 5;
+static const uint8_t major_tag = 6;
+static const uint8_t major_simple = 7;
+
+/* additional-information values */
+static const uint8_t info_uint8 = 24;
+static const uint8_t info_uint16 = 25;
+static const uint8_t info_uint32 = 26;
+static const uint8_t info_uint64 = 27;
+static const uint8_t info_indefinite = 31;
+
+/* major type 7 values */
+static const uint8_t simple_false = 20;
+static const uint8_t simple_true = 21;
+static const uint8_t simple_null = 22;
+static const uint8_t simple_undefined = 23;
+static const uint8_t simple_half = 25;
+static const uint8_t simple_float = 26;
+static const uint8_t simple_double = 27;
+static const uint8_t simple_break = 31;
+
+/* guard against stack exhaustion from hostile input */
+static const int max_depth = 512;
+
+
+void cbor_encoder::put_head(uint8_t major, uint64_t arg)
+{
+  char buf[9];
+  size_t len;
+  const uint8_t mt = major << 5;
+
+  if (arg < info_uint8) {
+    buf[0] = mt | (uint8_t) arg;
+    len = 1;
+  } else if (arg <= 0xFF) {
+    buf[0] = mt | info_uint8;
+    buf[1] = (char) arg;
+    len = 2;
+  } else if (arg <= 0xFFFF) {
+    buf[0] = mt | info_uint16;
+    buf[1] = (char)(arg >> 8);
+    buf[2] = (char) arg;
+    len = 3;
+  } else if (arg <= 0xFFFFFFFF) {
+    buf[0] = mt | info_uint32;
+    for (int i = 0; i < 4; i++)
+      buf[1 + i] = (char)(arg >> (24 - 8 * i));
+    len = 5;
+  } else {
+    buf[0] = mt | info_uint64;
+    for (int i = 0; i < 8; i++)
+      buf[1 + i] = (char)(arg >> (56 - 8 * i));
+    len = 9;
+  }
+
+  m_dest.insert(m_dest.end(), buf, buf + len);
+}
+
+
+void cbor_encoder::put_string(uint8_t major, const std::string& s)
+{
+  put_head(major, s.size());
+  m_dest.insert(m_dest.end(), s.begin(), s.end());
+}
+
+
+void cbor_encoder::put_bytes(const json_binary& b)
+{
+  put_head(major_bytes, b.size());
+  m_dest.insert(m_dest.end(), b.begin(), b.end());
+}
+
+
+void cbor_encoder::put_double(double d)
+{
+  char buf[9];
+  float f = (float) d;
+
+  if ((double) f == d) {
+    /* single precision is sufficient for an exact round trip */
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    buf[0] = (major_simple << 5) | simple_float;
+    for (int i = 0; i < 4; i++)
+      buf[1 + i] = (char)(bits >> (24 - 8 * i));
+    m_dest.insert(m_dest.end(), buf, buf + 5);
+  } else {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    buf[0] = (major_simple << 5) | simple_double;
+    for (int i = 0; i < 8; i++)
+      buf[1 + i] = (char)(bits >> (56 - 8 * i));
+    m_dest.insert(m_dest.end(), buf, buf + 9);
+  }
+}
+
+
+void cbor_encoder::encode(const json_value& jv)
+{
+  switch (jv.type()) {
+    case wampcc::eNULL:
+      m_dest.push_back((char)((major_simple << 5) | simple_null));
+      break;
+    case wampcc::eBOOL:
+      m_dest.push_back(
+          (char)((major_simple << 5) | (jv.as_bool() ? simple_true : simple_false)));
+      break;
+    case wampcc::eREAL:
+      put_double(jv.as_real());
+      break;
+    case wampcc::eINTEGER: {
+      if (jv.is_uint())
+        put_head(major_uint, jv.as_uint());
+      else {
+        int64_t v = jv.as_int();
+        if (v >= 0)
+          put_head(major_uint, (uint64_t) v);
+        else
+          put_head(major_negint, (uint64_t)(-1 - v));
+      }
+      break;
+    }
+    case wampcc::eSTRING:
+      put_string(major_text, jv.as_string());
+      break;
+    case wampcc::eBINARY:
+      put_bytes(jv.as_binary());
+      break;
+    case wampcc::eARRAY: {
+      const json_array& ja = jv.as_array();
+      put_head(major_array, ja.size());
+      for (auto& item : ja)
+        encode(item);
+      break;
+    }
+    case wampcc::eOBJECT: {
+      const json_object& jo = jv.as_object();
+      put_head(major_map, jo.size());
+      for (auto& item : jo) {
+        put_string(major_text, item.first);
+        encode(item.second);
+      }
+      break;
+    }
+  }
+}
+
+
+cbor_decoder::cbor_decoder(const char* ptr, size_t len, json_arena* arena)
+  : m_ptr((const uint8_t*) ptr),
+    m_end((const uint8_t*) ptr + len),
+    m_start((const uint8_t*) ptr),
+    m_arena(arena)
+{
+}
+
+
+json_value cbor_decoder::make_object()
+{
+  return m_arena ? m_arena->make_object() : json_value::make_object();
+}
+
+
+json_value cbor_decoder::make_array()
+{
+  return m_arena ? m_arena->make_array() : json_value::make_array();
+}
+
+
+json_value cbor_decoder::make_string()
+{
+  return m_arena ? m_arena->make_string() : json_value::make_string();
+}
+
+
+json_value cbor_decoder::make_binary()
+{
+  return m_arena ? m_arena->make_binary(nullptr, 0)
+                 : json_value::make_binary(json_binary());
+}
+
+
+json_value cbor_decoder::decode()
+{
+  json_value jv = decode_item(0);
+  if (m_ptr != m_end)
+    throw cbor_error("cbor trailing bytes after data item", m_ptr - m_start);
+  return jv;
+}
+
+
+json_value cbor_decoder::decode_prefix(json_prefix_fn prefix,
+                                       json_encoded_items& rest)
+{
+  rest = json_encoded_items();
+
+  const uint8_t ib = next_byte();
+  if ((ib >> 5) != major_array)
+    throw cbor_error("cbor array expected", 0);
+
+  const bool indefinite = (ib & 0x1F) == info_indefinite;
+  const uint64_t n = indefinite ? 0 : read_argument(ib & 0x1F);
+
+  json_value dest = make_array();
+  json_array& arr = dest.as_array();
+
+  size_t decode_count = 1;
+  for (uint64_t i = 0; indefinite || i < n; i++) {
+    if (indefinite && m_ptr != m_end &&
+        *m_ptr == ((major_simple << 5) | simple_break)) {
+      next_byte();
+      break;
+    }
+
+    if (arr.size() < decode_count) {
+      arr.push_back(decode_item(1));
+      if (arr.size() == 1)
+        decode_count = prefix(arr[0]);
+    } else {
+      if (rest.types.empty())
+        rest.ptr = (const char*) m_ptr;
+      rest.types.push_back(skip_item(1));
+      rest.len = (const char*) m_ptr - rest.ptr;
+    }
+  }
+
+  if (m_ptr != m_end)
+    throw cbor_error("cbor trailing bytes after data item", m_ptr - m_start);
+  return dest;
+}
+
+
+bool cbor_decoder::decode_events(json_event_handler& handler)
+{
+  if (!events_item(handler, 0))
+    return false;
+  if (m_ptr != m_end)
+    throw cbor_error("cbor trailing bytes after data item", m_ptr - m_start);
+  return true;
+}
+
+
+/* As decode_item, but report the item to an event handler.  Only containers
+ * are walked here; scalars are decoded by decode_item. */
+bool cbor_decoder::events_item(json_event_handler& handler, int depth)
+{
+  if (depth > max_depth)
+    throw cbor_error("cbor nesting too deep", m_ptr - m_start);
+
+  /* tags are ignored */
+  while (m_ptr != m_end && (*m_ptr >> 5) == major_tag) {
+    const uint8_t ib = next_byte();
+    read_argument(ib & 0x1F);
+  }
+
+  if (m_ptr == m_end)
+    throw cbor_error("cbor input truncated", m_ptr - m_start);
+
+  const uint8_t major = *m_ptr >> 5;
+  const uint8_t brk = (major_simple << 5) | simple_break;
+
+  if (major == major_array) {
+    const uint8_t info = next_byte() & 0x1F;
+    if (!handler.start_array())
+      return false;
+    if (info == info_indefinite) {
+      while (m_ptr != m_end && *m_ptr != brk)
+        if (!events_item(handler, depth + 1))
+          return false;
+      next_byte(); /* break */
+    } else {
+      uint64_t n = read_argument(info);
+      for (uint64_t i = 0; i < n; i++)
+        if (!events_item(handler, depth + 1))
+          return false;
+    }
+    return handler.end_array();
+  }
+
+  if (major == major_map) {
+    const uint8_t info = next_byte() & 0x1F;
+    if (!handler.start_object())
+      return false;
+    bool indefinite = (info == info_indefinite);
+    uint64_t n = indefinite ? 0 : read_argument(info);
+    std::string key;
+    for (uint64_t i = 0; indefinite || i < n; i++) {
+      if (indefinite && m_ptr != m_end && *m_ptr == brk) {
+        next_byte();
+        break;
+      }
+      uint8_t kb = next_byte();
+      if ((kb >> 5) != major_text)
+        throw cbor_error("cbor map key must be a text string", m_ptr - m_start);
+      key.clear();
+      read_string(major_text, kb & 0x1F, key);
+      if (!handler.key(key.data(), key.size()) ||
+          !events_item(handler, depth + 1))
+        return false;
+    }
+    return handler.end_object();
+  }
+
+  return json_emit_events(decode_item(depth), handler);
+}
+
+
+uint8_t cbor_decoder::next_byte()
+{
+  if (m_ptr == m_end)
+    throw cbor_error("cbor input truncated", m_ptr - m_start);
+  return *m_ptr++;
+}
+
+
+const uint8_t* cbor_decoder::take(size_t n)
+{
+  if ((size_t)(m_end - m_ptr) < n)
+    throw cbor_error("cbor input truncated", m_ptr - m_start);
+  const uint8_t* p = m_ptr;
+  m_ptr += n;
+  return p;
+}
+
+
+uint64_t cbor_decoder::read_argument(uint8_t info)
+{
+  if (info < info_uint8)
+    return info;
+
+  size_t n;
+  switch (info) {
+    case info_uint8:  n = 1; break;
+    case info_uint16: n = 2; break;
+    case info_uint32: n = 4; break;
+    case info_uint64: n = 8; break;
+    default:
+      throw cbor_error("cbor invalid additional information", m_ptr - m_start);
+  }
+
+  const uint8_t* p = take(n);
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+
+template <typename T>
+void cbor_decoder::read_string(uint8_t major, uint8_t info, T& dest)
+{
+  if (info == info_indefinite) {
+    /* sequence of definite-length chunks of the same major type */
+    while (true) {
+      uint8_t ib = next_byte();
+      if (ib == ((major_simple << 5) | simple_break))
+        return;
+      if ((ib >> 5) != major || (ib & 0x1F) == info_indefinite)
+        throw cbor_error("cbor invalid string chunk", m_ptr - m_start);
+      uint64_t len = read_argument(ib & 0x1F);
+      if (len > (uint64_t)(m_end - m_ptr))
+        throw cbor_error("cbor input truncated", m_ptr - m_start);
+      const uint8_t* p = take(len);
+      dest.insert(dest.end(), p, p + len);
+    }
+  }
+
+  uint64_t len = read_argument(info);
+  if (len > (uint64_t)(m_end - m_ptr))
+    throw cbor_error("cbor input truncated", m_ptr - m_start);
+  const uint8_t* p = take(len);
+  dest.assign(p, p + len);
+}
+
+
+void cbor_decoder::skip_string(uint8_t major, uint8_t info)
+{
+  if (info == info_indefinite) {
+    while (true) {
+      uint8_t ib = next_byte();
+      if (ib == ((major_simple << 5) | simple_break))
+        return;
+      if ((ib >> 5) != major || (ib & 0x1F) == info_indefinite)
+        throw cbor_error("cbor invalid string chunk", m_ptr - m_start);
+      uint64_t len = read_argument(ib & 0x1F);
+      if (len > (uint64_t)(m_end - m_ptr))
+        throw cbor_error("cbor input truncated", m_ptr - m_start);
+      take(len);
+    }
+  }
+
+  uint64_t len = read_argument(info);
+  if (len > (uint64_t)(m_end - m_ptr))
+    throw cbor_error("cbor input truncated", m_ptr - m_start);
+  take(len);
+}
+
+
+/* Validate and step over an item, without building it.  Accepts the same
+ * input as decode_item. */
+JSONType cbor_decoder::skip_item(int depth)
+{
+  if (depth > max_depth)
+    throw cbor_error("cbor nesting too deep", m_ptr - m_start);
+
+  const uint8_t ib = next_byte();
+  const uint8_t major = ib >> 5;
+  const uint8_t info = ib & 0x1F;
+  const uint8_t brk = (major_simple << 5) | simple_break;
+
+  switch (major) {
+    case major_uint:
+      read_argument(info);
+      return eINTEGER;
+
+    case major_negint:
+      if (read_argument(info) > (uint64_t)(std::numeric_limits<int64_t>::max)())
+        throw cbor_error("cbor negative integer out of range", m_ptr - m_start);
+      return eINTEGER;
+
+    case major_bytes:
+      skip_string(major, info);
+      return eBINARY;
+
+    case major_text:
+      skip_string(major, info);
+      return eSTRING;
+
+    case major_array: {
+      if (info == info_indefinite) {
+        while (m_ptr != m_end && *m_ptr != brk)
+          skip_item(depth + 1);
+        next_byte(); /* break */
+      } else {
+        uint64_t n = read_argument(info);
+        for (uint64_t i = 0; i < n; i++)
+          skip_item(depth + 1);
+      }
+      return eARRAY;
+    }
+
+    case major_map: {
+      bool indefinite = (info == info_indefinite);
+      uint64_t n = indefinite ? 0 : read_argument(info);
+      for (uint64_t i = 0; indefinite || i < n; i++) {
+        if (indefinite && m_ptr != m_end && *m_ptr == brk) {
+          next_byte();
+          break;
+        }
+        uint8_t kb = next_byte();
+        if ((kb >> 5) != major_text)
+          throw cbor_error("cbor map key must be a text string", m_ptr - m_start);
+        skip_string(major_text, kb & 0x1F);
+        skip_item(depth + 1);
+      }
+      return eOBJECT;
+    }
+
+    case major_tag:
+      read_argument(info);
+      return skip_item(depth + 1);
+
+    case major_simple: {
+      switch (info) {
+        case simple_false:
+        case simple_true: return eBOOL;
+        case simple_null:
+        case simple_undefined: return eNULL;
+        case simple_half: take(2); return eREAL;
+        case simple_float: take(4); return eREAL;
+        case simple_double: take(8); return eREAL;
+        default:
+          throw cbor_error("cbor unsupported simple value", m_ptr - m_start);
+      }
+    }
+  }
+
+  throw cbor_error("cbor invalid major type", m_ptr - m_start);
+}
+
+
+static double decode_half(uint16_t h)
+{
+  int exp = (h >> 10) & 0x1F;
+  int mant = h & 0x3FF;
+  double val;
+  if (exp == 0)
+    val = ldexp(mant, -24);
+  else if (exp != 31)
+    val = ldexp(mant + 1024, exp - 25);
+  else
+    val = mant == 0 ? std::numeric_limits<double>::infinity()
+                    : std::numeric_limits<double>::quiet_NaN();
+  return (h & 0x8000) ? -val : val;
+}
+
+
+json_value cbor_decoder::decode_item(int depth)
+{
+  if (depth > max_depth)
+    throw cbor_error("cbor nesting too deep", m_ptr - m_start);
+
+  const uint8_t ib = next_byte();
+  const uint8_t major = ib >> 5;
+  const uint8_t info = ib & 0x1F;
+
+  switch (major) {
+    case major_uint:
+      return json_value::make_uint(read_argument(info));
+
+    case major_negint: {
+      uint64_t n = read_argument(info);
+      if (n > (uint64_t)(std::numeric_limits<int64_t>::max)())
+        throw cbor_error("cbor negative integer out of range", m_ptr - m_start);
+      return json_value::make_int(-1 - (int64_t) n);
+    }
+
+    case major_bytes: {
+      json_value jv = make_binary();
+      read_string(major, info, jv.as_binary());
+      return jv;
+    }
+
+    case major_text: {
+      json_value jv = make_string();
+      read_string(major, info, jv.as_string());
+      return jv;
+    }
+
+    case major_array: {
+      json_value jv = make_array();
+      json_array& ja = jv.as_array();
+      if (info == info_indefinite) {
+        while (m_ptr != m_end && *m_ptr != ((major_simple << 5) | simple_break))
+          ja.push_back(decode_item(depth + 1));
+        next_byte(); /* break */
+      } else {
+        uint64_t n = read_argument(info);
+        if (n > (uint64_t)(m_end - m_ptr)) /* each item is at least 1 byte */
+          throw cbor_error("cbor input truncated", m_ptr - m_start);
+        ja.reserve(n);
+        for (uint64_t i = 0; i < n; i++)
+          ja.push_back(decode_item(depth + 1));
+      }
+      return jv;
+    }
+
+    case major_map: {
+      json_value jv = make_object();
+      json_object& jo = jv.as_object();
+      bool indefinite = (info == info_indefinite);
+      uint64_t n = indefinite ? 0 : read_argument(info);
+      for (uint64_t i = 0; indefinite || i < n; i++) {
+        if (indefinite && m_ptr != m_end &&
+            *m_ptr == ((major_simple << 5) | simple_break)) {
+          next_byte();
+          break;
+        }
+        uint8_t kb = next_byte();
+        if ((kb >> 5) != major_text)
+          throw cbor_error("cbor map key must be a text string", m_ptr - m_start);
+        std::string key;
+        read_string(major_text, kb & 0x1F, key);
+        jo[std::move(key)] = decode_item(depth + 1);
+      }
+      return jv;
+    }
+
+    case major_tag:
+      read_argument(info);
+      return decode_item(depth + 1);
+
+    case major_simple: {
+      switch (info) {
+        case simple_false: return json_value::make_bool(false);
+        case simple_true: return json_value::make_bool(true);
+        case simple_null:
+        case simple_undefined: return json_value::make_null();
+        case simple_half: {
+          const uint8_t* p = take(2);
+          return json_value::make_double(decode_half((p[0] << 8) | p[1]));
+        }
+        case simple_float: {
+          const uint8_t* p = take(4);
+          uint32_t bits = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+            (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+          float f;
+          memcpy(&f, &bits, sizeof(f));
+          return json_value::make_double(f);
+        }
+        case simple_double: {
+          const uint8_t* p = take(8);
+          uint64_t bits = 0;
+          for (int i = 0; i < 8; i++)
+            bits = (bits << 8) | p[i];
+          double d;
+          memcpy(&d, &bits, sizeof(d));
+          return json_value::make_double(d);
+        }
+        default:
+          throw cbor_error("cbor unsupported simple value", m_ptr - m_start);
+      }
+    }
+  }
+
+  throw cbor_error("cbor invalid major type", m_ptr - m_start);
+}
+
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_CBOR_SERIALISER_H
+#define WAMPCC_CBOR_SERIALISER_H
+
+#include "wampcc/json.h"
+
+#include <vector>
+
+namespace wampcc
+{
+
+/* Encode a json_value as CBOR (RFC 7049), appending to a byte vector. */
+class cbor_encoder
+{
+public:
+  cbor_encoder(std::vector<char>& dest) : m_dest(dest) {}
+
+  void encode(const json_value&);
+
+private:
+  void put_head(uint8_t major, uint64_t arg);
+  void put_string(uint8_t major, const std::string&);
+  void put_bytes(const json_binary&);
+  void put_double(double);
+
+  std::vector<char>& m_dest;
+};
+
+
+/* Decode a single CBOR data item into a json_value.  Tags are ignored, and
+ * byte strings are decoded as binary. */
+class cbor_decoder
+{
+public:
+  cbor_decoder(const char* ptr, size_t len, json_arena* arena = nullptr);
+
+  json_value decode();
+
+  /* Decode the leading items of a top level array, and validate and skip the
+   * remainder; see json_cbor_decode_prefix. */
+  json_value decode_prefix(json_prefix_fn, json_encoded_items& rest);
+
+  /* Decode as a sequence of events; see json_cbor_decode_events. */
+  bool decode_events(json_event_handler&);
+
+private:
+  json_value decode_item(int depth);
+  JSONType skip_item(int depth);
+  bool events_item(json_event_handler&, int depth);
+  void skip_string(uint8_t major, uint8_t info);
+  uint64_t read_argument(uint8_t info);
+  template <typename T> void read_string(uint8_t major, uint8_t info, T&);
+  uint8_t next_byte();
+  const uint8_t* take(size_t);
+
+  json_value make_object();
+  json_value make_array();
+  json_value make_string();
+  json_value make_binary();
+
+  const uint8_t* m_ptr;
+  const uint8_t* m_end;
+  const uint8_t* m_start;
+  json_arena* m_arena;
+};
+
+}
+
+#endif
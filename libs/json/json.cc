@@ -1,11 +1,17 @@
 #include "wampcc/json.h"
 #include "msgpack_serialiser.h"
+#include "cbor_serialiser.h"
+#include "json_parser.h"
+#include "json_encoder.h"
 #include "json_pointer.h"
 
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <new>
 
+#include <stdlib.h>
 #include <string.h>
 
 namespace wampcc {
@@ -49,12 +55,60 @@ const char* type_to_str(JSONType t)
     case wampcc::eINTEGER : return "integer";
     case wampcc::eBOOL    : return "bool";
     case wampcc::eNULL    : return "null";
+    case wampcc::eBINARY  : return "binary";
     default            : return "invalid";
   }
 }
 
 namespace internals {
 
+/* A shared node is preceded by its reference count */
+struct shared_node_header
+{
+  std::atomic<size_t> refs;
+};
+
+static_assert(sizeof(shared_node_header) % alignof(json_array) == 0 &&
+              sizeof(shared_node_header) % alignof(json_object) == 0 &&
+              sizeof(shared_node_header) % alignof(json_string) == 0 &&
+              sizeof(shared_node_header) % alignof(json_binary) == 0,
+              "shared node header must preserve alignment");
+
+template <typename T> static shared_node_header* shared_header(T* node)
+{
+  return reinterpret_cast<shared_node_header*>(node) - 1;
+}
+
+/* Move a node's contents into a new shared node, with a single reference */
+template <typename T> static T* make_shared_node(T& src)
+{
+  void* mem = ::operator new(sizeof(shared_node_header) + sizeof(T));
+  shared_node_header* header = new (mem) shared_node_header;
+  header->refs.store(1, std::memory_order_relaxed);
+  return new (header + 1) T(std::move(src));
+}
+
+template <typename T> static void release_shared(T* node)
+{
+  shared_node_header* header = shared_header(node);
+  if (header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    node->~T();
+    header->~shared_node_header();
+    ::operator delete(header);
+  }
+}
+
+/* Private copy of a shared node.  The children of a shared node are
+ * themselves shared, so this copies just one level. */
+template <typename T> static T* unshared_copy(T* node)
+{
+  /* as the sole owner, no other value can observe the node, so its contents
+   * can be taken rather than copied */
+  if (shared_header(node)->refs.load(std::memory_order_acquire) == 1)
+    return new T(std::move(*node));
+  return new T(*node);
+}
+
 valueimpl::Details valueimpl::init_details(JSONDetailedType t)
 {
   // create variable ... assume its in an undefined state
@@ -63,6 +117,7 @@ valueimpl::Details valueimpl::init_details(JSONDetailedType t)
   // make best effort to initialise union to zero
   d.data.uint = {};
   d.type = t;
+  d.storage = e_heap;
 
   return d;
 }
@@ -70,6 +125,34 @@ valueimpl::Details valueimpl::init_details(JSONDetailedType t)
 
 void valueimpl::dispose_details(valueimpl::Details& d)
 {
+  if (d.storage == e_pooled)
+  {
+    switch(d.type)
+    {
+      case e_object : json_arena::destroy(d.data.object); break;
+      case e_array  : json_arena::destroy(d.data.array); break;
+      case e_string : json_arena::destroy(d.data.string); break;
+      case e_binary : json_arena::destroy(d.data.binary); break;
+      default: break;
+    }
+    d = init_details();
+    return;
+  }
+
+  if (d.storage == e_shared)
+  {
+    switch(d.type)
+    {
+      case e_object : release_shared(d.data.object); break;
+      case e_array  : release_shared(d.data.array); break;
+      case e_string : release_shared(d.data.string); break;
+      case e_binary : release_shared(d.data.binary); break;
+      default: break;
+    }
+    d = init_details();
+    return;
+  }
+
   switch(d.type)
   {
     case e_object :
@@ -87,6 +170,11 @@ void valueimpl::dispose_details(valueimpl::Details& d)
       delete d.data.string;
       break;
     }
+    case e_binary :
+    {
+      delete d.data.binary;
+      break;
+    }
     default: break;
   }
   d = init_details();
@@ -151,10 +239,20 @@ valueimpl::valueimpl(json_string* a)
   details.data.string = a;
 }
 
+valueimpl::valueimpl(json_binary* a)
+  : details( init_details(valueimpl::e_binary) )
+{
+  details.data.binary = a;
+}
+
 valueimpl& valueimpl::operator=(valueimpl&& rhs) noexcept
 {
-  this->details = rhs.details;  // bitwise
-  rhs.details = init_details();
+  if (this != &rhs)
+  {
+    dispose_details(this->details);
+    this->details = rhs.details;  // bitwise
+    rhs.details = init_details();
+  }
   return *this;
 }
 
@@ -187,6 +285,26 @@ valueimpl::Details valueimpl::clone_details() const
   // basic bitwise copy is sufficent for value-types
   valueimpl::Details retval = this->details;
 
+  // a shared node is immutable, so copying just takes another reference
+  if (details.storage == e_shared)
+  {
+    shared_node_header* header = nullptr;
+    switch(details.type)
+    {
+      case e_object : header = shared_header(details.data.object); break;
+      case e_array  : header = shared_header(details.data.array); break;
+      case e_string : header = shared_header(details.data.string); break;
+      case e_binary : header = shared_header(details.data.binary); break;
+      default: break;
+    }
+    if (header)
+      header->refs.fetch_add(1, std::memory_order_relaxed);
+    return retval;
+  }
+
+  // copies of arena nodes are made on the heap
+  retval.storage = e_heap;
+
   // ... now handle pointer types
   switch(this->details.type)
   {
@@ -205,11 +323,74 @@ valueimpl::Details valueimpl::clone_details() const
       retval.data.string = new json_string(*details.data.string);
       break;
     }
+    case valueimpl::e_binary:
+    {
+      retval.data.binary = new json_binary(*details.data.binary);
+      break;
+    }
     default: break;
   }
   return retval;
 }
 
+void valueimpl::freeze()
+{
+  if (details.storage == e_shared)
+    return; // children of a shared node are already shared
+
+  Details frozen = init_details(details.type);
+  frozen.storage = e_shared;
+
+  switch(details.type)
+  {
+    case e_object :
+    {
+      for (auto & item : *details.data.object)
+        item.second.freeze();
+      frozen.data.object = make_shared_node(*details.data.object);
+      break;
+    }
+    case e_array:
+    {
+      for (auto & item : *details.data.array)
+        item.freeze();
+      frozen.data.array = make_shared_node(*details.data.array);
+      break;
+    }
+    case e_string:
+    {
+      frozen.data.string = make_shared_node(*details.data.string);
+      break;
+    }
+    case e_binary:
+    {
+      frozen.data.binary = make_shared_node(*details.data.binary);
+      break;
+    }
+    default: return;
+  }
+
+  dispose_details(details);
+  details = frozen;
+}
+
+void valueimpl::unshare()
+{
+  Details copy = init_details(details.type);
+
+  switch(details.type)
+  {
+    case e_object : copy.data.object = unshared_copy(details.data.object); break;
+    case e_array  : copy.data.array = unshared_copy(details.data.array); break;
+    case e_string : copy.data.string = unshared_copy(details.data.string); break;
+    case e_binary : copy.data.binary = unshared_copy(details.data.binary); break;
+    default: return;
+  }
+
+  dispose_details(details);
+  details = copy;
+}
+
 bool valueimpl::operator==(const valueimpl& rhs) const
 {
   if (this->details.type == rhs.details.type)
@@ -232,6 +413,10 @@ bool valueimpl::operator==(const valueimpl& rhs) const
       {
         return *(this->details.data.string) ==  *rhs.details.data.string;
       }
+      case valueimpl::e_binary:
+      {
+        return *(this->details.data.binary) ==  *rhs.details.data.binary;
+      }
       case valueimpl::e_bool:
       {
         return this->details.data.boolean == rhs.details.data.boolean;
@@ -409,6 +594,21 @@ json_value::json_value(const json_object& rhs)
 {
 }
 
+json_value::json_value(std::string&& s)
+  : m_impl(new json_string(std::move(s)))
+{
+}
+
+json_value::json_value(json_array&& rhs)
+  : m_impl(new json_array(std::move(rhs)))
+{
+}
+
+json_value::json_value(json_object&& rhs)
+  : m_impl(new json_object(std::move(rhs)))
+{
+}
+
 
 json_value::json_value(bool b)
   : m_impl( b, internals::valueimpl::BoolConstructor())
@@ -503,6 +703,22 @@ json_value json_value::make_string(std::string s)
   return retval;
 }
 
+json_value json_value::make_binary(const void* p, size_t n)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(p);
+  return make_binary(json_binary(bytes, bytes + n));
+}
+
+json_value json_value::make_binary(json_binary b)
+{
+  internals::valueimpl vimpl(new json_binary(std::move(b)));
+
+  json_value v;
+  v.m_impl.swap( vimpl );
+
+  return v;
+}
+
 json_value json_value::make_bool(bool v)
 {
   return json_value(v);
@@ -623,6 +839,13 @@ msgpack_error::msgpack_error(const std::string& msg,
 {
 }
 
+cbor_error::cbor_error(const std::string& msg,
+                       size_t error_offset_)
+: json_error(msg),
+  error_offset(error_offset_)
+{
+}
+
 //----------------------------------------------------------------------
 
 
@@ -748,20 +971,217 @@ json_value json_get_copy(const json_array& ar, size_t i,
 }
 
 
+std::string json_encode(const json_value& src)
+{
+  std::vector<char> dest;
+  json_encode(src, dest);
+  return std::string(dest.data(), dest.size());
+}
+
+std::string json_encode_any(const json_value& src)
+{
+  return json_encode(src);
+}
+
+void json_encode(const json_value& src, std::vector<char>& dest, bool compact)
+{
+  json_encoder encoder(dest, compact);
+  encoder.encode(src);
+}
+
+void json_decode(json_value& dest, const char* buffer, size_t buflen)
+{
+  json_parser parser(buffer, buflen, "<buffer>");
+  parser.parse(dest);
+}
+
+void json_decode(json_value& dest, const char* buffer)
+{
+  json_parser parser(buffer, strlen(buffer), "<string>");
+  parser.parse(dest);
+}
+
+json_value json_decode(const char* buffer, size_t buflen)
+{
+  json_value dest;
+  json_decode(dest, buffer, buflen);
+  return dest;
+}
+
+json_value json_decode(const char* buffer)
+{
+  json_value dest;
+  json_decode(dest, buffer);
+  return dest;
+}
+
+json_value json_decode(const char* buffer, size_t buflen, json_arena& arena)
+{
+  json_value dest;
+  json_parser parser(buffer, buflen, "<buffer>", &arena);
+  parser.parse(dest);
+  return dest;
+}
+
+bool json_decode_events(const char* buffer, size_t buflen,
+                        json_event_handler& handler)
+{
+  json_parser parser(buffer, buflen, "<buffer>");
+  return parser.parse_events(handler);
+}
+
+bool json_emit_events(const json_array& ja, json_event_handler& handler)
+{
+  if (!handler.start_array())
+    return false;
+  for (auto& item : ja)
+    if (!json_emit_events(item, handler))
+      return false;
+  return handler.end_array();
+}
+
+bool json_emit_events(const json_object& jo, json_event_handler& handler)
+{
+  if (!handler.start_object())
+    return false;
+  for (auto& item : jo)
+    if (!handler.key(item.first.data(), item.first.size()) ||
+        !json_emit_events(item.second, handler))
+      return false;
+  return handler.end_object();
+}
+
+bool json_emit_events(const json_value& jv, json_event_handler& handler)
+{
+  switch (jv.type()) {
+    case eNULL:
+      return handler.null_value();
+    case eBOOL:
+      return handler.bool_value(jv.as_bool());
+    case eREAL:
+      return handler.real_value(jv.as_real());
+    case eINTEGER:
+      return jv.is_uint() ? handler.uint_value(jv.as_uint())
+                          : handler.int_value(jv.as_int());
+    case eSTRING:
+      return handler.string_value(jv.as_string().data(),
+                                  jv.as_string().size());
+    case eBINARY:
+      return handler.binary_value(jv.as_binary().data(),
+                                  jv.as_binary().size());
+    case eARRAY:
+      return json_emit_events(jv.as_array(), handler);
+    case eOBJECT:
+      return json_emit_events(jv.as_object(), handler);
+  }
+  return true;
+}
+
+bool json_msgpack_decode_events(const char* p, size_t l,
+                                json_event_handler& handler)
+{
+  msgpack_decoder decoder(p, l);
+  return decoder.decode_events(handler);
+}
+
 json_value json_msgpack_decode(const char* p , size_t l)
 {
-  msgpack_decoder decoder;
-  if (decoder.decode(p, l))
-    return std::move(decoder.result);
-  else
-    throw msgpack_error("msgpack deocde failed");
+  msgpack_decoder decoder(p, l);
+  return decoder.decode();
+}
+
+json_value json_decode_prefix(const char* buffer, size_t buflen,
+                              json_prefix_fn prefix, json_encoded_items& rest,
+                              json_arena* arena)
+{
+  json_value dest;
+  json_parser parser(buffer, buflen, "<buffer>", arena);
+  parser.parse_prefix(dest, prefix, rest);
+  return dest;
+}
+
+json_value json_msgpack_decode_prefix(const char* p, size_t l,
+                                      json_prefix_fn prefix,
+                                      json_encoded_items& rest,
+                                      json_arena* arena)
+{
+  msgpack_decoder decoder(p, l, arena);
+  return decoder.decode_prefix(prefix, rest);
+}
+
+json_value json_msgpack_decode(const char* p, size_t l, json_arena& arena)
+{
+  msgpack_decoder decoder(p, l, &arena);
+  return decoder.decode();
+}
+
+static void free_msgpack_bytes(region* ptr)
+{
+  if (ptr)
+    ::free(ptr->first);
+
+  delete ptr;
 }
 
 std::unique_ptr<region, void(*)(region*)> json_msgpack_encode(const json_value& src)
 {
-  msgpack_encoder encoder;
+  /* encode into a per-thread buffer, which keeps its capacity across calls,
+   * so that only the returned region is allocated */
+  static thread_local std::vector<char> bytes;
+  bytes.clear();
+  msgpack_encoder(bytes).encode(src);
 
-  return encoder.encode(src);
+  char* mem = (char*) ::malloc(bytes.size() ? bytes.size() : 1);
+  if (mem == nullptr)
+    throw std::bad_alloc();
+  memcpy(mem, bytes.data(), bytes.size());
+  return {new region(mem, bytes.size()), free_msgpack_bytes};
+}
+
+void json_msgpack_encode(const json_value& src, std::vector<char>& dest)
+{
+  msgpack_encoder encoder(dest);
+  encoder.encode(src);
+}
+
+bool json_cbor_decode_events(const char* p, size_t l,
+                             json_event_handler& handler)
+{
+  cbor_decoder decoder(p, l);
+  return decoder.decode_events(handler);
+}
+
+json_value json_cbor_decode(const char* p, size_t l)
+{
+  cbor_decoder decoder(p, l);
+  return decoder.decode();
+}
+
+json_value json_cbor_decode(const char* p, size_t l, json_arena& arena)
+{
+  cbor_decoder decoder(p, l, &arena);
+  return decoder.decode();
+}
+
+json_value json_cbor_decode_prefix(const char* p, size_t l,
+                                   json_prefix_fn prefix,
+                                   json_encoded_items& rest, json_arena* arena)
+{
+  cbor_decoder decoder(p, l, arena);
+  return decoder.decode_prefix(prefix, rest);
+}
+
+std::vector<char> json_cbor_encode(const json_value& src)
+{
+  std::vector<char> dest;
+  json_cbor_encode(src, dest);
+  return dest;
+}
+
+void json_cbor_encode(const json_value& src, std::vector<char>& dest)
+{
+  cbor_encoder encoder(dest);
+  encoder.encode(src);
 }
 
 
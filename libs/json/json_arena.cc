@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/json.h"
+
+#include <atomic>
+#include <new>
+
+#include <stdlib.h>
+
+namespace wampcc
+{
+
+/* Block header, followed by the node storage.  A block is referenced once by
+ * its arena while it is the current block, and once by each live node. */
+struct json_arena::block
+{
+  std::atomic<size_t> refs;
+  size_t used;
+  size_t capacity;
+
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+/* Each node is preceded by a pointer to its block. */
+struct node_header
+{
+  void* owner;
+};
+
+static const size_t node_alignment = alignof(void*);
+
+static_assert(alignof(json_array) <= node_alignment &&
+                  alignof(json_object) <= node_alignment &&
+                  alignof(json_string) <= node_alignment &&
+                  alignof(json_binary) <= node_alignment,
+              "json_arena node alignment too small");
+
+static_assert(sizeof(node_header) % node_alignment == 0,
+              "json_arena node header must preserve alignment");
+
+
+static inline size_t align_up(size_t n)
+{
+  return (n + node_alignment - 1) & ~(node_alignment - 1);
+}
+
+
+void json_arena::unref(block* b)
+{
+  if (b && b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    b->~block();
+    free(b);
+  }
+}
+
+
+const size_t json_arena::default_block_size;
+
+
+json_arena::json_arena(size_t block_size)
+  : m_block(nullptr),
+    m_block_size(block_size)
+{
+}
+
+
+json_arena::~json_arena()
+{
+  unref(m_block);
+}
+
+
+void* json_arena::allocate(size_t size)
+{
+  size_t needed = sizeof(node_header) + align_up(size);
+
+  if (!m_block || m_block->capacity - m_block->used < needed) {
+    size_t capacity = std::max(m_block_size, needed);
+    void* mem = malloc(sizeof(block) + capacity);
+    if (!mem)
+      throw std::bad_alloc();
+
+    block* b = new (mem) block;
+    b->refs.store(1, std::memory_order_relaxed);
+    b->used = 0;
+    b->capacity = capacity;
+
+    unref(m_block);
+    m_block = b;
+  }
+
+  node_header* header =
+      reinterpret_cast<node_header*>(m_block->data() + m_block->used);
+  header->owner = m_block;
+  m_block->used += needed;
+  m_block->refs.fetch_add(1, std::memory_order_relaxed);
+
+  return header + 1;
+}
+
+
+void json_arena::release(void* node)
+{
+  node_header* header = static_cast<node_header*>(node) - 1;
+  unref(static_cast<block*>(header->owner));
+}
+
+
+template <typename T, typename... Args> T* json_arena::create(Args&&... args)
+{
+  void* mem = allocate(sizeof(T));
+  try {
+    return new (mem) T(std::forward<Args>(args)...);
+  } catch (...) {
+    release(mem);
+    throw;
+  }
+}
+
+
+json_value json_arena::make_array()
+{
+  internals::valueimpl vimpl(create<json_array>(),
+                             internals::valueimpl::PooledConstructor());
+  json_value v;
+  v.m_impl.swap(vimpl);
+  return v;
+}
+
+
+json_value json_arena::make_object()
+{
+  internals::valueimpl vimpl(create<json_object>(),
+                             internals::valueimpl::PooledConstructor());
+  json_value v;
+  v.m_impl.swap(vimpl);
+  return v;
+}
+
+
+json_value json_arena::make_string()
+{
+  internals::valueimpl vimpl(create<json_string>(),
+                             internals::valueimpl::PooledConstructor());
+  json_value v;
+  v.m_impl.swap(vimpl);
+  return v;
+}
+
+
+json_value json_arena::make_string(const char* s, size_t n)
+{
+  internals::valueimpl vimpl(create<json_string>(s, n),
+                             internals::valueimpl::PooledConstructor());
+  json_value v;
+  v.m_impl.swap(vimpl);
+  return v;
+}
+
+
+json_value json_arena::make_binary(const char* p, size_t n)
+{
+  internals::valueimpl vimpl(create<json_binary>(p, p + n),
+                             internals::valueimpl::PooledConstructor());
+  json_value v;
+  v.m_impl.swap(vimpl);
+  return v;
+}
+
+}
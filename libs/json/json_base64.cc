@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "json_base64.h"
+
+namespace wampcc
+{
+
+static const char base64_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int base64_value(char c)
+{
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+
+void base64_encode(const unsigned char* src, size_t len, std::vector<char>& dest)
+{
+  dest.reserve(dest.size() + 4 * ((len + 2) / 3));
+
+  size_t i = 0;
+  for (; i + 3 <= len; i += 3) {
+    const uint32_t v = (uint32_t(src[i]) << 16) | (uint32_t(src[i + 1]) << 8) | src[i + 2];
+    dest.push_back(base64_chars[(v >> 18) & 0x3F]);
+    dest.push_back(base64_chars[(v >> 12) & 0x3F]);
+    dest.push_back(base64_chars[(v >> 6) & 0x3F]);
+    dest.push_back(base64_chars[v & 0x3F]);
+  }
+
+  if (i < len) {
+    uint32_t v = uint32_t(src[i]) << 16;
+    if (i + 1 < len)
+      v |= uint32_t(src[i + 1]) << 8;
+    dest.push_back(base64_chars[(v >> 18) & 0x3F]);
+    dest.push_back(base64_chars[(v >> 12) & 0x3F]);
+    dest.push_back(i + 1 < len ? base64_chars[(v >> 6) & 0x3F] : '=');
+    dest.push_back('=');
+  }
+}
+
+
+bool base64_decode(const char* src, size_t len, json_binary& dest)
+{
+  if (len % 4)
+    return false;
+
+  dest.clear();
+  dest.reserve(len / 4 * 3);
+
+  for (size_t i = 0; i < len; i += 4) {
+    const bool last = (i + 4 == len);
+    const int pad = (last && src[i + 3] == '=') + (last && src[i + 2] == '=');
+
+    uint32_t v = 0;
+    for (int j = 0; j < 4 - pad; j++) {
+      int d = base64_value(src[i + j]);
+      if (d < 0)
+        return false;
+      v |= uint32_t(d) << (18 - 6 * j);
+    }
+
+    dest.push_back((unsigned char)(v >> 16));
+    if (pad < 2)
+      dest.push_back((unsigned char)(v >> 8));
+    if (pad < 1)
+      dest.push_back((unsigned char) v);
+  }
+
+  return true;
+}
+
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_JSON_BASE64_H
+#define WAMPCC_JSON_BASE64_H
+
+#include "wampcc/json.h"
+
+#include <vector>
+
+namespace wampcc
+{
+
+/* Base64 (RFC 4648), as used for binary values carried in JSON text. */
+
+/* Append the padded base64 encoding of 'len' bytes to 'dest' */
+void base64_encode(const unsigned char* src, size_t len, std::vector<char>& dest);
+
+/* Decode padded base64 into 'dest'. Returns false if the input is not valid
+ * base64, in which case 'dest' is left in an unspecified state. */
+bool base64_decode(const char* src, size_t len, json_binary& dest);
+
+}
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "json_encoder.h"
+#include "json_base64.h"
+#include "json_text.h"
+
+#include <cmath>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace wampcc
+{
+
+/* For each byte, the character to follow a backslash when it must be
+ * escaped; 'u' for a \u00XX escape, and zero for no escape. */
+struct escape_table
+{
+  char value[256];
+
+  escape_table()
+  {
+    memset(value, 0, sizeof(value));
+    for (int i = 0; i < 0x20; i++)
+      value[i] = 'u';
+    value[(unsigned char) '"'] = '"';
+    value[(unsigned char) '\\'] = '\\';
+    value[(unsigned char) '\b'] = 'b';
+    value[(unsigned char) '\f'] = 'f';
+    value[(unsigned char) '\n'] = 'n';
+    value[(unsigned char) '\r'] = 'r';
+    value[(unsigned char) '\t'] = 't';
+  }
+};
+
+static const escape_table escapes;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+
+/* Skip over ASCII bytes that need no escaping. */
+static inline const char* scan_unescaped(const char* p, const char* end)
+{
+#ifdef WAMPCC_JSON_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i max_control = _mm_set1_epi8(0x1F);
+
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    /* unsigned v <= 0x1F, via max(v, 0x1F) == 0x1F */
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_max_epu8(v, max_control), max_control));
+    /* bytes >= 0x80 have their top bit set, and must be validated */
+    int mask = _mm_movemask_epi8(special) | _mm_movemask_epi8(v);
+    if (mask)
+      return p + first_set_bit(mask);
+    p += 16;
+  }
+#endif
+
+  while (p != end && (unsigned char) *p < 0x80 &&
+         escapes.value[(unsigned char) *p] == 0)
+    p++;
+  return p;
+}
+
+
+void json_encoder::put_string(const std::string& s)
+{
+  const char* p = s.data();
+  const char* const end = p + s.size();
+
+  put('"');
+  while (p != end) {
+    const char* run = scan_unescaped(p, end);
+    put(p, run - p);
+    if (run == end)
+      break;
+
+    const unsigned char c = *run;
+    if (c >= 0x80) {
+      size_t n = utf8_sequence_length((const unsigned char*) run, end - run);
+      if (n == 0)
+        throw json_error("invalid UTF-8 in string");
+      put(run, n);
+      p = run + n;
+      continue;
+    }
+
+    const char e = escapes.value[c];
+    if (e == 'u') {
+      const char u[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xF]};
+      put(u, sizeof(u));
+    } else {
+      const char u[2] = {'\\', e};
+      put(u, sizeof(u));
+    }
+    p = run + 1;
+  }
+  put('"');
+}
+
+
+void json_encoder::put_uint(uint64_t v)
+{
+  char buf[20];
+  char* p = buf + sizeof(buf);
+
+  while (v >= 100) {
+    const unsigned i = (v % 100) * 2;
+    v /= 100;
+    *--p = digit_pairs[i + 1];
+    *--p = digit_pairs[i];
+  }
+  if (v >= 10) {
+    const unsigned i = v * 2;
+    *--p = digit_pairs[i + 1];
+    *--p = digit_pairs[i];
+  } else
+    *--p = (char)('0' + v);
+
+  put(p, buf + sizeof(buf) - p);
+}
+
+
+void json_encoder::put_int(int64_t v)
+{
+  if (v < 0) {
+    put('-');
+    put_uint(0 - (uint64_t) v);
+  } else
+    put_uint((uint64_t) v);
+}
+
+
+void json_encoder::put_double(double d)
+{
+  /* JSON has no representation for these */
+  if (!std::isfinite(d)) {
+    put("null", 4);
+    return;
+  }
+
+  /* Shortest round-trip formatting: most values coming from decimal sources
+   * round-trip at 15 significant digits, which %g also trims of trailing
+   * zeros; other values need 16 or 17.  snprintf and strtod agree on the
+   * locale's decimal point, which is then replaced with '.'. */
+  char buf[32];
+  int len = 0;
+  for (int precision = 15; precision <= 17; precision++) {
+    len = snprintf(buf, sizeof(buf), "%.*g", precision, d);
+    if (precision == 17 || strtod(buf, nullptr) == d)
+      break;
+  }
+  len = (int) from_locale_number(buf, len);
+
+  put(buf, len);
+
+  /* ensure the value is decoded as a real, not an integer */
+  if (strpbrk(buf, ".eE") == nullptr)
+    put(".0", 2);
+}
+
+
+void json_encoder::encode(const json_value& jv)
+{
+  switch (jv.type()) {
+    case wampcc::eNULL:
+      put("null", 4);
+      break;
+    case wampcc::eBOOL:
+      if (jv.as_bool())
+        put("true", 4);
+      else
+        put("false", 5);
+      break;
+    case wampcc::eINTEGER:
+      if (jv.is_uint())
+        put_uint(jv.as_uint());
+      else
+        put_int(jv.as_int());
+      break;
+    case wampcc::eREAL:
+      put_double(jv.as_real());
+      break;
+    case wampcc::eSTRING:
+      put_string(jv.as_string());
+      break;
+    case wampcc::eBINARY: {
+      /* WAMP convention: a NUL followed by the base64 of the bytes */
+      const json_binary& b = jv.as_binary();
+      put("\"\\u0000", 7);
+      base64_encode(b.data(), b.size(), m_dest);
+      put('"');
+      break;
+    }
+    case wampcc::eARRAY: {
+      const json_array& ja = jv.as_array();
+      put('[');
+      for (auto it = ja.begin(); it != ja.end(); ++it) {
+        if (it != ja.begin()) {
+          if (m_compact)
+            put(',');
+          else
+            put(", ", 2);
+        }
+        encode(*it);
+      }
+      put(']');
+      break;
+    }
+    case wampcc::eOBJECT: {
+      const json_object& jo = jv.as_object();
+      put('{');
+      for (auto it = jo.begin(); it != jo.end(); ++it) {
+        if (it != jo.begin()) {
+          if (m_compact)
+            put(',');
+          else
+            put(", ", 2);
+        }
+        put_string(it->first);
+        if (m_compact)
+          put(':');
+        else
+          put(": ", 2);
+        encode(it->second);
+      }
+      put('}');
+      break;
+    }
+  }
+}
+
+}
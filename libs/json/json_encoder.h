@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_JSON_ENCODER_H
+#define WAMPCC_JSON_ENCODER_H
+
+#include "wampcc/json.h"
+
+#include <vector>
+
+namespace wampcc
+{
+
+/* Streaming JSON encoder, which walks a json_value and appends the JSON text
+ * to a byte vector. By default the output layout matches that previously
+ * produced by jansson, ie, with a space after each ',' and ':'; compact mode
+ * omits those spaces. */
+class json_encoder
+{
+public:
+  json_encoder(std::vector<char>& dest, bool compact = false)
+    : m_dest(dest),
+      m_compact(compact)
+  {
+  }
+
+  void encode(const json_value&);
+
+private:
+  void put_string(const std::string&);
+  void put_uint(uint64_t);
+  void put_int(int64_t);
+  void put_double(double);
+
+  void put(char c) { m_dest.push_back(c); }
+  void put(const char* p, size_t len) { m_dest.insert(m_dest.end(), p, p + len); }
+
+  std::vector<char>& m_dest;
+  bool m_compact;
+};
+
+}
+
+#endif
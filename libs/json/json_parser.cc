@@ -0,0 +1,824 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "json_parser.h"
+#include "json_base64.h"
+#include "json_text.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace wampcc
+{
+
+/* guard against stack exhaustion from hostile input; same as jansson */
+static const int max_depth = 2048;
+
+/* powers of ten exactly representable as a double */
+static const double exact_powers_of_ten[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+
+/* Does a string token start with an escaped NUL, which by WAMP convention
+ * marks a base64 encoded binary value */
+static inline bool is_binary_token(const char* p, const char* end)
+{
+  return end - p >= 7 && memcmp(p, "\"\\u0000", 7) == 0;
+}
+
+
+static inline bool is_plain_string_char(unsigned char c)
+{
+  return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+
+/* Skip over string bytes that need no special handling, ie, printable ASCII
+ * other than quote and backslash. */
+static inline const char* scan_plain(const char* p, const char* end)
+{
+#ifdef WAMPCC_JSON_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i space = _mm_set1_epi8(0x20);
+
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    /* signed compare catches both control characters and bytes >= 0x80 */
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmplt_epi8(v, space));
+    int mask = _mm_movemask_epi8(special);
+    if (mask)
+      return p + first_set_bit(mask);
+    p += 16;
+  }
+#endif
+
+  while (p != end && is_plain_string_char(*p))
+    p++;
+  return p;
+}
+
+
+static void append_utf8(std::string& dest, uint32_t cp)
+{
+  if (cp < 0x80)
+    dest.push_back((char) cp);
+  else if (cp < 0x800) {
+    dest.push_back((char)(0xC0 | (cp >> 6)));
+    dest.push_back((char)(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    dest.push_back((char)(0xE0 | (cp >> 12)));
+    dest.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+    dest.push_back((char)(0x80 | (cp & 0x3F)));
+  } else {
+    dest.push_back((char)(0xF0 | (cp >> 18)));
+    dest.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+    dest.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+    dest.push_back((char)(0x80 | (cp & 0x3F)));
+  }
+}
+
+
+static int hex_value(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+json_parser::json_parser(const char* ptr, size_t len, const char* source,
+                         json_arena* arena)
+  : m_start(ptr),
+    m_ptr(ptr),
+    m_end(ptr + len),
+    m_source(source),
+    m_arena(arena)
+{
+}
+
+
+json_value json_parser::make_object()
+{
+  return m_arena ? m_arena->make_object() : json_value::make_object();
+}
+
+
+json_value json_parser::make_array()
+{
+  return m_arena ? m_arena->make_array() : json_value::make_array();
+}
+
+
+json_value json_parser::make_string()
+{
+  return m_arena ? m_arena->make_string() : json_value::make_string();
+}
+
+
+void json_parser::fail(const char* msg, const char* at) const
+{
+  int line = 1;
+  int column = 0;
+  for (const char* p = m_start; p < at; p++) {
+    if (*p == '\n') {
+      line++;
+      column = 0;
+    } else
+      column++;
+  }
+
+  std::ostringstream os;
+  os << "error=" << msg << " "
+     << "line=" << line << " "
+     << "column=" << column << " "
+     << "position=" << (at - m_start);
+
+  parse_error perr(os.str());
+  perr.error = msg;
+  perr.source = m_source;
+  perr.line = line;
+  perr.position = (int)(at - m_start);
+  perr.column = column;
+  throw perr;
+}
+
+
+void json_parser::skip_ws()
+{
+  while (m_ptr != m_end &&
+         (*m_ptr == ' ' || *m_ptr == '\n' || *m_ptr == '\r' || *m_ptr == '\t'))
+    m_ptr++;
+}
+
+
+void json_parser::parse(json_value& dest)
+{
+  skip_ws();
+  if (m_ptr == m_end || (*m_ptr != '{' && *m_ptr != '['))
+    fail("'[' or '{' expected", m_ptr);
+
+  parse_value(dest, 0);
+
+  skip_ws();
+  if (m_ptr != m_end)
+    fail("end of file expected", m_ptr);
+}
+
+
+void json_parser::parse_prefix(json_value& dest, json_prefix_fn prefix,
+                               json_encoded_items& rest)
+{
+  rest = json_encoded_items();
+
+  skip_ws();
+  if (m_ptr == m_end || *m_ptr != '[')
+    fail("'[' expected", m_ptr);
+
+  dest = make_array();
+  json_array& arr = dest.as_array();
+
+  m_ptr++; /* '[' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == ']')
+    m_ptr++;
+  else {
+    size_t decode_count = 1;
+    while (true) {
+      if (arr.size() < decode_count) {
+        arr.emplace_back();
+        parse_value(arr.back(), 1);
+        if (arr.size() == 1)
+          decode_count = prefix(arr[0]);
+      } else {
+        if (rest.types.empty())
+          rest.ptr = m_ptr;
+        rest.types.push_back(skip_value(1));
+        rest.len = m_ptr - rest.ptr;
+      }
+
+      skip_ws();
+      if (m_ptr == m_end)
+        fail("']' expected", m_ptr);
+      if (*m_ptr == ']') {
+        m_ptr++;
+        break;
+      }
+      if (*m_ptr != ',')
+        fail("']' expected", m_ptr);
+      m_ptr++;
+      skip_ws();
+    }
+  }
+
+  skip_ws();
+  if (m_ptr != m_end)
+    fail("end of file expected", m_ptr);
+}
+
+
+/* Validate and step over a value, without building it. */
+JSONType json_parser::skip_value(int depth)
+{
+  if (m_ptr == m_end)
+    fail("unexpected end of input", m_ptr);
+
+  switch (*m_ptr) {
+    case '{':
+      skip_object(depth + 1);
+      return eOBJECT;
+    case '[':
+      skip_array(depth + 1);
+      return eARRAY;
+    case '"': {
+      const bool binary = is_binary_token(m_ptr, m_end);
+      m_scratch.clear();
+      parse_string(m_scratch);
+      json_binary bytes;
+      if (binary && base64_decode(m_scratch.data() + 1, m_scratch.size() - 1, bytes))
+        return eBINARY;
+      return eSTRING;
+    }
+    case 't':
+      parse_literal("true", 4);
+      return eBOOL;
+    case 'f':
+      parse_literal("false", 5);
+      return eBOOL;
+    case 'n':
+      parse_literal("null", 4);
+      return eNULL;
+    default:
+      if (*m_ptr == '-' || is_digit(*m_ptr)) {
+        json_value number;
+        parse_number(number);
+        return number.type();
+      }
+      fail("invalid token", m_ptr);
+  }
+}
+
+
+void json_parser::skip_object(int depth)
+{
+  if (depth > max_depth)
+    fail("maximum parsing depth reached", m_ptr);
+
+  m_ptr++; /* '{' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == '}') {
+    m_ptr++;
+    return;
+  }
+
+  while (true) {
+    if (m_ptr == m_end || *m_ptr != '"')
+      fail("string or '}' expected", m_ptr);
+    m_scratch.clear();
+    parse_string(m_scratch);
+
+    skip_ws();
+    if (m_ptr == m_end || *m_ptr != ':')
+      fail("':' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+
+    skip_value(depth);
+
+    skip_ws();
+    if (m_ptr == m_end)
+      fail("'}' expected", m_ptr);
+    if (*m_ptr == '}') {
+      m_ptr++;
+      return;
+    }
+    if (*m_ptr != ',')
+      fail("'}' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+  }
+}
+
+
+void json_parser::skip_array(int depth)
+{
+  if (depth > max_depth)
+    fail("maximum parsing depth reached", m_ptr);
+
+  m_ptr++; /* '[' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == ']') {
+    m_ptr++;
+    return;
+  }
+
+  while (true) {
+    skip_value(depth);
+
+    skip_ws();
+    if (m_ptr == m_end)
+      fail("']' expected", m_ptr);
+    if (*m_ptr == ']') {
+      m_ptr++;
+      return;
+    }
+    if (*m_ptr != ',')
+      fail("']' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+  }
+}
+
+
+void json_parser::parse_value(json_value& dest, int depth)
+{
+  if (m_ptr == m_end)
+    fail("unexpected end of input", m_ptr);
+
+  switch (*m_ptr) {
+    case '{':
+      parse_object(dest, depth + 1);
+      break;
+    case '[':
+      parse_array(dest, depth + 1);
+      break;
+    case '"':
+      if (is_binary_token(m_ptr, m_end))
+        parse_binary(dest);
+      else {
+        dest = make_string();
+        parse_string(dest.as_string());
+      }
+      break;
+    case 't':
+      parse_literal("true", 4);
+      dest = json_value::make_bool(true);
+      break;
+    case 'f':
+      parse_literal("false", 5);
+      dest = json_value::make_bool(false);
+      break;
+    case 'n':
+      parse_literal("null", 4);
+      dest = json_value::make_null();
+      break;
+    default:
+      if (*m_ptr == '-' || is_digit(*m_ptr))
+        parse_number(dest);
+      else
+        fail("invalid token", m_ptr);
+  }
+}
+
+
+void json_parser::parse_literal(const char* literal, size_t len)
+{
+  if ((size_t)(m_end - m_ptr) < len || memcmp(m_ptr, literal, len) != 0)
+    fail("invalid token", m_ptr);
+  m_ptr += len;
+}
+
+
+void json_parser::parse_object(json_value& dest, int depth)
+{
+  if (depth > max_depth)
+    fail("maximum parsing depth reached", m_ptr);
+
+  dest = make_object();
+  json_object& obj = dest.as_object();
+
+  m_ptr++; /* '{' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == '}') {
+    m_ptr++;
+    return;
+  }
+
+  while (true) {
+    if (m_ptr == m_end || *m_ptr != '"')
+      fail("string or '}' expected", m_ptr);
+
+    std::string key;
+    parse_string(key);
+
+    skip_ws();
+    if (m_ptr == m_end || *m_ptr != ':')
+      fail("':' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+
+    /* parse directly into the member; a duplicate key replaces the earlier
+     * value, as with jansson */
+    parse_value(obj[std::move(key)], depth);
+
+    skip_ws();
+    if (m_ptr == m_end)
+      fail("'}' expected", m_ptr);
+    if (*m_ptr == '}') {
+      m_ptr++;
+      return;
+    }
+    if (*m_ptr != ',')
+      fail("'}' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+  }
+}
+
+
+void json_parser::parse_array(json_value& dest, int depth)
+{
+  if (depth > max_depth)
+    fail("maximum parsing depth reached", m_ptr);
+
+  dest = make_array();
+  json_array& arr = dest.as_array();
+
+  m_ptr++; /* '[' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == ']') {
+    m_ptr++;
+    return;
+  }
+
+  while (true) {
+    arr.emplace_back();
+    parse_value(arr.back(), depth);
+
+    skip_ws();
+    if (m_ptr == m_end)
+      fail("']' expected", m_ptr);
+    if (*m_ptr == ']') {
+      m_ptr++;
+      return;
+    }
+    if (*m_ptr != ',')
+      fail("']' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+  }
+}
+
+
+bool json_parser::parse_events(json_event_handler& handler)
+{
+  skip_ws();
+  if (m_ptr == m_end || (*m_ptr != '{' && *m_ptr != '['))
+    fail("'[' or '{' expected", m_ptr);
+
+  if (!events_value(handler, 0))
+    return false;
+
+  skip_ws();
+  if (m_ptr != m_end)
+    fail("end of file expected", m_ptr);
+  return true;
+}
+
+
+bool json_parser::events_value(json_event_handler& handler, int depth)
+{
+  if (m_ptr == m_end)
+    fail("unexpected end of input", m_ptr);
+
+  switch (*m_ptr) {
+    case '{':
+      return events_object(handler, depth + 1);
+    case '[':
+      return events_array(handler, depth + 1);
+    case '"':
+      if (is_binary_token(m_ptr, m_end)) {
+        json_value jv;
+        parse_binary(jv);
+        return json_emit_events(jv, handler);
+      }
+      m_scratch.clear();
+      parse_string(m_scratch);
+      return handler.string_value(m_scratch.data(), m_scratch.size());
+    case 't':
+      parse_literal("true", 4);
+      return handler.bool_value(true);
+    case 'f':
+      parse_literal("false", 5);
+      return handler.bool_value(false);
+    case 'n':
+      parse_literal("null", 4);
+      return handler.null_value();
+    default:
+      if (*m_ptr == '-' || is_digit(*m_ptr)) {
+        json_value number;
+        parse_number(number);
+        return json_emit_events(number, handler);
+      }
+      fail("invalid token", m_ptr);
+  }
+}
+
+
+bool json_parser::events_object(json_event_handler& handler, int depth)
+{
+  if (depth > max_depth)
+    fail("maximum parsing depth reached", m_ptr);
+
+  if (!handler.start_object())
+    return false;
+
+  m_ptr++; /* '{' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == '}') {
+    m_ptr++;
+    return handler.end_object();
+  }
+
+  while (true) {
+    if (m_ptr == m_end || *m_ptr != '"')
+      fail("string or '}' expected", m_ptr);
+    m_scratch.clear();
+    parse_string(m_scratch);
+    if (!handler.key(m_scratch.data(), m_scratch.size()))
+      return false;
+
+    skip_ws();
+    if (m_ptr == m_end || *m_ptr != ':')
+      fail("':' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+
+    if (!events_value(handler, depth))
+      return false;
+
+    skip_ws();
+    if (m_ptr == m_end)
+      fail("'}' expected", m_ptr);
+    if (*m_ptr == '}') {
+      m_ptr++;
+      return handler.end_object();
+    }
+    if (*m_ptr != ',')
+      fail("'}' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+  }
+}
+
+
+bool json_parser::events_array(json_event_handler& handler, int depth)
+{
+  if (depth > max_depth)
+    fail("maximum parsing depth reached", m_ptr);
+
+  if (!handler.start_array())
+    return false;
+
+  m_ptr++; /* '[' */
+  skip_ws();
+  if (m_ptr != m_end && *m_ptr == ']') {
+    m_ptr++;
+    return handler.end_array();
+  }
+
+  while (true) {
+    if (!events_value(handler, depth))
+      return false;
+
+    skip_ws();
+    if (m_ptr == m_end)
+      fail("']' expected", m_ptr);
+    if (*m_ptr == ']') {
+      m_ptr++;
+      return handler.end_array();
+    }
+    if (*m_ptr != ',')
+      fail("']' expected", m_ptr);
+    m_ptr++;
+    skip_ws();
+  }
+}
+
+
+/* Parse a string which might hold a binary value; if its content is not
+ * valid base64 it is kept as a string. */
+void json_parser::parse_binary(json_value& dest)
+{
+  m_scratch.clear();
+  parse_string(m_scratch);
+
+  dest = m_arena ? m_arena->make_binary(nullptr, 0)
+                 : json_value::make_binary(json_binary());
+  if (!base64_decode(m_scratch.data() + 1, m_scratch.size() - 1, dest.as_binary())) {
+    dest = make_string();
+    dest.as_string() = m_scratch;
+  }
+}
+
+
+void json_parser::parse_string(std::string& dest)
+{
+  const char* p = ++m_ptr; /* opening quote */
+  const char* run = p;
+
+  while (true) {
+    p = scan_plain(p, m_end);
+    if (p == m_end)
+      fail("premature end of input", p);
+
+    const unsigned char c = *p;
+    if (c == '"') {
+      dest.append(run, p - run);
+      m_ptr = p + 1;
+      return;
+    }
+    else if (c == '\\') {
+      dest.append(run, p - run);
+      p = parse_escape(p, dest);
+      run = p;
+    }
+    else if (c < 0x20)
+      fail("control character in string", p);
+    else {
+      size_t n = utf8_sequence_length((const unsigned char*) p, m_end - p);
+      if (n == 0)
+        fail("invalid UTF-8 in string", p);
+      p += n;
+    }
+  }
+}
+
+
+const char* json_parser::parse_escape(const char* p, std::string& dest)
+{
+  const char* const escape = p;
+  if (m_end - p < 2)
+    fail("premature end of input", p);
+
+  switch (p[1]) {
+    case '"':  dest.push_back('"');  return p + 2;
+    case '\\': dest.push_back('\\'); return p + 2;
+    case '/':  dest.push_back('/');  return p + 2;
+    case 'b':  dest.push_back('\b'); return p + 2;
+    case 'f':  dest.push_back('\f'); return p + 2;
+    case 'n':  dest.push_back('\n'); return p + 2;
+    case 'r':  dest.push_back('\r'); return p + 2;
+    case 't':  dest.push_back('\t'); return p + 2;
+    case 'u':  break;
+    default:
+      fail("invalid escape", escape);
+  }
+
+  auto read_hex4 = [this, escape](const char* q) -> uint32_t {
+    if (m_end - q < 4)
+      fail("premature end of input", escape);
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+      int h = hex_value(q[i]);
+      if (h < 0)
+        fail("invalid escape", escape);
+      v = (v << 4) | h;
+    }
+    return v;
+  };
+
+  uint32_t cp = read_hex4(p + 2);
+  p += 6;
+
+  if (cp >= 0xD800 && cp <= 0xDBFF) {
+    /* high surrogate, must be followed by an escaped low surrogate */
+    if (m_end - p < 2 || p[0] != '\\' || p[1] != 'u')
+      fail("invalid Unicode surrogate pair", escape);
+    uint32_t lo = read_hex4(p + 2);
+    if (lo < 0xDC00 || lo > 0xDFFF)
+      fail("invalid Unicode surrogate pair", escape);
+    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+    p += 6;
+  }
+  else if (cp >= 0xDC00 && cp <= 0xDFFF)
+    fail("invalid Unicode surrogate pair", escape);
+
+  append_utf8(dest, cp);
+  return p;
+}
+
+
+void json_parser::parse_number(json_value& dest)
+{
+  const char* const start = m_ptr;
+  const char* p = m_ptr;
+
+  const bool negative = (*p == '-');
+  if (negative)
+    p++;
+
+  if (p == m_end || !is_digit(*p))
+    fail("invalid number", start);
+
+  /* accumulate all mantissa digits, noting if they exceed uint64 */
+  uint64_t mantissa = 0;
+  bool overflow = false;
+  auto add_digit = [&](char c) {
+    const unsigned d = c - '0';
+    if (mantissa > ((std::numeric_limits<uint64_t>::max)() - d) / 10)
+      overflow = true;
+    else
+      mantissa = mantissa * 10 + d;
+  };
+
+  if (*p == '0') {
+    p++;
+    if (p != m_end && is_digit(*p))
+      fail("invalid number", start);
+  } else {
+    while (p != m_end && is_digit(*p))
+      add_digit(*p++);
+  }
+
+  bool is_real = false;
+  int exponent10 = 0;
+
+  if (p != m_end && *p == '.') {
+    is_real = true;
+    p++;
+    if (p == m_end || !is_digit(*p))
+      fail("invalid number", start);
+    while (p != m_end && is_digit(*p)) {
+      add_digit(*p++);
+      exponent10--;
+    }
+  }
+
+  if (p != m_end && (*p == 'e' || *p == 'E')) {
+    is_real = true;
+    p++;
+    bool exp_negative = false;
+    if (p != m_end && (*p == '+' || *p == '-'))
+      exp_negative = (*p++ == '-');
+    if (p == m_end || !is_digit(*p))
+      fail("invalid number", start);
+    int e = 0;
+    while (p != m_end && is_digit(*p)) {
+      if (e < 100000)
+        e = e * 10 + (*p - '0');
+      p++;
+    }
+    exponent10 += exp_negative ? -e : e;
+  }
+
+  m_ptr = p;
+
+  if (!is_real && !overflow) {
+    const uint64_t int64_max = (std::numeric_limits<int64_t>::max)();
+    if (!negative) {
+      if (mantissa <= int64_max)
+        dest = json_value::make_int((int64_t) mantissa);
+      else
+        dest = json_value::make_uint(mantissa);
+      return;
+    }
+    if (mantissa <= int64_max) {
+      dest = json_value::make_int(-(int64_t) mantissa);
+      return;
+    }
+    if (mantissa == int64_max + 1) {
+      dest = json_value::make_int((std::numeric_limits<int64_t>::min)());
+      return;
+    }
+    /* below int64 range; fall through to a real */
+  }
+
+  /* Fast path: when the mantissa and the power of ten are both exactly
+   * representable, a single multiply or divide is correctly rounded. */
+  if (!overflow && mantissa <= (uint64_t(1) << 53) &&
+      exponent10 >= -22 && exponent10 <= 22) {
+    double d = (double) mantissa;
+    if (exponent10 < 0)
+      d /= exact_powers_of_ten[-exponent10];
+    else
+      d *= exact_powers_of_ten[exponent10];
+    dest = json_value::make_double(negative ? -d : d);
+    return;
+  }
+
+  /* Slow path. The token is copied, since the input need not be
+   * null-terminated. */
+  double d = json_strtod(std::string(start, p - start));
+  if (std::isinf(d))
+    fail("real number overflow", start);
+  dest = json_value::make_double(d);
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_JSON_PARSER_H
+#define WAMPCC_JSON_PARSER_H
+
+#include "wampcc/json.h"
+
+namespace wampcc
+{
+
+/* Single pass JSON (RFC 7159) parser, which builds a json_value directly from
+ * the input text. As with the jansson based decoder it replaces, the top level
+ * value must be an object or an array. Integers are decoded exactly over the
+ * full int64 and uint64 ranges. Strings holding a NUL followed by base64 are
+ * decoded as binary. If an arena is provided, container and string nodes are
+ * allocated from it. */
+class json_parser
+{
+public:
+  json_parser(const char* ptr, size_t len, const char* source,
+              json_arena* arena = nullptr);
+
+  void parse(json_value& dest);
+
+  /* Decode the leading items of a top level array, and validate and skip the
+   * remainder; see json_decode_prefix. */
+  void parse_prefix(json_value& dest, json_prefix_fn, json_encoded_items& rest);
+
+  /* Decode as a sequence of events; see json_decode_events. */
+  bool parse_events(json_event_handler&);
+
+private:
+  void parse_value(json_value& dest, int depth);
+  void parse_object(json_value& dest, int depth);
+  void parse_array(json_value& dest, int depth);
+  void parse_string(std::string& dest);
+  void parse_binary(json_value& dest);
+  void parse_number(json_value& dest);
+  bool events_value(json_event_handler&, int depth);
+  bool events_object(json_event_handler&, int depth);
+  bool events_array(json_event_handler&, int depth);
+  void parse_literal(const char* literal, size_t len);
+  JSONType skip_value(int depth);
+  void skip_object(int depth);
+  void skip_array(int depth);
+  const char* parse_escape(const char* p, std::string& dest);
+  void skip_ws();
+
+  json_value make_object();
+  json_value make_array();
+  json_value make_string();
+
+  [[noreturn]] void fail(const char* msg, const char* at) const;
+
+  const char* m_start;
+  const char* m_ptr;
+  const char* m_end;
+  const char* m_source;
+  json_arena* m_arena;
+
+  /* discarded strings, when skipping, and strings passed to an event handler */
+  std::string m_scratch;
+};
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef WAMPCC_JSON_TEXT_H
+#define WAMPCC_JSON_TEXT_H
+
+#include <string>
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define WAMPCC_JSON_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Helpers shared by the JSON parser and encoder. */
+
+namespace wampcc
+{
+
+/* Length of the well-formed UTF-8 sequence at 'p', or 0 if invalid. */
+static inline size_t utf8_sequence_length(const unsigned char* p, size_t avail)
+{
+  const unsigned char c = p[0];
+  size_t n;
+  unsigned char lo = 0x80, hi = 0xBF;
+
+  if (c >= 0xC2 && c <= 0xDF)
+    n = 2;
+  else if (c == 0xE0) {
+    n = 3;
+    lo = 0xA0;
+  } else if ((c >= 0xE1 && c <= 0xEC) || c == 0xEE || c == 0xEF)
+    n = 3;
+  else if (c == 0xED) {
+    n = 3;
+    hi = 0x9F;
+  } else if (c == 0xF0) {
+    n = 4;
+    lo = 0x90;
+  } else if (c >= 0xF1 && c <= 0xF3)
+    n = 4;
+  else if (c == 0xF4) {
+    n = 4;
+    hi = 0x8F;
+  } else
+    return 0;
+
+  if (avail < n || p[1] < lo || p[1] > hi)
+    return 0;
+  for (size_t i = 2; i < n; i++)
+    if ((p[i] & 0xC0) != 0x80)
+      return 0;
+  return n;
+}
+
+
+/* Index of the lowest set bit of a non-zero SSE2 byte mask */
+static inline unsigned first_set_bit(unsigned mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (unsigned) index;
+#else
+  return (unsigned) __builtin_ctz(mask);
+#endif
+}
+
+
+/* Decimal point of the LC_NUMERIC locale, which the C library number
+ * conversions use in place of the '.' of JSON. */
+static inline const char* locale_decimal_point()
+{
+  const char* point = localeconv()->decimal_point;
+  return (point && *point) ? point : ".";
+}
+
+
+static inline bool locale_uses_period()
+{
+  const char* point = locale_decimal_point();
+  return point[0] == '.' && point[1] == '\0';
+}
+
+
+/* Rewrite a number formatted by the C library in the current locale to use
+ * the '.' of JSON; returns the new length of the null-terminated buffer. */
+static inline size_t from_locale_number(char* buf, size_t len)
+{
+  if (locale_uses_period())
+    return len;
+
+  const char* point = locale_decimal_point();
+  char* pos = strstr(buf, point);
+  if (!pos)
+    return len;
+
+  size_t point_len = strlen(point);
+  *pos = '.';
+  memmove(pos + 1, pos + point_len, len - (pos - buf) - point_len + 1);
+  return len - (point_len - 1);
+}
+
+
+/* Convert the text of a JSON number to a double, whatever the locale; as
+ * jansson does, the locale's decimal point is swapped in for strtod. */
+static inline double json_strtod(std::string token)
+{
+  if (!locale_uses_period()) {
+    size_t pos = token.find('.');
+    if (pos != std::string::npos)
+      token.replace(pos, 1, locale_decimal_point());
+  }
+  return strtod(token.c_str(), nullptr);
+}
+
+}
+
+#endif
@@ -7,425 +7,536 @@
 
 #include "msgpack_serialiser.h"
 
-#include <iostream>
-#include <stack>
-#include <sstream>
+#include <limits>
 
-//#define WAMPCC_TRACE_MSGPACK
+#include <string.h>
 
 namespace wampcc
 {
 
-static void free_msgpack_bytes(region* ptr)
+/* guard against stack exhaustion from hostile input */
+static const int max_depth = 2048;
+
+typedef uint32_t t_msgpack_size;
+
+void msgpack_encoder::put_head(uint8_t type, uint64_t arg, size_t bytes)
 {
-  if (ptr)
-    ::free(ptr->first);
+  char buf[9];
+  buf[0] = (char) type;
+  for (size_t i = 0; i < bytes; i++)
+    buf[1 + i] = (char)(arg >> (8 * (bytes - 1 - i)));
+  m_dest.insert(m_dest.end(), buf, buf + 1 + bytes);
+}
+
 
-  delete ptr;
+void msgpack_encoder::put_uint(uint64_t v)
+{
+  if (v < 0x80)
+    m_dest.push_back((char) v);
+  else if (v <= 0xFF)
+    put_head(0xcc, v, 1);
+  else if (v <= 0xFFFF)
+    put_head(0xcd, v, 2);
+  else if (v <= 0xFFFFFFFF)
+    put_head(0xce, v, 4);
+  else
+    put_head(0xcf, v, 8);
 }
 
-msgpack_encoder::msgpack_encoder() : m_packer(m_sbuf) {}
 
-typedef uint32_t t_msgpack_size;
+void msgpack_encoder::put_int(int64_t v)
+{
+  if (v >= 0)
+    put_uint((uint64_t) v);
+  else if (v >= -32)
+    m_dest.push_back((char) v);
+  else if (v >= -128)
+    put_head(0xd0, (uint64_t) v, 1);
+  else if (v >= -32768)
+    put_head(0xd1, (uint64_t) v, 2);
+  else if (v >= (std::numeric_limits<int32_t>::min)())
+    put_head(0xd2, (uint64_t) v, 4);
+  else
+    put_head(0xd3, (uint64_t) v, 8);
+}
 
-std::unique_ptr<region, void (*)(region*)> msgpack_encoder::encode(
-    const json_value& src)
+
+void msgpack_encoder::put_double(double d)
 {
-  pack_value(src);
-  size_t len = m_sbuf.size(); // size() must be called before release()
-  return {new region(m_sbuf.release(), len), free_msgpack_bytes};
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  put_head(0xcb, bits, 8);
 }
 
-void msgpack_encoder::pack_string(const std::string& s)
+
+void msgpack_encoder::put_string(const std::string& s)
 {
   if (s.size() > (std::numeric_limits<t_msgpack_size>::max)())
     throw msgpack_error("string exceeds msgpack max size");
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_str (len " << s.size() << ")" << std::endl;
-#endif
-  m_packer.pack_str(s.size());
-
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_str_body" << std::endl;
-#endif
-  m_packer.pack_str_body(s.c_str(), s.size());
+  if (s.size() < 32)
+    m_dest.push_back((char)(0xa0 | s.size()));
+  else if (s.size() <= 0xFF)
+    put_head(0xd9, s.size(), 1);
+  else if (s.size() <= 0xFFFF)
+    put_head(0xda, s.size(), 2);
+  else
+    put_head(0xdb, s.size(), 4);
+  m_dest.insert(m_dest.end(), s.begin(), s.end());
 }
 
-void msgpack_encoder::pack_object(const json_object& jobject)
+
+void msgpack_encoder::put_binary(const json_binary& b)
 {
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_map(items " << jobject.size() << ")" << std::endl;
-#endif
-  m_packer.pack_map(jobject.size());
-
-  for (auto& item : jobject) {
-    pack_string(item.first);
-    pack_value(item.second);
-  }
+  if (b.size() > (std::numeric_limits<t_msgpack_size>::max)())
+    throw msgpack_error("binary exceeds msgpack max size");
+
+  if (b.size() <= 0xFF)
+    put_head(0xc4, b.size(), 1);
+  else if (b.size() <= 0xFFFF)
+    put_head(0xc5, b.size(), 2);
+  else
+    put_head(0xc6, b.size(), 4);
+  m_dest.insert(m_dest.end(), b.begin(), b.end());
 }
 
-void msgpack_encoder::pack_array(const json_array& ja)
+
+void msgpack_encoder::put_array(const json_array& ja)
 {
   if (ja.size() > (std::numeric_limits<t_msgpack_size>::max)())
     throw msgpack_error("json_array exceeds msgpack max size");
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::cout << "pack_array(items " << ja.size() << ")" << std::endl;
-#endif
-  m_packer.pack_array(ja.size());
+  if (ja.size() < 16)
+    m_dest.push_back((char)(0x90 | ja.size()));
+  else if (ja.size() <= 0xFFFF)
+    put_head(0xdc, ja.size(), 2);
+  else
+    put_head(0xdd, ja.size(), 4);
+
   for (auto& item : ja)
-    pack_value(item);
+    encode(item);
+}
+
+
+void msgpack_encoder::put_object(const json_object& jo)
+{
+  if (jo.size() > (std::numeric_limits<t_msgpack_size>::max)())
+    throw msgpack_error("json_object exceeds msgpack max size");
+
+  if (jo.size() < 16)
+    m_dest.push_back((char)(0x80 | jo.size()));
+  else if (jo.size() <= 0xFFFF)
+    put_head(0xde, jo.size(), 2);
+  else
+    put_head(0xdf, jo.size(), 4);
+
+  for (auto& item : jo) {
+    put_string(item.first);
+    encode(item.second);
+  }
 }
 
-void msgpack_encoder::pack_value(const json_value& jv)
+
+void msgpack_encoder::encode(const json_value& jv)
 {
   switch (jv.type()) {
-    case wampcc::eNULL: {
-#ifdef WAMPCC_TRACE_MSGPACK
-      std::cout << "pack_nil" << std::endl;
-#endif
-      m_packer.pack_nil();
+    case wampcc::eNULL:
+      m_dest.push_back((char) 0xc0);
       break;
-    }
-    case wampcc::eOBJECT: {
-      pack_object(jv.as_object());
+    case wampcc::eBOOL:
+      m_dest.push_back((char)(jv.as_bool() ? 0xc3 : 0xc2));
       break;
-    }
-    case wampcc::eARRAY: {
-      pack_array(jv.as_array());
+    case wampcc::eREAL:
+      put_double(jv.as_real());
       break;
-    }
-    case wampcc::eSTRING: {
-      pack_string(jv.as_string());
+    case wampcc::eINTEGER:
+      if (jv.is_int())
+        put_int(jv.as_int());
+      else
+        put_uint(jv.as_uint());
       break;
-    }
-    case wampcc::eBOOL: {
-      if (jv.as_bool() == true) {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_true" << std::endl;
-#endif
-        m_packer.pack_true();
-      } else {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_false" << std::endl;
-#endif
-        m_packer.pack_false();
-      }
+    case wampcc::eSTRING:
+      put_string(jv.as_string());
       break;
-    }
-    case wampcc::eREAL: {
-#ifdef WAMPCC_TRACE_MSGPACK
-      std::cout << "pack_double" << std::endl;
-#endif
-      m_packer.pack_double(jv.as_real());
+    case wampcc::eBINARY:
+      put_binary(jv.as_binary());
       break;
-    }
-    case wampcc::eINTEGER: {
-      if (jv.is_int()) {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_long_long" << std::endl;
-#endif
-        m_packer.pack_long_long(jv.as_int());
-      } else {
-#ifdef WAMPCC_TRACE_MSGPACK
-        std::cout << "pack_unsigned_long_long" << std::endl;
-#endif
-        m_packer.pack_unsigned_long_long(jv.as_uint());
-      }
+    case wampcc::eARRAY:
+      put_array(jv.as_array());
+      break;
+    case wampcc::eOBJECT:
+      put_object(jv.as_object());
       break;
-    }
   }
 }
 
-class msgpack_visitor
+
+msgpack_decoder::msgpack_decoder(const char* ptr, size_t len,
+                                 json_arena* arena)
+  : m_ptr((const uint8_t*) ptr),
+    m_end((const uint8_t*) ptr + len),
+    m_start((const uint8_t*) ptr),
+    m_arena(arena)
 {
-public:
-  /* Add the currently parsed json_value into the json document, which means we
-   * either add it to a parent array, or to a parent object, or if we are
-   * parsing a map-key, we use it for a mapkey. */
-  json_value* add(json_value&& jv)
-  {
-    switch (m_parse_mode) {
-      case parse_mode::init: {
-        m_root = std::move(jv);
-        m_parse_mode = parse_mode::undef;
-        return &m_root;
-      }
-      case parse_mode::undef: {
-        throw msgpack_error("add json_value called for undefied parse_mode");
-      }
-      case parse_mode::array: {
-        if (m_containers.empty())
-          throw msgpack_error(
-              "add array-item attempted without parent container");
-
-        json_array& arr = m_containers.top()->as_array();
-        arr.push_back(std::move(jv));
-        return &arr.back();
-      }
-      case parse_mode::object: {
-        if (m_containers.empty())
-          throw msgpack_error(
-              "add object-item attempted without parent container");
-        if (!m_have_map_key)
-          throw msgpack_error("add object-item attempted without map-key");
-
-        m_have_map_key = false;
-        json_object& obj = m_containers.top()->as_object();
-        auto ins = obj.insert({std::move(m_map_key), std::move(jv)});
-        return &(ins.first->second);
-      }
-      case parse_mode::mapkey: {
-        if (m_have_map_key)
-          throw msgpack_error("map-key assigned attempted when map_key already available");
+}
 
-        m_map_key = std::move(jv.as_string());
-        m_have_map_key = true;
-        return nullptr;
-      }
-    }
-    return nullptr;
-  }
 
-  bool visit_boolean(bool v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_bool(v));
-    return true;
-  }
+void msgpack_decoder::fail(const char* msg) const
+{
+  throw msgpack_error(msg, m_ptr - m_start, m_ptr - m_start);
+}
 
-  bool visit_nil()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    add(json_value::make_null());
-    return true;
-  }
 
-  bool visit_float(double v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_double(v));
-    return true;
-  }
+const uint8_t* msgpack_decoder::take(uint64_t n)
+{
+  if (n > (uint64_t)(m_end - m_ptr))
+    fail("insufficient bytes when parsing msgpack");
+  const uint8_t* p = m_ptr;
+  m_ptr += n;
+  return p;
+}
 
-  bool visit_negative_integer(int64_t v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_int(v));
-    return true;
-  }
 
-  bool visit_positive_integer(uint64_t v)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << v << std::endl;
-#endif
-    add(json_value::make_uint(v));
-    return true;
-  }
+uint64_t msgpack_decoder::read_be(size_t bytes)
+{
+  const uint8_t* p = take(bytes);
+  uint64_t v = 0;
+  for (size_t i = 0; i < bytes; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
 
-  bool visit_str(const char* v, uint32_t size)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ":" << std::string(v, size)
-              << std::endl;
-#endif
-    add(json_value::make_string(v, size));
-    return true;
-  }
 
-  bool start_map_key()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::mapkey;
-    return true;
+msgpack_decoder::head msgpack_decoder::read_head()
+{
+  const uint8_t b = *take(1);
+
+  if (b <= 0x7f) return {kind::uint, b};
+  if (b <= 0x8f) return {kind::map, uint64_t(b & 0x0f)};
+  if (b <= 0x9f) return {kind::array, uint64_t(b & 0x0f)};
+  if (b <= 0xbf) return {kind::str, uint64_t(b & 0x1f)};
+  if (b >= 0xe0) return {kind::sint, (uint64_t)(int64_t)(int8_t) b};
+
+  switch (b) {
+    case 0xc0: return {kind::nil, 0};
+    case 0xc2: return {kind::boolean, 0};
+    case 0xc3: return {kind::boolean, 1};
+    case 0xc4: return {kind::bin, read_be(1)};
+    case 0xc5: return {kind::bin, read_be(2)};
+    case 0xc6: return {kind::bin, read_be(4)};
+    case 0xc7: return {kind::ext, read_be(1) + 1}; /* +1 for ext type */
+    case 0xc8: return {kind::ext, read_be(2) + 1};
+    case 0xc9: return {kind::ext, read_be(4) + 1};
+    case 0xca: return {kind::float32, read_be(4)};
+    case 0xcb: return {kind::float64, read_be(8)};
+    case 0xcc: return {kind::uint, read_be(1)};
+    case 0xcd: return {kind::uint, read_be(2)};
+    case 0xce: return {kind::uint, read_be(4)};
+    case 0xcf: return {kind::uint, read_be(8)};
+    case 0xd0: return {kind::sint, (uint64_t)(int64_t)(int8_t) read_be(1)};
+    case 0xd1: return {kind::sint, (uint64_t)(int64_t)(int16_t) read_be(2)};
+    case 0xd2: return {kind::sint, (uint64_t)(int64_t)(int32_t) read_be(4)};
+    case 0xd3: return {kind::sint, read_be(8)};
+    case 0xd4: return {kind::ext, 2};
+    case 0xd5: return {kind::ext, 3};
+    case 0xd6: return {kind::ext, 5};
+    case 0xd7: return {kind::ext, 9};
+    case 0xd8: return {kind::ext, 17};
+    case 0xd9: return {kind::str, read_be(1)};
+    case 0xda: return {kind::str, read_be(2)};
+    case 0xdb: return {kind::str, read_be(4)};
+    case 0xdc: return {kind::array, read_be(2)};
+    case 0xdd: return {kind::array, read_be(4)};
+    case 0xde: return {kind::map, read_be(2)};
+    case 0xdf: return {kind::map, read_be(4)};
   }
 
-  bool end_map_key()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::undef;
-    return true;
-  }
+  m_ptr--;
+  fail("invalid msgpack type byte");
+}
 
-  bool start_map(uint32_t pairs)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ": items " << pairs
-              << std::endl;
-    m_indent += "  ";
-#endif
-    add_container(json_object());
-    return true;
-  }
 
-  bool end_map()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    m_indent = m_indent.substr(0, m_indent.size() - 2);
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_containers.pop();
-    return true;
-  }
+/* Number of items of a container, checked against the remaining input so
+ * that a hostile header cannot trigger a huge allocation. */
+uint64_t msgpack_decoder::container_size(const head& h,
+                                         uint64_t min_item_bytes)
+{
+  if (h.arg > (uint64_t)(m_end - m_ptr) / min_item_bytes)
+    fail("insufficient bytes when parsing msgpack");
+  return h.arg;
+}
 
-  bool start_map_value()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::object;
-    return true;
-  }
 
-  bool end_map_value()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::undef;
-    return true;
-  }
+json_value msgpack_decoder::make_object()
+{
+  return m_arena ? m_arena->make_object() : json_value::make_object();
+}
 
-  bool start_array(uint32_t num_elements)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << ": size " << num_elements
-              << std::endl;
-    m_indent += "  ";
-#endif
-    json_array array;
-    array.reserve(num_elements);
-    add_container(std::move(array));
-    return true;
-  }
 
-  bool end_array()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    m_indent = m_indent.substr(0, m_indent.size() - 2);
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_containers.pop();
-    return true;
-  }
+json_value msgpack_decoder::make_array()
+{
+  return m_arena ? m_arena->make_array() : json_value::make_array();
+}
 
-  bool start_array_item()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::array;
-    return true;
-  }
 
-  bool end_array_item()
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    m_parse_mode = parse_mode::undef;
-    return true;
-  }
+json_value msgpack_decoder::decode_item(int depth)
+{
+  if (depth > max_depth)
+    fail("msgpack nesting too deep");
 
-  [[ noreturn ]] void parse_error(size_t parsed_offset, size_t error_offset)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    throw msgpack_error("parse error when parsing msgpack", parsed_offset,
-                        error_offset);
-  }
+  const head h = read_head();
 
-  [[ noreturn ]] void insufficient_bytes(size_t parsed_offset, size_t error_offset)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    throw msgpack_error("insufficient bytes when parsing msgpack",
-                        parsed_offset, error_offset);
-  }
+  switch (h.type) {
+    case kind::nil:
+      return json_value::make_null();
 
-  bool visit_bin(const char* /*v*/, uint32_t /*size*/)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    return true;
-  }
-  bool visit_ext(const char* /*v*/, uint32_t /*size*/)
-  {
-#ifdef WAMPCC_TRACE_MSGPACK
-    std::cout << m_indent << __FUNCTION__ << std::endl;
-#endif
-    return true;
-  }
+    case kind::boolean:
+      return json_value::make_bool(h.arg != 0);
 
-  json_value& root() { return m_root; }
-  const json_value& root() const { return m_root; }
+    case kind::uint:
+      return json_value::make_uint(h.arg);
 
-  bool is_good() const {
-    return m_containers.empty() &&
-      (m_have_map_key == false) &&
-      (m_parse_mode == parse_mode::undef);
+    case kind::sint: {
+      /* as with msgpack-c, non-negative values decode as unsigned */
+      const int64_t v = (int64_t) h.arg;
+      return v < 0 ? json_value::make_int(v) : json_value::make_uint(v);
+    }
+
+    case kind::float32: {
+      const uint32_t bits = (uint32_t) h.arg;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      return json_value::make_double(f);
+    }
+
+    case kind::float64: {
+      double d;
+      memcpy(&d, &h.arg, sizeof(d));
+      return json_value::make_double(d);
+    }
+
+    case kind::str: {
+      const char* p = (const char*) take(h.arg);
+      return m_arena ? m_arena->make_string(p, h.arg)
+                     : json_value::make_string(p, h.arg);
+    }
+
+    case kind::bin: {
+      const char* p = (const char*) take(h.arg);
+      return m_arena ? m_arena->make_binary(p, h.arg)
+                     : json_value::make_binary(p, h.arg);
+    }
+
+    case kind::array: {
+      const uint64_t n = container_size(h, 1);
+      json_value jv = make_array();
+      json_array& ja = jv.as_array();
+      ja.reserve(n);
+      for (uint64_t i = 0; i < n; i++)
+        ja.push_back(decode_item(depth + 1));
+      return jv;
+    }
+
+    case kind::map: {
+      const uint64_t n = container_size(h, 2);
+      json_value jv = make_object();
+      json_object& jo = jv.as_object();
+      jo.reserve(n);
+      for (uint64_t i = 0; i < n; i++) {
+        const head key = read_head();
+        if (key.type != kind::str)
+          fail("msgpack map key must be a string");
+        const char* p = (const char*) take(key.arg);
+        jo[std::string(p, key.arg)] = decode_item(depth + 1);
+      }
+      return jv;
+    }
+
+    case kind::ext:
+      break;
   }
 
-private:
-  /* Here 'container' is a univeral reference, however we want to restrict this
-   * template to accepting only rvalue references. */
-  template <typename T, class = typename std::enable_if<
-                            !std::is_lvalue_reference<T>::value>::type>
-  void add_container(T&& container)
-  {
-    json_value* p = add(json_value(std::move(container)));
-    m_containers.push(p);
+  fail("msgpack ext type not supported");
+}
+
+
+/* Validate and step over an item, without building it.  Accepts the same
+ * input as decode_item. */
+JSONType msgpack_decoder::skip_item(int depth)
+{
+  if (depth > max_depth)
+    fail("msgpack nesting too deep");
+
+  const head h = read_head();
+
+  switch (h.type) {
+    case kind::nil: return eNULL;
+    case kind::boolean: return eBOOL;
+    case kind::uint:
+    case kind::sint: return eINTEGER;
+    case kind::float32:
+    case kind::float64: return eREAL;
+    case kind::str:
+      take(h.arg);
+      return eSTRING;
+    case kind::bin:
+      take(h.arg);
+      return eBINARY;
+    case kind::array: {
+      const uint64_t n = container_size(h, 1);
+      for (uint64_t i = 0; i < n; i++)
+        skip_item(depth + 1);
+      return eARRAY;
+    }
+    case kind::map: {
+      const uint64_t n = container_size(h, 2);
+      for (uint64_t i = 0; i < n; i++) {
+        const head key = read_head();
+        if (key.type != kind::str)
+          fail("msgpack map key must be a string");
+        take(key.arg);
+        skip_item(depth + 1);
+      }
+      return eOBJECT;
+    }
+    case kind::ext:
+      break;
   }
 
-  json_value m_root;
+  fail("msgpack ext type not supported");
+}
+
+
+/* As decode_item, but report the item to an event handler.  Strings, binary
+ * and keys are passed by pointer into the input, without being copied. */
+bool msgpack_decoder::events_item(json_event_handler& handler, int depth)
+{
+  if (depth > max_depth)
+    fail("msgpack nesting too deep");
 
-#ifdef WAMPCC_TRACE_MSGPACK
-  std::string m_indent;
-#endif
+  const head h = read_head();
 
-  std::stack<json_value*> m_containers;
+  switch (h.type) {
+    case kind::nil:
+      return handler.null_value();
 
-  std::string m_map_key;
+    case kind::boolean:
+      return handler.bool_value(h.arg != 0);
 
-  /* Do we have a map-key? */
-  bool m_have_map_key = false;
+    case kind::uint:
+      return handler.uint_value(h.arg);
+
+    case kind::sint: {
+      const int64_t v = (int64_t) h.arg;
+      return v < 0 ? handler.int_value(v) : handler.uint_value(v);
+    }
+
+    case kind::float32: {
+      const uint32_t bits = (uint32_t) h.arg;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      return handler.real_value(f);
+    }
+
+    case kind::float64: {
+      double d;
+      memcpy(&d, &h.arg, sizeof(d));
+      return handler.real_value(d);
+    }
 
-  /* What kind of value is currently being parsed and added to the documet? */
-  enum class parse_mode {
-    undef,  /* nothing */
-    init,   /* the first item */
-    array,  /* an array-cell */
-    object, /* an object-item (value) */
-    mapkey  /* an object-item (key) */
-  } m_parse_mode = parse_mode::init;
-};
+    case kind::str: {
+      const char* p = (const char*) take(h.arg);
+      return handler.string_value(p, h.arg);
+    }
+
+    case kind::bin: {
+      const uint8_t* p = take(h.arg);
+      return handler.binary_value(p, h.arg);
+    }
+
+    case kind::array: {
+      const uint64_t n = container_size(h, 1);
+      if (!handler.start_array())
+        return false;
+      for (uint64_t i = 0; i < n; i++)
+        if (!events_item(handler, depth + 1))
+          return false;
+      return handler.end_array();
+    }
+
+    case kind::map: {
+      const uint64_t n = container_size(h, 2);
+      if (!handler.start_object())
+        return false;
+      for (uint64_t i = 0; i < n; i++) {
+        const head key = read_head();
+        if (key.type != kind::str)
+          fail("msgpack map key must be a string");
+        const char* p = (const char*) take(key.arg);
+        if (!handler.key(p, key.arg) || !events_item(handler, depth + 1))
+          return false;
+      }
+      return handler.end_object();
+    }
 
-bool msgpack_decoder::decode(const char* src, size_t len)
+    case kind::ext:
+      break;
+  }
+
+  fail("msgpack ext type not supported");
+}
+
+
+bool msgpack_decoder::decode_events(json_event_handler& handler)
+{
+  if (!events_item(handler, 0))
+    return false;
+  if (m_ptr != m_end)
+    fail("trailing bytes after msgpack data");
+  return true;
+}
+
+
+json_value msgpack_decoder::decode()
 {
-  msgpack_visitor visitor;
+  json_value jv = decode_item(0);
+  if (m_ptr != m_end)
+    fail("trailing bytes after msgpack data");
+  return jv;
+}
+
 
-  bool success = msgpack::parse<msgpack_visitor>(src, len, visitor);
+json_value msgpack_decoder::decode_prefix(json_prefix_fn prefix,
+                                          json_encoded_items& rest)
+{
+  rest = json_encoded_items();
+
+  const head h = read_head();
+  if (h.type != kind::array)
+    fail("msgpack array expected");
+  const uint64_t count = container_size(h, 1);
+
+  json_value dest = make_array();
+  json_array& arr = dest.as_array();
+
+  size_t decode_count = 1;
+  for (uint64_t i = 0; i < count; i++) {
+    if (arr.size() < decode_count) {
+      arr.push_back(decode_item(1));
+      if (arr.size() == 1)
+        decode_count = prefix(arr[0]);
+    } else {
+      if (rest.types.empty())
+        rest.ptr = (const char*) m_ptr;
+      rest.types.push_back(skip_item(1));
+      rest.len = (const char*) m_ptr - rest.ptr;
+    }
+  }
 
-  if (success && visitor.is_good())
-    this->result = std::move(visitor.root());
+  if (m_ptr != m_end)
+    fail("trailing bytes after msgpack array");
 
-  return success && visitor.is_good();
+  return dest;
 }
+
 }
@@ -10,38 +10,82 @@
 
 #include "wampcc/json.h"
 
-#include "msgpack.hpp"
+#include <vector>
 
 namespace wampcc
 {
 
+/* Encode a json_value as msgpack, appending to a byte vector.  Each item is
+ * written in its smallest msgpack representation, except reals, which are
+ * always written as float 64. */
 class msgpack_encoder
 {
 public:
-  msgpack_encoder();
-  std::unique_ptr<region, void(*)(region*)> encode(const json_value &);
+  msgpack_encoder(std::vector<char>& dest) : m_dest(dest) {}
+
+  void encode(const json_value&);
 
 private:
-  msgpack::sbuffer m_sbuf;
-  msgpack::packer<msgpack::sbuffer> m_packer;
+  void put_head(uint8_t type, uint64_t arg, size_t bytes);
+  void put_uint(uint64_t);
+  void put_int(int64_t);
+  void put_double(double);
+  void put_string(const std::string&);
+  void put_binary(const json_binary&);
+  void put_array(const json_array&);
+  void put_object(const json_object&);
 
-  void pack_array(const json_array &);
-  void pack_object(const json_object &);
-  void pack_value(const json_value&);
-  void pack_string(const std::string&);
+  std::vector<char>& m_dest;
 };
 
 
+/* Decode msgpack directly into a json_value, by recursive descent. Container
+ * sizes are taken from their headers, so arrays and objects are sized before
+ * their items are decoded, and no parse stack is needed. Map keys must be
+ * strings, and ext items are not supported. If an arena is provided,
+ * container, string and binary nodes are allocated from it. */
 class msgpack_decoder
 {
 public:
-  json_value result;
+  msgpack_decoder(const char* ptr, size_t len, json_arena* arena = nullptr);
 
-  bool decode(const char *, size_t);
-};
+  json_value decode();
+
+  /* Decode the leading items of a top level array, and validate and skip the
+   * remainder; see json_msgpack_decode_prefix. */
+  json_value decode_prefix(json_prefix_fn, json_encoded_items& rest);
 
+  /* Decode as a sequence of events; see json_msgpack_decode_events. */
+  bool decode_events(json_event_handler&);
+
+private:
+  enum class kind { nil, boolean, uint, sint, float32, float64,
+                    str, bin, array, map, ext };
 
+  struct head
+  {
+    kind type;
+    uint64_t arg; /* value, or length */
+  };
 
+  head read_head();
+  json_value decode_item(int depth);
+  JSONType skip_item(int depth);
+  bool events_item(json_event_handler&, int depth);
+  uint64_t read_be(size_t bytes);
+  const uint8_t* take(uint64_t);
+  uint64_t container_size(const head&, uint64_t min_item_bytes);
+
+  json_value make_object();
+  json_value make_array();
+
+  [[noreturn]] void fail(const char* msg) const;
+
+  const uint8_t* m_ptr;
+  const uint8_t* m_end;
+  const uint8_t* m_start;
+  json_arena* m_arena;
+};
 
 }
 
@@ -94,7 +94,14 @@ void event_loop::dispatch(std::chrono::milliseconds delay, timer_fn fn)
 }
 
 
-void event_loop::dispatch(std::chrono::milliseconds delay,
+void event_loop::dispatch_after(std::chrono::microseconds delay,
+                                std::function<void()> fn)
+{
+  dispatch(delay, std::make_shared<ev_function_dispatch>(std::move(fn)));
+}
+
+
+void event_loop::dispatch(std::chrono::steady_clock::duration delay,
                           std::shared_ptr<event> sp)
 {
   auto tp_due = std::chrono::steady_clock::now() + delay;
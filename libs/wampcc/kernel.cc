@@ -32,9 +32,12 @@ std::mutex logger::lockable_console::stream_mutex ;
 logger::lockable_console logger::lockable_cout;
 
 static long default_socket_max_pending_write_bytes = 0x100000; // 1mb
+static long default_socket_conflation_threshold_bytes = 0x40000; // 256kb
 
 config::config()
   : socket_max_pending_write_bytes(default_socket_max_pending_write_bytes),
+    socket_conflation_threshold_bytes(default_socket_conflation_threshold_bytes),
+    pubsub_shard_threads(0),
     ssl(false)
 {
 }
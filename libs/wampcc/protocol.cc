@@ -14,27 +14,255 @@
 #include "wampcc/utils.h"
 #include "wampcc/websocket_protocol.h"
 
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 
 #include <string.h>
 
 namespace wampcc {
 
+  /* Each decoded message gets its own arena, so that its nodes are released
+   * together.  Blocks are sized to the message, so that a small message, part
+   * of which may be retained, does not pin a full sized block. */
+  static size_t arena_block_size(size_t msglen)
+  {
+    return (std::min)(json_arena::default_block_size, 256 + 4 * msglen);
+  }
+
+  /* Append the encoding of a single item */
+  static void encode_item(serialiser_type st, const json_value& item,
+                          std::vector<char>& dest)
+  {
+    switch (st) {
+      case serialiser_type::msgpack:
+        wampcc::json_msgpack_encode(item, dest);
+        break;
+      case serialiser_type::cbor:
+        wampcc::json_cbor_encode(item, dest);
+        break;
+      default:
+        wampcc::json_encode(item, dest, true);
+    }
+  }
+
+  static void put_be(size_t n, int bytes, std::vector<char>& dest)
+  {
+    for (int i = bytes - 1; i >= 0; i--)
+      dest.push_back((char) ((n >> (8 * i)) & 0xFF));
+  }
+
+  /* Append the header of an array of 'n' items */
+  static void put_array_header(serialiser_type st, size_t n,
+                               std::vector<char>& dest)
+  {
+    switch (st) {
+      case serialiser_type::msgpack:
+        if (n < 16)
+          dest.push_back((char) (0x90 | n));
+        else if (n < 0x10000) {
+          dest.push_back((char) 0xdc);
+          put_be(n, 2, dest);
+        } else {
+          dest.push_back((char) 0xdd);
+          put_be(n, 4, dest);
+        }
+        break;
+      case serialiser_type::cbor:
+        if (n < 24)
+          dest.push_back((char) (0x80 | n));
+        else if (n < 0x100) {
+          dest.push_back((char) 0x98);
+          put_be(n, 1, dest);
+        } else if (n < 0x10000) {
+          dest.push_back((char) 0x99);
+          put_be(n, 2, dest);
+        } else {
+          dest.push_back((char) 0x9a);
+          put_be(n, 4, dest);
+        }
+        break;
+      default:
+        dest.push_back('[');
+    }
+  }
+
+  static json_value decode_items(const encoded_args& tail)
+  {
+    const char* ptr = tail.bytes.data();
+    const size_t len = tail.bytes.size();
+    switch (tail.serialiser) {
+      case serialiser_type::msgpack:
+        return wampcc::json_msgpack_decode(ptr, len);
+      case serialiser_type::cbor:
+        return wampcc::json_cbor_decode(ptr, len);
+      default:
+        return wampcc::json_decode(ptr, len);
+    }
+  }
+
+  void codec::encode(const json_array& head, const encoded_args& tail,
+                     std::vector<char>& dest)
+  {
+    const serialiser_type st = base_type();
+
+    if (tail.serialiser == st) {
+      put_array_header(st, head.size() + tail.count, dest);
+      for (auto& item : head) {
+        encode_item(st, item, dest);
+        if (st == serialiser_type::json)
+          dest.push_back(',');
+      }
+      dest.insert(dest.end(), tail.bytes.begin() + tail.items_begin,
+                  tail.bytes.begin() + tail.items_end);
+      if (st == serialiser_type::json)
+        dest.push_back(']');
+    }
+    else {
+      /* peer uses a different serialiser, so must transcode */
+      json_value items = decode_items(tail);
+      put_array_header(st, head.size() + tail.count, dest);
+      bool first = true;
+      for (auto& item : head) {
+        if (!first && st == serialiser_type::json)
+          dest.push_back(',');
+        encode_item(st, item, dest);
+        first = false;
+      }
+      for (auto& item : items.as_array()) {
+        if (!first && st == serialiser_type::json)
+          dest.push_back(',');
+        encode_item(st, item, dest);
+        first = false;
+      }
+      if (st == serialiser_type::json)
+        dest.push_back(']');
+    }
+  }
+
+
+  void wamp_args::decode()
+  {
+    if (!encoded)
+      return;
+
+    json_value items = decode_items(*encoded);
+    json_array& ja = items.as_array();
+    if (ja.size() > 0)
+      args_list = std::move(ja[0].as_array());
+    if (ja.size() > 1)
+      args_dict = std::move(ja[1].as_object());
+    encoded.reset();
+  }
+
+
+  bool wamp_args::operator==(const wamp_args& rhs) const
+  {
+    /* identical encodings need not be decoded */
+    if (encoded && rhs.encoded &&
+        encoded->serialiser == rhs.encoded->serialiser &&
+        encoded->bytes == rhs.encoded->bytes)
+      return true;
+
+    wamp_args lhs_decoded, rhs_decoded;
+    const wamp_args* lhs_ptr = this;
+    const wamp_args* rhs_ptr = &rhs;
+    if (encoded) {
+      lhs_decoded.encoded = encoded;
+      lhs_decoded.decode();
+      lhs_ptr = &lhs_decoded;
+    }
+    if (rhs.encoded) {
+      rhs_decoded.encoded = rhs.encoded;
+      rhs_decoded.decode();
+      rhs_ptr = &rhs_decoded;
+    }
+
+    return (lhs_ptr->args_list == rhs_ptr->args_list) &&
+      (lhs_ptr->args_dict == rhs_ptr->args_dict);
+  }
+
+
+  bool wamp_args::decode_events(json_event_handler& handler) const
+  {
+    if (encoded) {
+      const char* ptr = encoded->bytes.data();
+      const size_t len = encoded->bytes.size();
+      switch (encoded->serialiser) {
+        case serialiser_type::msgpack:
+          return wampcc::json_msgpack_decode_events(ptr, len, handler);
+        case serialiser_type::cbor:
+          return wampcc::json_cbor_decode_events(ptr, len, handler);
+        default:
+          return wampcc::json_decode_events(ptr, len, handler);
+      }
+    }
+
+    return handler.start_array() &&
+      json_emit_events(args_list, handler) &&
+      (args_dict.empty() || json_emit_events(args_dict, handler)) &&
+      handler.end_array();
+  }
+
+
+  /* Number of leading items of a message to decode, when deferring the decode
+   * of arguments: those up to, but excluding, Arguments of CALL, PUBLISH,
+   * YIELD and EVENT messages, and otherwise all items. */
+  static size_t deferred_args_prefix(const json_value& first)
+  {
+    if (first.is_uint())
+      switch (first.as_uint()) {
+        case msg_type::wamp_msg_call: return 4;
+        case msg_type::wamp_msg_publish: return 4;
+        case msg_type::wamp_msg_yield: return 3;
+        case msg_type::wamp_msg_event: return 4;
+      }
+    return (std::numeric_limits<size_t>::max)();
+  }
+
+  /* Copy the encoded Arguments and ArgumentsKw, wrapped as a complete array */
+  static std::shared_ptr<const encoded_args> make_encoded_args(
+    serialiser_type st, const json_encoded_items& rest)
+  {
+    if (rest.count() > 2 || rest.types[0] != eARRAY ||
+        (rest.count() == 2 && rest.types[1] != eOBJECT))
+      throw protocol_error("invalid message arguments");
+
+    std::shared_ptr<encoded_args> ea(new encoded_args());
+    ea->serialiser = st;
+    ea->count = rest.count();
+    ea->bytes.reserve(rest.len + 6);
+    put_array_header(st, rest.count(), ea->bytes);
+    ea->items_begin = ea->bytes.size();
+    ea->bytes.insert(ea->bytes.end(), rest.ptr, rest.ptr + rest.len);
+    ea->items_end = ea->bytes.size();
+    if (st == serialiser_type::json)
+      ea->bytes.push_back(']');
+    return ea;
+  }
+
+
   class json_codec : public codec
   {
   public:
     json_value decode(const char* ptr, size_t msglen) override
     {
-      json_value jv = wampcc::json_decode(ptr, msglen);
+      json_arena arena(arena_block_size(msglen));
+      json_value jv = wampcc::json_decode(ptr, msglen, arena);
       return jv;
     }
 
-    std::vector<char> encode(const json_array& src) override
+    json_value decode_prefix(const char* ptr, size_t msglen,
+                             json_prefix_fn prefix,
+                             json_encoded_items& rest) override
+    {
+      json_arena arena(arena_block_size(msglen));
+      return wampcc::json_decode_prefix(ptr, msglen, prefix, rest, &arena);
+    }
+
+    void encode(const json_array& src, std::vector<char>& dest) override
     {
-      std::string s = wampcc::json_encode(src);
-      std::vector<char> retval(s.size());
-      memcpy(retval.data(), s.c_str(), s.size());
-      return retval;
+      wampcc::json_encode(src, dest, true);
     }
 
     serialiser_type type() const override { return serialiser_type::json;}
@@ -46,22 +274,157 @@ namespace wampcc {
   public:
     json_value decode(const char* ptr, size_t msglen) override
     {
-      json_value jv = wampcc::json_msgpack_decode(ptr, msglen);
+      json_arena arena(arena_block_size(msglen));
+      json_value jv = wampcc::json_msgpack_decode(ptr, msglen, arena);
       return jv;
     }
 
-    std::vector<char> encode(const json_array& src) override
+    json_value decode_prefix(const char* ptr, size_t msglen,
+                             json_prefix_fn prefix,
+                             json_encoded_items& rest) override
     {
-      auto region = wampcc::json_msgpack_encode(src);
-      std::vector<char> retval(region->second);
-      memcpy(retval.data(), region->first, region->second);
-      return retval;
+      json_arena arena(arena_block_size(msglen));
+      return wampcc::json_msgpack_decode_prefix(ptr, msglen, prefix, rest,
+                                                &arena);
+    }
+
+    void encode(const json_array& src, std::vector<char>& dest) override
+    {
+      wampcc::json_msgpack_encode(src, dest);
     }
 
     serialiser_type type() const override { return serialiser_type::msgpack;}
     const char* name() const override { return "msgpack"; }
   };
 
+  class cbor_codec : public codec
+  {
+  public:
+    json_value decode(const char* ptr, size_t msglen) override
+    {
+      json_arena arena(arena_block_size(msglen));
+      return wampcc::json_cbor_decode(ptr, msglen, arena);
+    }
+
+    json_value decode_prefix(const char* ptr, size_t msglen,
+                             json_prefix_fn prefix,
+                             json_encoded_items& rest) override
+    {
+      json_arena arena(arena_block_size(msglen));
+      return wampcc::json_cbor_decode_prefix(ptr, msglen, prefix, rest,
+                                             &arena);
+    }
+
+    void encode(const json_array& src, std::vector<char>& dest) override
+    {
+      wampcc::json_cbor_encode(src, dest);
+    }
+
+    serialiser_type type() const override { return serialiser_type::cbor;}
+    const char* name() const override { return "cbor"; }
+  };
+
+  static const char record_separator = 0x1e;
+
+  /* Encode buffers larger than this are released rather than reused */
+  static const size_t max_retained_encode_buf = 1024 * 1024;
+
+  /* Batched JSON: each message is followed by the 0x1e record separator,
+   * which cannot otherwise appear in JSON text. */
+  class json_batched_codec : public json_codec
+  {
+  public:
+
+    void encode(const json_array& src, std::vector<char>& dest) override
+    {
+      json_codec::encode(src, dest);
+      dest.push_back(record_separator);
+    }
+
+    void encode(const json_array& head, const encoded_args& tail,
+                std::vector<char>& dest) override
+    {
+      codec::encode(head, tail, dest);
+      dest.push_back(record_separator);
+    }
+
+    void for_each_message(const char* ptr, size_t len,
+                          const std::function<void(const char*, size_t)>& fn) override
+    {
+      const char* const end = ptr + len;
+      while (ptr != end) {
+        const char* sep = (const char*) memchr(ptr, record_separator, end - ptr);
+        if (sep == nullptr) {
+          /* tolerate a final message without a trailing separator */
+          fn(ptr, end - ptr);
+          break;
+        }
+        if (sep != ptr)
+          fn(ptr, sep - ptr);
+        ptr = sep + 1;
+      }
+    }
+
+    serialiser_type type() const override { return serialiser_type::json_batched;}
+    serialiser_type base_type() const override { return serialiser_type::json;}
+    const char* name() const override { return "json.batched"; }
+  };
+
+  /* Batched msgpack: each message is preceded by its length, as a 4 byte
+   * unsigned integer in network byte order. */
+  class msgpack_batched_codec : public msgpack_codec
+  {
+  public:
+    void encode(const json_array& src, std::vector<char>& dest) override
+    {
+      /* reserve the length prefix, and fill it in once the size is known */
+      const size_t start = dest.size();
+      dest.resize(start + 4);
+      msgpack_codec::encode(src, dest);
+      put_length(dest, start);
+    }
+
+    void encode(const json_array& head, const encoded_args& tail,
+                std::vector<char>& dest) override
+    {
+      const size_t start = dest.size();
+      dest.resize(start + 4);
+      codec::encode(head, tail, dest);
+      put_length(dest, start);
+    }
+
+    void for_each_message(const char* ptr, size_t len,
+                          const std::function<void(const char*, size_t)>& fn) override
+    {
+      while (len) {
+        if (len < 4)
+          throw protocol_error("batched msgpack message truncated");
+        const uint8_t* p = (const uint8_t*) ptr;
+        size_t msglen = (size_t(p[0]) << 24) | (size_t(p[1]) << 16) |
+          (size_t(p[2]) << 8) | size_t(p[3]);
+        if (msglen > len - 4)
+          throw protocol_error("batched msgpack message truncated");
+        fn(ptr + 4, msglen);
+        ptr += 4 + msglen;
+        len -= 4 + msglen;
+      }
+    }
+
+    serialiser_type type() const override { return serialiser_type::msgpack_batched;}
+    serialiser_type base_type() const override { return serialiser_type::msgpack;}
+    const char* name() const override { return "msgpack.batched"; }
+
+  private:
+    static void put_length(std::vector<char>& dest, size_t start)
+    {
+      const size_t len = dest.size() - start - 4;
+      dest[start + 0] = (len >> 24) & 0xFF;
+      dest[start + 1] = (len >> 16) & 0xFF;
+      dest[start + 2] = (len >> 8) & 0xFF;
+      dest[start + 3] = len & 0xFF;
+    }
+  };
+
 
   buffer::read_pointer::read_pointer(char * p, size_t avail)
     : m_ptr(p),
@@ -126,10 +489,18 @@ namespace wampcc {
   /* select & create a codec from range of choices */
   void protocol::create_codec(int choices)
   {
+    /* prefer unbatched, to avoid introducing batching delay unless only
+     * batching is available */
     if (choices & serialiser_type::msgpack)
       m_codec = std::shared_ptr<codec>(new msgpack_codec());
+    else if (choices & serialiser_type::cbor)
+      m_codec = std::shared_ptr<codec>(new cbor_codec());
     else if (choices & serialiser_type::json)
       m_codec = std::shared_ptr<codec>(new json_codec());
+    else if (choices & serialiser_type::msgpack_batched)
+      m_codec = std::shared_ptr<codec>(new msgpack_batched_codec());
+    else if (choices & serialiser_type::json_batched)
+      m_codec = std::shared_ptr<codec>(new json_batched_codec());
   }
 
   protocol::protocol(kernel* kernel,
@@ -156,18 +527,73 @@ namespace wampcc {
 }
 
 
-std::vector<char> protocol::encode(const json_array& ja)
+const std::vector<char>* prepared_message::find(serialiser_type st,
+                                                frame_format ff) const
+{
+  for (auto& item : m_entries)
+    if (item.serialiser == st && item.format == ff)
+      return &item.bytes;
+  return nullptr;
+}
+
+
+const std::vector<char>& prepared_message::store(serialiser_type st,
+                                                 frame_format ff,
+                                                 std::vector<char> bytes)
+{
+  m_entries.push_back({st, ff, std::move(bytes)});
+  return m_entries.back().bytes;
+}
+
+
+void protocol::send_msg(prepared_message& pm)
+{
+  if (pm.tail())
+    send_msg(pm.message(), *pm.tail());
+  else
+    send_msg(pm.message());
+}
+
+
+void protocol::send_msg(std::vector<prepared_message*>& msgs)
 {
-  return m_codec?m_codec->encode(ja):std::vector<char>();
+  for (auto pm : msgs)
+    send_msg(*pm);
+}
+
+
+void protocol::encode(const json_array& ja, const encoded_args* tail,
+                      std::vector<char>& dest, size_t headroom)
+{
+  /* don't let a single large message pin its memory for the session life */
+  if (dest.capacity() > max_retained_encode_buf)
+    std::vector<char>().swap(dest);
+
+  dest.resize(headroom);
+  if (tail)
+    m_codec->encode(ja, *tail, dest);
+  else
+    m_codec->encode(ja, dest);
 }
 
 
 void protocol::decode(const char* ptr, size_t len)
 {
   /* IO thread */
+  m_codec->for_each_message(ptr, len, [this](const char* msg, size_t msglen) {
+      decode_message(msg, msglen);
+    });
+}
+
+
+void protocol::decode_message(const char* ptr, size_t len)
+{
   try
   {
-    json_value jv = m_codec->decode(ptr, len);
+    json_encoded_items rest;
+    json_value jv = m_callbacks.deferred_args_msg
+      ? m_codec->decode_prefix(ptr, len, deferred_args_prefix, rest)
+      : m_codec->decode(ptr, len);
 
     LOG_TRACE("fd: " << fd() << ", json_rx: " << jv);
 
@@ -179,7 +605,11 @@ void protocol::decode(const char* ptr, size_t len)
     if (!msg[0].is_uint())
       throw protocol_error("message type must be uint");
 
-    m_msg_processor(msg, msg[0].as_uint());
+    if (rest.count())
+      m_callbacks.deferred_args_msg(
+        msg, msg[0].as_uint(), make_encoded_args(m_codec->base_type(), rest));
+    else
+      m_msg_processor(msg, msg[0].as_uint());
   }
   catch( const json_error& e)
   {
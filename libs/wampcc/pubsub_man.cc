@@ -14,6 +14,7 @@
 #include "wampcc/kernel.h"
 
 #include <list>
+#include <deque>
 #include <iostream>
 #include <algorithm>
 
@@ -27,88 +28,383 @@ static bool session_equals(const session_handle& p1, const session_handle& p2)
 /*
 Thread safety.
 
-There is a global lock on the pubsub_man instance, m_lock.
-
-This is needed because of possible interaction between the WAMPCC EV thread
-(which conveys actions from remote subscribers and publishers), and from any
-user thread that calls the public publish() method.
+Publications can arrive on the WAMPCC EV thread (from remote publishers) and on
+any user thread that calls the public publish() method, so the publish path is
+designed to let publications to unrelated topics proceed in parallel.
+
+Topics are partitioned into shards, by hash of the topic URI.  Each shard has
+its own registry of topics, and its own lock, held just to find a topic.  If
+the kernel is configured with pubsub_shard_threads, each shard also has its
+own thread, and the router dispatches every publication to the thread of the
+topic's shard, so publications to different topics proceed in parallel while
+those to one topic stay in order.  Otherwise there is a single shard, and
+publications are made on the calling thread.
+
+The pattern registry is shared by all shards, under m_pattern_lock, held just
+to collect the pattern subscriptions matching a topic.  The global lock,
+m_lock, protects the subscription IDs and the index of each session's
+subscriptions, which span the shards; it is held to create a topic or pattern,
+and to remove a session's subscriptions, but is not taken to publish.  The
+shard and pattern locks are only ever held briefly, with no other lock taken
+while they are held.
+
+Each managed_topic then has two locks of its own.  The publish lock serialises
+the publications to a topic, so that its image, publication IDs and event
+order are consistent, and is also held while a subscriber is added so that the
+subscriber sees an initial snapshot followed by every later update.  The write
+lock serialises changes to the subscriber list.  The list itself is immutable
+once published; writers replace it with a modified copy, so publishers can
+read it without locking (including when fanning out to a pattern subscription
+that is shared by many topics).  Locks are always taken in the order m_lock,
+publish lock, write lock.
+
+The image of a topic is updated lazily: patches are appended to a log, under
+the publish lock, and only folded into the image when a snapshot is needed,
+or once the log reaches max_patch_log entries.
+
+Topics and patterns are shared_ptr owned, so a publisher or subscriber can
+keep using one after releasing the registry locks.  One which has no
+subscribers and no image is reclaimed, under m_lock and its publish lock, and
+marked as retired;
+a publisher or subscriber that finds a retired topic once it holds the publish
+lock just looks it up again.
 */
 
+enum class match_policy { exact, prefix, wildcard };
+
+/* Number of patches logged for a topic before they are folded into its image */
+static const size_t max_patch_log = 256;
+
+
+/* A published EVENT retained in the history of a topic.  The encodings made
+ * as it was written to subscribers are kept with it, so that it can be
+ * replayed to a late joiner without encoding it again. */
+struct retained_event
+{
+  retained_event(json_array __msg, std::shared_ptr<const encoded_args> __encoded)
+    : msg(std::move(__msg)),
+      encoded(std::move(__encoded)),
+      prepared(msg, encoded.get()),
+      when(std::chrono::steady_clock::now())
+  {
+  }
+
+  /* Whether the event carried a patch to the topic image */
+  bool is_patch() const
+  {
+    return msg[3].as_object().find(KEY_PATCH) != msg[3].as_object().end();
+  }
+
+  json_array msg;
+  std::shared_ptr<const encoded_args> encoded;
+  prepared_message prepared;
+  std::chrono::steady_clock::time_point when;
+};
+
+
+/* Bounded history of the events published to a topic, oldest first. */
+class event_history
+{
+public:
+  typedef std::deque<std::shared_ptr<retained_event>> event_list;
+
+  event_history(event_history_options options)
+    : m_options(options)
+  {
+  }
+
+  std::shared_ptr<retained_event> append(json_array msg,
+                                         std::shared_ptr<const encoded_args> encoded)
+  {
+    auto ev = std::make_shared<retained_event>(std::move(msg), std::move(encoded));
+    m_events.push_back(ev);
+    if (m_options.max_events && m_events.size() > m_options.max_events)
+      m_events.pop_front();
+    expire();
+    return ev;
+  }
+
+  /* The retained events, after discarding any older than max_age */
+  const event_list& events()
+  {
+    expire();
+    return m_events;
+  }
+
+private:
+
+  void expire()
+  {
+    if (m_options.max_age.count() == 0)
+      return;
+
+    auto oldest = std::chrono::steady_clock::now() - m_options.max_age;
+    while (!m_events.empty() && m_events.front()->when < oldest)
+      m_events.pop_front();
+  }
+
+  event_history_options m_options;
+  event_list m_events;
+};
+
+/* The snapshot EVENT sent to a new subscriber of a topic with an image.  It
+ * is kept until the image next changes, so that subscribers of the same
+ * serialisation and frame format share its encoding, rather than each taking
+ * a copy of the image and encoding it. */
+struct cached_snapshot
+{
+  cached_snapshot(t_subscription_id subscription_id, const json_value& image,
+                  json_value __patch_option)
+    : patch_option(std::move(__patch_option)),
+      prepared(msg)
+  {
+    json_array patch;
+    json_object& operation = json_append<json_object>(patch);
+    operation["op"]    = "replace";
+    operation["path"]  = "";  /* replace whole document */
+    operation["value"] = image;
+
+    json_object event_options;
+    event_options[KEY_PATCH] = patch_option;
+    event_options[KEY_SNAPSHOT] = 1;
+
+    msg.reserve(5);
+    msg.push_back( msg_type::wamp_msg_event );
+    msg.push_back( subscription_id );
+    msg.push_back( 0 ); // publication id
+    msg.push_back( std::move(event_options) );
+    msg.push_back( json_array({std::move(patch), json_array()}) ); // empty event
+  }
+
+  json_value patch_option; /* the subscriber's _p option, echoed in the EVENT */
+  json_array msg;
+  prepared_message prepared;
+};
+
+
 class managed_topic
 {
 public:
 
-  managed_topic(t_subscription_id __subscription_id)
-  :  m_subscription_id(__subscription_id),
-     m_is_valid(false)
+  typedef std::vector< std::weak_ptr<wamp_session> > subscriber_list;
+
+  managed_topic(t_subscription_id __subscription_id,
+                std::string __realm,
+                std::string __uri,
+                match_policy __policy = match_policy::exact)
+  :  m_subscribers(std::make_shared<subscriber_list>()),
+     m_realm(std::move(__realm)),
+     m_uri(std::move(__uri)),
+     m_policy(__policy),
+     m_subscription_id(__subscription_id),
+     m_is_valid(false),
+     m_is_retired(false)
   {
   }
 
   t_subscription_id subscription_id() const { return m_subscription_id; }
 
+  const std::string& realm() const { return m_realm; }
+  const std::string& uri() const { return m_uri; }
+  match_policy policy() const { return m_policy; }
+
 
   uint64_t next_publication_id() { return m_id_gen.next(); }
 
 
+  /* Serialises the publications to this topic */
+  std::mutex& publish_lock() { return m_publish_lock; }
+
+
+  /* The event history of the topic, or null if events are not retained.
+   * Caller must hold the publish lock. */
+  event_history* history() { return m_history.get(); }
+
+  void set_history(const event_history_options& options)
+  {
+    if (options.max_events || options.max_age.count())
+      m_history.reset(new event_history(options));
+    else
+      m_history.reset();
+  }
+
+
+  /* Indicate whether the topic has been reclaimed, and so removed from the
+   * registries.  Caller must hold the publish lock. */
+  bool is_retired() const { return m_is_retired; }
+  void retire() { m_is_retired = true; }
+
+
   /** Add a subscriber to this topic. */
   void add(std::weak_ptr<wamp_session> wp)
   {
-    auto it = std::find_if(std::begin(m_subscribers),
-                           std::end(m_subscribers),
-                           [wp](std::weak_ptr<wamp_session>& rhs)
+    std::lock_guard<std::mutex> guard(m_write_lock);
+    const subscriber_list& current = *m_subscribers;
+
+    auto it = std::find_if(std::begin(current),
+                           std::end(current),
+                           [wp](const std::weak_ptr<wamp_session>& rhs)
                            {
                              return session_equals(wp,rhs);
                            });
 
     /* In WAMP it is not an error for a session to subscribe multiple times. So
      * we dont throw an exception here if the session is already subscribed. */
-    if (it == std::end(m_subscribers))
-      m_subscribers.push_back(wp);
+    if (it == std::end(current))
+    {
+      auto updated = std::make_shared<subscriber_list>(current);
+      updated->push_back(wp);
+      std::atomic_store(&m_subscribers,
+                        std::shared_ptr<const subscriber_list>(std::move(updated)));
+    }
   }
 
 
   /** Remove a subscriber from this topic. */
   void remove(std::weak_ptr<wamp_session> wp)
   {
-    auto it = std::find_if(std::begin(m_subscribers),
-                           std::end(m_subscribers),
-                           [wp](std::weak_ptr<wamp_session>& rhs)
+    std::lock_guard<std::mutex> guard(m_write_lock);
+    const subscriber_list& current = *m_subscribers;
+
+    auto it = std::find_if(std::begin(current),
+                           std::end(current),
+                           [wp](const std::weak_ptr<wamp_session>& rhs)
                            {
                              return session_equals(wp,rhs);
                            });
 
     /* In WAMP it is not an error for a session to subscribe multiple times. So
      * we dont throw an exception here if the session is not found. */
-    if (it != std::end(m_subscribers))
-      m_subscribers.erase(it);
+    if (it != std::end(current))
+    {
+      auto updated = std::make_shared<subscriber_list>(current);
+      updated->erase(updated->begin() + (it - current.begin()));
+      std::atomic_store(&m_subscribers,
+                        std::shared_ptr<const subscriber_list>(std::move(updated)));
+    }
+  }
+
+
+  /** Remove any subscribers which have expired. */
+  void remove_expired()
+  {
+    std::lock_guard<std::mutex> guard(m_write_lock);
+    const subscriber_list& current = *m_subscribers;
+
+    size_t num_active = std::count_if(
+      std::begin(current), std::end(current),
+      [](const std::weak_ptr<wamp_session>& item) { return !item.expired(); });
+
+    if (num_active != current.size())
+    {
+      auto temp = std::make_shared<subscriber_list>();
+      temp->reserve(num_active);
+      for (auto item : current)
+      {
+        if (!item.expired())
+          temp->push_back( std::move(item) );
+      }
+      std::atomic_store(&m_subscribers,
+                        std::shared_ptr<const subscriber_list>(std::move(temp)));
+    }
   }
 
   /** Indicate whether an image exists for this topic.  This will be false until
-   * the first update arrives from the topic publisher. */
-  bool is_valid() const { return m_is_valid;}
+   * the first update arrives from the topic publisher.  While patches are
+   * logged it is true, even if none of them can be applied; fold_patches
+   * first for an exact answer. */
+  bool is_valid() const { return m_is_valid || !m_patch_log.empty(); }
 
+  /** The image, as of the last fold_patches. */
   const json_value& image() const { return m_image; }
 
   /** Accept a json-model update sent by a topic publisher.  This is represented
-   * as a json patch, which is applied to the image. */
-  void update_image(const json_array& patchset)
+   * as a json patch, either decoded or still encoded, which is logged rather
+   * than applied to the image; see fold_patches.  Returns true once the log
+   * has reached max_patch_log entries. */
+  bool update_image(json_value patch, std::shared_ptr<const encoded_args> encoded)
   {
-    m_image.patch(patchset);
+    m_snapshot.reset();
+    m_patch_log.push_back({std::move(patch), std::move(encoded)});
+    return m_patch_log.size() >= max_patch_log;
+  }
 
-    // only set as valid once a patch has successfully been applied.
-    m_is_valid = true;
+  /** Apply the logged patches to the image, in order.  A patch that cannot be
+   * applied is discarded; returns the number discarded. */
+  size_t fold_patches()
+  {
+    size_t discarded = 0;
+    for (auto & entry : m_patch_log)
+    {
+      try
+      {
+        if (entry.encoded)
+        {
+          wamp_args args;
+          args.encoded = std::move(entry.encoded);
+          args.decode();
+          entry.patch = std::move(args.args_list.at(0));
+        }
+        if (!m_image.patch(entry.patch.as_array()))
+        {
+          discarded++;
+          continue;
+        }
+
+        // only set as valid once a patch has successfully been applied.
+        m_is_valid = true;
+      }
+      catch (...)
+      {
+        discarded++;
+      }
+    }
+    m_patch_log.clear();
+    return discarded;
   }
 
-  std::vector< std::weak_ptr<wamp_session> > &  subscribers()  {return m_subscribers;}
-  const std::vector< std::weak_ptr<wamp_session> > &  subscribers() const {return m_subscribers;}
+  /** The snapshot EVENT of the image, for a subscriber with the given _p
+   * option, which is built on first use after each update.  Caller must hold
+   * the publish lock, and first fold_patches. */
+  prepared_message& snapshot(const json_value& patch_option)
+  {
+    if (!m_snapshot || m_snapshot->patch_option != patch_option)
+      m_snapshot.reset(new cached_snapshot(m_subscription_id, m_image,
+                                           patch_option));
+    return m_snapshot->prepared;
+  }
+
+  /** Snapshot of the subscribers, which can be read without locking. */
+  std::shared_ptr<const subscriber_list> subscribers() const
+  {
+    return std::atomic_load(&m_subscribers);
+  }
 
 private:
 
-  std::vector< std::weak_ptr<wamp_session> > m_subscribers;
+  std::mutex m_publish_lock;
+  std::mutex m_write_lock;
 
-  // current upto date image of the value
+  std::shared_ptr<const subscriber_list> m_subscribers;
+
+  std::string m_realm;
+  std::string m_uri;
+  match_policy m_policy;
+
+  // image of the value, upto date once the patch log is folded into it
   json_value m_image;
 
+  struct logged_patch
+  {
+    json_value patch;
+    std::shared_ptr<const encoded_args> encoded;
+  };
+  std::vector<logged_patch> m_patch_log;
+
+  std::unique_ptr<cached_snapshot> m_snapshot;
+
+  std::unique_ptr<event_history> m_history;
+
   global_scope_id_generator m_id_gen;
 
   // Note, we are tieing the subscription ID direct to the topic.  WAMP does
@@ -119,128 +415,550 @@ private:
 
   // Track whether this image has ever applied an update
   bool m_is_valid;
+
+  bool m_is_retired;
+};
+
+
+/* Split a URI into its components, eg "a..b" gives "a", "" and "b". */
+static std::vector<std::string> uri_components(const std::string& uri)
+{
+  std::vector<std::string> parts;
+  size_t start = 0;
+  for (;;) {
+    size_t pos = uri.find('.', start);
+    if (pos == std::string::npos) {
+      parts.push_back(uri.substr(start));
+      return parts;
+    }
+    parts.push_back(uri.substr(start, pos - start));
+    start = pos + 1;
+  }
+}
+
+
+/* Check the components of the URI of a pattern subscription.  A wildcard
+ * pattern may have any number of empty components, while a prefix pattern may
+ * only end with one, eg "com.myapp." */
+static bool is_pattern_uri(const std::vector<std::string>& parts,
+                           bool is_prefix)
+{
+  for (size_t i = 0; i < parts.size(); i++) {
+    if (parts[i].empty()) {
+      if (is_prefix && (i + 1) < parts.size())
+        return false;
+    }
+    else if (!is_strict_uri(parts[i].c_str()))
+      return false;
+  }
+  return true;
+}
+
+
+/*
+Index of the prefix and wildcard subscriptions of a realm, as a trie keyed by
+URI component.  The subscriptions matching a published topic are found by
+walking the components of the topic, so the cost is proportional to the URI
+depth and not to the number of subscriptions.
+
+A wildcard pattern is held at the node reached by its components, where an
+empty component is the wildcard edge.  A prefix pattern matches by string
+prefix, so can end within a component (eg "com.myapp.stat" matches
+"com.myapp.status.cpu").  It is held at the node of all but its last
+component, keyed by that last, possibly partial, component.
+
+Each pattern is represented by a managed_topic, which carries its
+subscription ID and subscribers, but never has an image.
+*/
+class pattern_trie
+{
+public:
+
+  /* Return the slot for a pattern, creating trie nodes as required */
+  std::shared_ptr<managed_topic>& slot(const std::vector<std::string>& parts,
+                                       bool is_prefix)
+  {
+    node* n = &m_root;
+    size_t depth = is_prefix ? parts.size() - 1 : parts.size();
+    for (size_t i = 0; i < depth; i++) {
+      std::unique_ptr<node>& child = n->children[parts[i]];
+      if (!child)
+        child.reset(new node());
+      n = child.get();
+    }
+    return is_prefix ? n->prefixes[parts.back()] : n->wildcard;
+  }
+
+  /* Remove a pattern, and any trie nodes left empty */
+  void erase(const std::vector<std::string>& parts, bool is_prefix)
+  {
+    erase(m_root, parts, is_prefix ? parts.size() - 1 : parts.size(), 0,
+          is_prefix);
+  }
+
+  bool empty() const { return m_root.empty(); }
+
+  /* Collect the pattern subscriptions that match a topic */
+  void match(const std::vector<std::string>& parts,
+             std::vector<std::shared_ptr<managed_topic>>& dest) const
+  {
+    /* prefix patterns all lie along the path of the topic components */
+    const node* n = &m_root;
+    for (size_t i = 0; n && i < parts.size(); i++) {
+      if (!n->prefixes.empty()) {
+        const std::string& part = parts[i];
+        for (size_t len = 0; len <= part.size(); len++) {
+          auto it = n->prefixes.find(part.substr(0, len));
+          if (it != n->prefixes.end() && it->second)
+            dest.push_back(it->second);
+        }
+      }
+      auto it = n->children.find(parts[i]);
+      n = (it != n->children.end()) ? it->second.get() : nullptr;
+    }
+
+    match_wildcard(m_root, parts, 0, dest);
+  }
+
+private:
+
+  struct node
+  {
+    std::map<std::string, std::unique_ptr<node>> children;
+    std::shared_ptr<managed_topic> wildcard;
+    std::map<std::string, std::shared_ptr<managed_topic>> prefixes;
+
+    bool empty() const
+    {
+      return children.empty() && prefixes.empty() && !wildcard;
+    }
+  };
+
+  /* Returns true if the node is left empty */
+  static bool erase(node& n, const std::vector<std::string>& parts,
+                    size_t depth, size_t i, bool is_prefix)
+  {
+    if (i == depth) {
+      if (is_prefix)
+        n.prefixes.erase(parts.back());
+      else
+        n.wildcard.reset();
+    }
+    else {
+      auto it = n.children.find(parts[i]);
+      if (it != n.children.end() &&
+          erase(*it->second, parts, depth, i + 1, is_prefix))
+        n.children.erase(it);
+    }
+    return n.empty();
+  }
+
+  static void match_wildcard(const node& n,
+                             const std::vector<std::string>& parts,
+                             size_t i,
+                             std::vector<std::shared_ptr<managed_topic>>& dest)
+  {
+    if (i == parts.size()) {
+      if (n.wildcard)
+        dest.push_back(n.wildcard);
+      return;
+    }
+
+    auto it = n.children.find(parts[i]);
+    if (it != n.children.end())
+      match_wildcard(*it->second, parts, i + 1, dest);
+
+    it = n.children.find(std::string());
+    if (it != n.children.end())
+      match_wildcard(*it->second, parts, i + 1, dest);
+  }
+
+  node m_root;
+};
+
+
+/* Write a prepared EVENT to each subscriber of a topic, and remove any
+ * subscribers which have expired.  The subscriber list is read without
+ * locking. */
+void pubsub_man::fan_out(managed_topic* mt, prepared_message& prepared)
+{
+  auto subscribers = mt->subscribers();
+
+  size_t num_active = 0;
+  for (auto & item : *subscribers)
+  {
+    if (auto sp = item.lock())
+    {
+      sp->send_msg(prepared);
+      num_active++;
+    }
+  }
+
+  // remove any expired sessions
+  if (num_active != subscribers->size())
+    mt->remove_expired();
+}
+
+
+/* A partition of the topics, chosen by hash of the topic URI. */
+struct pubsub_man::shard
+{
+  std::mutex lock;
+  realm_to_topicreg topics;
+
+  /* publication IDs for topics which have no managed_topic */
+  global_scope_id_generator publication_ids;
+
+  /* present only if pubsub is threaded */
+  std::unique_ptr<event_loop> loop;
 };
 
 
 /* Constructor */
 pubsub_man::pubsub_man(kernel* k)
   : __logger(k->get_logger()),
-    m_next_subscription_id(1)  /* zero used for initial snapshot */
+    m_next_subscription_id(1),  /* zero used for initial snapshot */
+    m_shard_threads(k->get_config().pubsub_shard_threads)
 {
+  m_shards.resize(std::max<size_t>(m_shard_threads, 1));
+  for (auto & sh : m_shards)
+  {
+    sh.reset(new shard());
+    if (m_shard_threads)
+      sh->loop.reset(new event_loop(k));
+  }
 }
 
 
 pubsub_man::~pubsub_man()
 {
-  // destructor needed here so that unique_ptr can see the definition of
-  // managed_topic
+  /* Functions already dispatched to a shard are invoked before its thread
+   * stops, so must be done while the registries still exist. */
+  for (auto & sh : m_shards)
+    if (sh->loop)
+      sh->loop->sync_stop();
+}
+
+
+size_t pubsub_man::shard_of(const std::string& uri) const
+{
+  return std::hash<std::string>()(uri) % m_shards.size();
 }
 
 
-managed_topic* pubsub_man::find_topic(const std::string& topic,
-                                      const std::string& realm,
-                                      bool allow_create)
+void pubsub_man::dispatch(size_t shard, std::function<void()> fn)
 {
-  // first find the realm
-  auto realm_iter = m_topics.find( realm );
-  if (realm_iter == m_topics.end())
+  if (!m_shards[shard]->loop)
+    throw std::runtime_error("pubsub is not threaded");
+
+  m_shards[shard]->loop->dispatch(std::move(fn));
+}
+
+
+/* Find a topic, optionally creating it.  The caller must not hold m_lock. */
+std::shared_ptr<managed_topic> pubsub_man::find_topic(const std::string& topic,
+                                                      const std::string& realm,
+                                                      bool allow_create)
+{
+  shard& sh = *m_shards[shard_of(topic)];
+
   {
-    if (allow_create)
+    std::lock_guard<std::mutex> shard_guard(sh.lock);
+    auto realm_iter = sh.topics.find(realm);
+    if (realm_iter != sh.topics.end())
     {
-      auto result = m_topics.insert(std::make_pair(realm, topic_registry()));
-      realm_iter = result.first;
+      auto topic_iter = realm_iter->second.find(topic);
+      if (topic_iter != realm_iter->second.end())
+        return topic_iter->second;
     }
-    else
-      return nullptr;
   }
 
-  // now find the topic
-  auto topic_iter = realm_iter->second.find( topic );
-  if (topic_iter ==  realm_iter->second.end())
+  if (!allow_create)
+    return nullptr;
+
+  /* look again, now holding m_lock, which allocates the subscription ID */
+  std::lock_guard<std::mutex> guard(m_lock);
+  std::lock_guard<std::mutex> shard_guard(sh.lock);
+
+  std::shared_ptr<managed_topic>& ptr = sh.topics[realm][topic];
+  if (!ptr)
   {
-    if (allow_create)
+    ptr = std::make_shared<managed_topic>(m_next_subscription_id++,
+                                          realm, topic);
+    m_subscription_registry[ptr->subscription_id()] = ptr;
+  }
+
+  return ptr;
+}
+
+
+t_publication_id pubsub_man::untracked_publication_id(const std::string& topic)
+{
+  shard& sh = *m_shards[shard_of(topic)];
+  std::lock_guard<std::mutex> shard_guard(sh.lock);
+  return sh.publication_ids.next();
+}
+
+
+/* Collect the pattern subscriptions which match a topic */
+void pubsub_man::match_patterns(const std::string& realm,
+                                const std::string& topic,
+                                std::vector<std::shared_ptr<managed_topic>>& patterns)
+{
+  std::lock_guard<std::mutex> pattern_guard(m_pattern_lock);
+
+  auto realm_iter = m_patterns.find(realm);
+  if (realm_iter != m_patterns.end())
+    realm_iter->second->match(uri_components(topic), patterns);
+}
+
+
+/* Find or create a pattern subscription.  The caller must hold m_lock. */
+std::shared_ptr<managed_topic> pubsub_man::find_pattern(const std::string& pattern,
+                                                        const std::string& match,
+                                                        const std::string& realm)
+{
+  bool is_prefix = (match == "prefix");
+  std::vector<std::string> parts = uri_components(pattern);
+
+  if (!is_pattern_uri(parts, is_prefix))
+    throw wamp_error(WAMP_ERROR_INVALID_URI, "pattern fails strictness check");
+
+  std::lock_guard<std::mutex> pattern_guard(m_pattern_lock);
+
+  std::unique_ptr<pattern_trie>& trie = m_patterns[realm];
+  if (!trie)
+    trie.reset(new pattern_trie());
+
+  std::shared_ptr<managed_topic>& ptr = trie->slot(parts, is_prefix);
+  if (!ptr)
+  {
+    ptr = std::make_shared<managed_topic>(
+      m_next_subscription_id++, realm, pattern,
+      is_prefix ? match_policy::prefix : match_policy::wildcard);
+    m_subscription_registry[ptr->subscription_id()] = ptr;
+  }
+
+  return ptr;
+}
+
+
+/* Discard a topic or pattern which has no subscribers and holds no image, so
+ * that the registries do not grow with every topic ever used. */
+void pubsub_man::reclaim(const std::shared_ptr<managed_topic>& mt)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  std::lock_guard<std::mutex> publish_guard(mt->publish_lock());
+
+  if (mt->is_retired() || mt->history() || !mt->subscribers()->empty())
+    return;
+
+  /* the patch log may hold only patches that cannot be applied, which leave
+   * the topic without an image */
+  fold_patches(mt.get());
+  if (mt->is_valid())
+    return;
+
+  mt->retire();
+  m_subscription_registry.erase(mt->subscription_id());
+
+  if (mt->policy() == match_policy::exact)
+  {
+    shard& sh = *m_shards[shard_of(mt->uri())];
+    std::lock_guard<std::mutex> shard_guard(sh.lock);
+    auto realm_iter = sh.topics.find(mt->realm());
+    if (realm_iter != sh.topics.end())
     {
-      std::unique_ptr<managed_topic> ptr(new managed_topic(m_next_subscription_id++));
-      m_subscription_registry[ptr->subscription_id()] = ptr.get();
-      auto result = realm_iter->second.insert(std::make_pair(topic, std::move(ptr)));
-      topic_iter = result.first;
+      realm_iter->second.erase(mt->uri());
+      if (realm_iter->second.empty())
+        sh.topics.erase(realm_iter);
+    }
+  }
+  else
+  {
+    std::lock_guard<std::mutex> pattern_guard(m_pattern_lock);
+    auto realm_iter = m_patterns.find(mt->realm());
+    if (realm_iter != m_patterns.end())
+    {
+      realm_iter->second->erase(uri_components(mt->uri()),
+                                mt->policy() == match_policy::prefix);
+      if (realm_iter->second->empty())
+        m_patterns.erase(realm_iter);
     }
-    else return nullptr;
   }
-
-  return topic_iter->second.get();
 }
 
 
-t_publication_id pubsub_man::update_topic(const std::string& topic,
-                                          const std::string& realm,
-                                          json_object options,
-                                          wamp_args args)
+/* Finds whether the first of the Arguments is an array, reading no further
+ * than its start, so that encoded arguments need not be decoded. */
+class first_arg_is_array : public json_event_handler
 {
-  managed_topic* mt = find_topic(topic, realm, true);
+public:
+  bool result = false;
 
-  if (!mt)
+  bool start_array() override
   {
-    LOG_WARN("Discarding update to non existing topic '" << topic << "'");
-    throw wamp_error(WAMP_RUNTIME_ERROR);
+    /* the outer array, then Arguments, then the first argument */
+    if (++m_depth < 3)
+      return true;
+    result = true;
+    return false;
   }
 
-  if (options.find(KEY_PATCH) != options.end())
+  bool null_value() override { return false; }
+  bool bool_value(bool) override { return false; }
+  bool int_value(json_int_t) override { return false; }
+  bool uint_value(json_uint_t) override { return false; }
+  bool real_value(double) override { return false; }
+  bool string_value(const char*, size_t) override { return false; }
+  bool binary_value(const unsigned char*, size_t) override { return false; }
+  bool start_object() override { return false; }
+  bool end_array() override { return false; }
+
+private:
+  int m_depth = 0;
+};
+
+
+/* Check that a publication which is a patch carries an array as its first
+ * argument. */
+static void check_patch(const json_object& options, const wamp_args& args)
+{
+  if (options.find(KEY_PATCH) == options.end())
+    return;
+
+  first_arg_is_array check;
+  args.decode_events(check);
+  if (!check.result)
+    throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "patch must be an array");
+}
+
+
+/* Log the patch carried by a publication against a topic image, if the
+ * publication is a patch.  Arguments still encoded are kept so, to be decoded
+ * only if the image is needed.  Caller must hold the publish lock. */
+void pubsub_man::apply_patch(managed_topic* mt, const json_object& options,
+                             wamp_args& args)
+{
+  if (options.find(KEY_PATCH) == options.end())
+    return;
+
+  check_patch(options, args);
+
+  bool log_full;
+  if (args.encoded)
+    log_full = mt->update_image(json_value(), args.encoded);
+  else
   {
-    // apply the patch
-    //std::cout << "@" << topic << ", patch\n";
-    //std::cout << "BEFORE: " << mt->image << "\n";
-    //std::cout << "PATCH : " << args.args_list << "\n";
-    mt->update_image(args.args_list[0].as_array());
-    //std::cout << "AFTER : "  << mt->image << "\n";
-    //std::cout << "-------\n";
+    /* the logged patch shares, rather than copies, the payload */
+    args.args_list[0].freeze();
+    log_full = mt->update_image(args.args_list[0], nullptr);
   }
 
-  /*
-    Broadcast to multiple subscribers.  Instead of using the event() method on
-    each wamp_session, we preform that the message and same the same to each
-    subscriber.
-   */
-  auto publication_id = mt->next_publication_id();
+  if (log_full)
+    fold_patches(mt);
+}
+
+
+/* Bring a topic image up to date.  Caller must hold the publish lock. */
+void pubsub_man::fold_patches(managed_topic* mt)
+{
+  if (size_t discarded = mt->fold_patches())
+    LOG_WARN("discarded " << discarded << " invalid patch(es) to topic '"
+             << mt->uri() << "'");
+}
+
+
+/* Form an EVENT message, taking the publication options as its details. */
+static json_array make_event(t_subscription_id subscription_id,
+                             t_publication_id publication_id,
+                             json_object options,
+                             wamp_args& args)
+{
   json_array msg;
   msg.reserve(6);
   msg.push_back( msg_type::wamp_msg_event );
-  msg.push_back( mt->subscription_id() );
+  msg.push_back( subscription_id );
   msg.push_back( publication_id );
   msg.push_back( std::move(options) );
 
   if (!args.args_list.empty() || !args.args_dict.empty())
   {
-    msg.push_back(args.args_list);
+    msg.push_back(std::move(args.args_list));
     if (!args.args_dict.empty())
-      msg.push_back(args.args_dict);
+      msg.push_back(std::move(args.args_dict));
   }
 
-  size_t num_active = 0;
-  for (auto & item : mt->subscribers())
+  return msg;
+}
+
+
+static void check_publish_uris(const std::string& realm,
+                               const std::string& topic)
+{
+  if (realm.empty())
+    throw wamp_error(WAMP_ERROR_INVALID_URI, "realm has zero length");
+
+  if (is_strict_uri(realm.c_str()) == false)
+    throw wamp_error(WAMP_ERROR_INVALID_URI, "realm fails strictness check");
+
+  if (topic.empty())
+    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic has zero length");
+
+  if (is_strict_uri(topic.c_str()) == false)
+    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
+}
+
+
+/* Publish to a topic and to the pattern subscriptions that match it.  The
+ * topic is null if it has no managed_topic; otherwise the caller must hold its
+ * publish lock.  The caller must not hold m_lock. */
+void pubsub_man::update_topic(managed_topic* mt,
+                              t_publication_id publication_id,
+                              const std::vector<std::shared_ptr<managed_topic>>& patterns,
+                              const std::string& topic,
+                              json_object options,
+                              wamp_args args)
+{
+  if (mt)
+    apply_patch(mt, options, args);
+
+  /*
+    Broadcast to multiple subscribers.  Instead of using the event() method on
+    each wamp_session, we prepare the message once, so that it is encoded only
+    once for each serialisation and frame format in use by the subscribers,
+    and then written to each.
+   */
+  json_array msg = make_event(mt ? mt->subscription_id() : 0, publication_id,
+                              std::move(options), args);
+
+  /* arguments still encoded are spliced into each EVENT as received */
+  if (mt && mt->history())
   {
-    if (auto sp = item.lock())
-    {
-      sp->send_msg(msg);
-      num_active++;
-    }
+    /* the retained event keeps the encodings made during the fan out */
+    auto ev = mt->history()->append(std::move(msg), args.encoded);
+    fan_out(mt, ev->prepared);
+    if (!patterns.empty())
+      msg = ev->msg;
+  }
+  else if (mt)
+  {
+    prepared_message prepared(msg, args.encoded.get());
+    fan_out(mt, prepared);
   }
 
-  // remove any expired sessions
+  /* Pattern subscriptions each have their own subscription ID, so need their
+   * own EVENT, which reuses the message above with the details extended by
+   * the concrete topic. */
+  if (!patterns.empty())
+    msg[3].as_object()["topic"] = topic;
 
-  if (num_active != mt->subscribers().size())
+  for (auto & pattern : patterns)
   {
-    std::vector< std::weak_ptr<wamp_session> > temp;
-    temp.resize(num_active);
-    for (auto item : mt->subscribers())
-    {
-      if (!item.expired())
-        temp.push_back( std::move(item) );
-    }
-    mt->subscribers().swap( temp );
+    msg[1] = pattern->subscription_id();
+    prepared_message prepared(msg, args.encoded.get());
+    fan_out(pattern.get(), prepared);
   }
-
-  return publication_id;
 }
 
 
@@ -253,50 +971,334 @@ t_publication_id pubsub_man::publish(std::string realm,
 {
   /* ANY thread */
 
-  if (realm.empty())
-    throw wamp_error(WAMP_ERROR_INVALID_URI, "realm has zero length");
+  check_publish_uris(realm, topic);
 
-  if (is_strict_uri(realm.c_str()) == false)
-    throw wamp_error(WAMP_ERROR_INVALID_URI, "realm fails strictness check");
+  /* A topic is only created to hold an image; otherwise an event to a topic
+   * without subscribers just needs a publication ID. */
+  const bool is_patch = options.find(KEY_PATCH) != options.end();
 
-  if (topic.empty())
-    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic has zero length");
+  for (;;)
+  {
+    std::shared_ptr<managed_topic> mt;
+    std::vector<std::shared_ptr<managed_topic>> patterns;
+    t_publication_id publication_id = 0;
 
-  if (is_strict_uri(topic.c_str()) == false)
-    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
+    mt = find_topic(topic, realm, is_patch);
+    if (!mt)
+      publication_id = untracked_publication_id(topic);
 
-  std::lock_guard<std::mutex> guard(m_lock);
-  return update_topic(topic, realm, std::move(options), args);
+    match_patterns(realm, topic, patterns);
+
+    if (!mt)
+    {
+      update_topic(nullptr, publication_id, patterns, topic,
+                   std::move(options), std::move(args));
+      return publication_id;
+    }
+
+    std::lock_guard<std::mutex> guard(mt->publish_lock());
+
+    /* reclaimed since it was found, so look it up again */
+    if (mt->is_retired())
+      continue;
+
+    publication_id = mt->next_publication_id();
+    update_topic(mt.get(), publication_id, patterns, topic,
+                 std::move(options), std::move(args));
+    return publication_id;
+  }
 }
 
 
-json_array pubsub_man::get_topics(const std::string& realm) const
+/* Publish a batch of publications to a realm.  The topics involved are all
+ * locked together, so that the
+ * EVENTs can be grouped by subscriber and each subscriber's EVENTs written to
+ * it together, in publication order. */
+std::vector<t_publication_id> pubsub_man::publish_batch(const std::string& realm,
+                                                        std::vector<publish_item>& items)
 {
   /* ANY thread */
 
-  std::lock_guard<std::mutex> guard(m_lock);
+  /* reject the whole batch before any topic is changed */
+  for (auto & item : items)
+  {
+    check_publish_uris(realm, item.uri);
+    check_patch(item.options, item.args);
+  }
 
-  auto realm_iter = m_topics.find(realm);
+  struct publication
+  {
+    std::shared_ptr<managed_topic> mt;
+    std::vector<std::shared_ptr<managed_topic>> patterns;
+    t_publication_id publication_id;
+  };
 
-  wampcc::json_array uris;
+  for (;;)
+  {
+    std::vector<publication> batch(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      const bool is_patch =
+        items[i].options.find(KEY_PATCH) != items[i].options.end();
+      batch[i].mt = find_topic(items[i].uri, realm, is_patch);
+      if (!batch[i].mt)
+        batch[i].publication_id = untracked_publication_id(items[i].uri);
+      match_patterns(realm, items[i].uri, batch[i].patterns);
+    }
+
+    /* lock each topic once, in subscription ID order, so that concurrent
+     * batches cannot deadlock */
+    std::vector<managed_topic*> topics;
+    for (auto & item : batch)
+      if (item.mt)
+        topics.push_back(item.mt.get());
+    std::sort(topics.begin(), topics.end(),
+              [](managed_topic* lhs, managed_topic* rhs) {
+                return lhs->subscription_id() < rhs->subscription_id();
+              });
+    topics.erase(std::unique(topics.begin(), topics.end()), topics.end());
+
+    std::vector<std::unique_lock<std::mutex>> guards;
+    guards.reserve(topics.size());
+    bool any_retired = false;
+    for (auto mt : topics)
+    {
+      guards.emplace_back(mt->publish_lock());
+      any_retired |= mt->is_retired();
+    }
+
+    /* a topic was reclaimed since it was found, so look them up again */
+    if (any_retired)
+      continue;
+
+    /* The messages and their encodings must outlive the writes; a list keeps
+     * them at fixed addresses. */
+    std::list<json_array> messages;
+    std::list<prepared_message> prepared;
+    std::map<wamp_session*,
+             std::pair<std::shared_ptr<wamp_session>,
+                       std::vector<prepared_message*>>> by_subscriber;
+    std::vector<managed_topic*> has_expired;
+    std::vector<std::shared_ptr<retained_event>> retained;
+
+    auto add_subscribers = [&](managed_topic* mt, prepared_message& pm)
+    {
+      bool expired = false;
+      for (auto & item : *mt->subscribers())
+      {
+        if (auto sp = item.lock())
+        {
+          auto & entry = by_subscriber[sp.get()];
+          if (!entry.first)
+            entry.first = std::move(sp);
+          entry.second.push_back(&pm);
+        }
+        else
+          expired = true;
+      }
+      if (expired)
+        has_expired.push_back(mt);
+    };
+
+    std::vector<t_publication_id> publication_ids;
+    publication_ids.reserve(items.size());
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      managed_topic* mt = batch[i].mt.get();
+      publish_item& item = items[i];
+
+      if (mt)
+      {
+        apply_patch(mt, item.options, item.args);
+        batch[i].publication_id = mt->next_publication_id();
+      }
+
+      /* pattern subscriptions take copies of the message, made shallow */
+      item.args.freeze();
+      messages.push_back(make_event(mt ? mt->subscription_id() : 0,
+                                    batch[i].publication_id,
+                                    std::move(item.options), item.args));
+      json_array& msg = messages.back();
+
+      if (mt && mt->history())
+      {
+        /* held until written, in case the history discards it first */
+        retained.push_back(mt->history()->append(msg, item.args.encoded));
+        add_subscribers(mt, retained.back()->prepared);
+      }
+      else if (mt)
+      {
+        prepared.emplace_back(msg, item.args.encoded.get());
+        add_subscribers(mt, prepared.back());
+      }
+
+      for (auto & pattern : batch[i].patterns)
+      {
+        messages.push_back(msg);
+        json_array& pattern_msg = messages.back();
+        pattern_msg[1] = pattern->subscription_id();
+        pattern_msg[3].as_object()["topic"] = item.uri;
+        prepared.emplace_back(pattern_msg, item.args.encoded.get());
+        add_subscribers(pattern.get(), prepared.back());
+      }
+
+      publication_ids.push_back(batch[i].publication_id);
+    }
+
+    for (auto & entry : by_subscriber)
+      entry.second.first->send_msg(entry.second.second);
+
+    for (auto mt : has_expired)
+      mt->remove_expired();
+
+    return publication_ids;
+  }
+}
+
+
+void pubsub_man::set_event_history(const std::string& realm,
+                                   const std::string& topic,
+                                   event_history_options options)
+{
+  /* ANY thread */
 
-  // Note that it's not an error if the realm is not found in the map; that just
+  check_publish_uris(realm, topic);
+
+  for (;;)
+  {
+    std::shared_ptr<managed_topic> mt = find_topic(topic, realm, true);
+
+    {
+      std::lock_guard<std::mutex> publish_guard(mt->publish_lock());
+
+      /* reclaimed since it was found, so look it up again */
+      if (mt->is_retired())
+        continue;
+
+      mt->set_history(options);
+    }
+
+    /* the topic may no longer be needed, if history was disabled */
+    if (mt->subscribers()->empty())
+      reclaim(mt);
+    return;
+  }
+}
+
+
+/* Represent a retained event as returned by the event history procedures */
+static json_object retained_event_to_json(const retained_event& ev)
+{
+  wamp_args args;
+  if (ev.encoded)
+  {
+    args.encoded = ev.encoded;
+    args.decode();
+  }
+  else
+  {
+    if (ev.msg.size() > 4)
+      args.args_list = ev.msg[4].as_array();
+    if (ev.msg.size() > 5)
+      args.args_dict = ev.msg[5].as_object();
+  }
+
+  return json_object({{"publication", ev.msg[2]},
+                      {"details", ev.msg[3]},
+                      {"args", std::move(args.args_list)},
+                      {"kwargs", std::move(args.args_dict)}});
+}
+
+
+json_array pubsub_man::get_events(const std::string& realm,
+                                  t_subscription_id sub_id,
+                                  size_t limit)
+{
+  /* ANY thread */
+
+  std::shared_ptr<managed_topic> mt;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto it = m_subscription_registry.find(sub_id);
+    if (it != m_subscription_registry.end() && it->second->realm() == realm)
+      mt = it->second;
+  }
+
+  if (!mt)
+    throw wamp_error(WAMP_ERROR_NO_SUCH_SUBSCRIPTION);
+
+  return get_events(mt.get(), limit);
+}
+
+
+json_array pubsub_man::get_history(const std::string& realm,
+                                   const std::string& topic,
+                                   size_t limit)
+{
+  /* ANY thread */
+
+  std::shared_ptr<managed_topic> mt = find_topic(topic, realm, false);
+
+  if (!mt)
+    return json_array();
+
+  return get_events(mt.get(), limit);
+}
+
+
+/* The last 'limit' retained events of a topic, oldest first; all of them if
+ * limit is zero. */
+json_array pubsub_man::get_events(managed_topic* mt, size_t limit)
+{
+  std::lock_guard<std::mutex> publish_guard(mt->publish_lock());
+
+  json_array events;
+  if (!mt->history())
+    return events;
+
+  const event_history::event_list& retained = mt->history()->events();
+  size_t first = (limit && limit < retained.size()) ? retained.size() - limit : 0;
+  events.reserve(retained.size() - first);
+  for (size_t i = first; i < retained.size(); i++)
+    events.push_back(retained_event_to_json(*retained[i]));
+
+  return events;
+}
+
+
+json_array pubsub_man::get_topics(const std::string& realm) const
+{
+  /* ANY thread */
+
+  std::vector<std::string> names;
+
+  // Note that it's not an error if the realm is not found in a shard; that just
   // means no topics have yet been registered.
 
-  if (realm_iter != m_topics.end()) {
-    const topic_registry& reg = realm_iter->second;
-    uris.reserve(reg.size());
-    for (auto & item : reg)
-      uris.push_back(item.first);
+  for (auto & sh : m_shards)
+  {
+    std::lock_guard<std::mutex> shard_guard(sh->lock);
+    auto realm_iter = sh->topics.find(realm);
+    if (realm_iter != sh->topics.end())
+      for (auto & item : realm_iter->second)
+        names.push_back(item.first);
   }
 
+  std::sort(names.begin(), names.end());
+
+  wampcc::json_array uris;
+  uris.reserve(names.size());
+  for (auto & name : names)
+    uris.push_back(std::move(name));
+
   return uris;
 }
 
 
 /* Add a subscription to a managed topic.  Need to sync the addition of the
-  subscriber, with the series of images and updates it sees. This is done via
-  single threaded access to this class.
+  subscriber, with the series of images and updates it sees. This is done by
+  holding the publish lock of the topic.
  */
 uint64_t pubsub_man::subscribe(wamp_session* sptr,
                                t_request_id request_id,
@@ -308,53 +1310,116 @@ uint64_t pubsub_man::subscribe(wamp_session* sptr,
   if (topic.empty())
     throw wamp_error(WAMP_ERROR_INVALID_URI, "topic has zero length");
 
-  if (is_strict_uri(topic.c_str()) == false)
-    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
-
-  std::lock_guard<std::mutex> guard(m_lock);
-
-  // find or create a topic
-  managed_topic* mt = find_topic(topic, sptr->realm(), true);
+  std::string match = "exact";
+  auto match_iter = options.find("match");
+  if (match_iter != options.end())
+  {
+    if (!match_iter->second.is_string())
+      throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "match option must be a string");
+    match = match_iter->second.as_string();
+  }
 
-  if (!mt)
-    throw wamp_error(WAMP_ERROR_INVALID_URI);
+  const bool is_exact = (match == "exact");
 
-  LOG_INFO("session #" << sptr->unique_id() << " subscribed to '"<< topic << "'");
+  if (!is_exact && match != "prefix" && match != "wildcard")
+    throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "unknown match policy");
 
-  json_array msg({msg_type::wamp_msg_subscribed, request_id,mt->subscription_id()});
-  sptr->send_msg(msg);
+  if (is_exact && is_strict_uri(topic.c_str()) == false)
+    throw wamp_error(WAMP_ERROR_INVALID_URI, "topic fails strictness check");
 
-  /* for stateful topic must send initial snapshot (only if an image exists) */
-  if (mt->is_valid() && (options.find(KEY_PATCH) != options.end()))
+  /* conflate the events of each topic, or of each value of an ArgumentsKw
+   * field, while the subscriber is slow */
+  bool conflate = false;
+  std::string conflate_key;
+  if (json_value* opt = json_get_ptr(options, WAMP_CONFLATE))
   {
-    wampcc::wamp_args pub_args;
-    pub_args.args_list = json_array();
+    if (opt->is_string() && !opt->as_string().empty())
+    {
+      conflate = true;
+      conflate_key = opt->as_string();
+    }
+    else if (opt->is_bool())
+      conflate = opt->as_bool();
+    else
+      throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT,
+                       "conflate option must be a bool or a field name");
+  }
 
-    json_array patch;
-    json_object& operation = json_append<json_object>(patch);
-    operation["op"]    = "replace";
-    operation["path"]  = "";  /* replace whole document */
-    operation["value"] = mt->image();
+  for (;;)
+  {
+    // find or create a topic or pattern
+    std::shared_ptr<managed_topic> mt;
+    if (is_exact)
+      mt = find_topic(topic, sptr->realm(), true);
+    else
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      mt = find_pattern(topic, match, sptr->realm());
+    }
 
-    pub_args.args_list.push_back(std::move(patch));
-    pub_args.args_list.push_back(json_array()); // empty event
+    {
+      std::lock_guard<std::mutex> publish_guard(mt->publish_lock());
+
+      /* reclaimed since it was found, so look it up again */
+      if (mt->is_retired())
+        continue;
+
+      if (is_exact)
+        LOG_INFO("session #" << sptr->unique_id() << " subscribed to '"<< topic << "'");
+      else
+        LOG_INFO("session #" << sptr->unique_id() << " subscribed to " << match
+                 << " '"<< topic << "'");
+
+      json_array msg({msg_type::wamp_msg_subscribed, request_id,mt->subscription_id()});
+      sptr->send_msg(msg);
+
+      /* for stateful topic must send initial snapshot (only if an image exists),
+       * so first bring the image up to date */
+      const bool wants_snapshot = options.find(KEY_PATCH) != options.end();
+      if (wants_snapshot && mt->is_valid())
+        fold_patches(mt.get());
+
+      const bool sent_snapshot = wants_snapshot && mt->is_valid();
+      if (sent_snapshot)
+        sptr->send_msg(mt->snapshot(options[KEY_PATCH]));
+
+      /* replay any retained events, as already encoded, in a single write.
+       * Each was published before the snapshot, so the patches among them
+       * are already applied to its image and are not sent again. */
+      json_value* get_retained = json_get_ptr(options, WAMP_GET_RETAINED);
+      if (get_retained && get_retained->is_true() && mt->history())
+      {
+        std::vector<prepared_message*> replay;
+        for (auto & ev : mt->history()->events())
+          if (!sent_snapshot || !ev->is_patch())
+            replay.push_back(&ev->prepared);
+        if (!replay.empty())
+          sptr->send_msg(replay);
+      }
+
+      if (conflate)
+        sptr->conflate_subscription(mt->subscription_id(), conflate_key);
+
+      mt->add(sptr->handle());
+    }
 
-    json_object event_options;
-    event_options[KEY_PATCH] = options[KEY_PATCH];
-    event_options[KEY_SNAPSHOT] = 1;
-    json_array snapshot_msg;
-    snapshot_msg.reserve(5);
-    snapshot_msg.push_back( msg_type::wamp_msg_event );
-    snapshot_msg.push_back( mt->subscription_id() );
-    snapshot_msg.push_back( 0 ); // publication id
-    snapshot_msg.push_back( std::move(event_options) );
-    snapshot_msg.push_back( pub_args.args_list );
-    sptr->send_msg(snapshot_msg);
-  }
+    /* index by session, so that session_closed need not search every topic */
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_session_subscriptions[sptr->unique_id()].insert(mt->subscription_id());
+    }
 
-  mt->add(sptr->handle());
+    /* A session is marked closed before session_closed is called, so if that
+     * ran after the subscriber was added but before it was indexed, it missed
+     * this subscription; repeat it, to remove the subscriber. */
+    if (sptr->is_closed())
+    {
+      auto session = sptr->shared_from_this();
+      session_closed(session);
+    }
 
-  return mt->subscription_id();
+    return mt->subscription_id();
+  }
 }
 
 
@@ -364,16 +1429,32 @@ void pubsub_man::unsubscribe(wamp_session* sptr,
 {
   /* ANY thread */
 
-  std::lock_guard<std::mutex> guard(m_lock);
+  std::shared_ptr<managed_topic> mt;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto it = m_subscription_registry.find(sub_id);
+    if (it != m_subscription_registry.end())
+      mt = it->second;
 
-  auto it = m_subscription_registry.find(sub_id);
+    auto session_iter = m_session_subscriptions.find(sptr->unique_id());
+    if (session_iter != m_session_subscriptions.end())
+    {
+      session_iter->second.erase(sub_id);
+      if (session_iter->second.empty())
+        m_session_subscriptions.erase(session_iter);
+    }
+  }
 
-  if (it != m_subscription_registry.end())
+  if (mt)
   {
-    it->second->remove(sptr->handle());
+    mt->remove(sptr->handle());
+    sptr->unconflate_subscription(sub_id);
 
     json_array msg({msg_type::wamp_msg_unsubscribed, request_id });
     sptr->send_msg(msg);
+
+    if (mt->subscribers()->empty())
+      reclaim(mt);
   }
   else
   {
@@ -382,26 +1463,35 @@ void pubsub_man::unsubscribe(wamp_session* sptr,
 }
 
 
-void pubsub_man::session_closed(session_handle /*sh*/)
+void pubsub_man::session_closed(std::shared_ptr<wamp_session>& session)
 {
-  /* EV loop */
+  /* EV thread */
 
-  // // design of this can be improved, ie, we should track what topics a session
-  // // has subscribed too, rather than searching every topic.
-  // for (auto & realm_iter : m_topics)
-  //   for (auto & item : realm_iter.second)
-  //   {
+  std::vector<std::shared_ptr<managed_topic>> subscribed;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
 
-  //     for (auto it = item.second->m_subscribers.begin();
-  //          it != item.second->m_subscribers.end(); it++)
-  //     {
-  //       if (compare_session( *it, sh))
-  //       {
-  //         item.second->m_subscribers.erase( it );
-  //         break;
-  //       }
-  //     }
-  //   }
+    auto session_iter = m_session_subscriptions.find(session->unique_id());
+    if (session_iter == m_session_subscriptions.end())
+      return;
+
+    for (auto sub_id : session_iter->second)
+    {
+      auto it = m_subscription_registry.find(sub_id);
+      if (it != m_subscription_registry.end())
+        subscribed.push_back(it->second);
+    }
+
+    m_session_subscriptions.erase(session_iter);
+  }
+
+  for (auto & mt : subscribed)
+  {
+    mt->remove(session);
+
+    if (mt->subscribers()->empty())
+      reclaim(mt);
+  }
 }
 
 } // namespace wampcc
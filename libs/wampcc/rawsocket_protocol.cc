@@ -14,6 +14,8 @@
 
 #include <sstream>
 
+#include <string.h>
+
 namespace wampcc {
 
 template<int N>
@@ -74,14 +76,20 @@ void rawsocket_protocol::initiate(t_initiate_cb cb)
 
   char handshake[HANDSHAKE_SIZE];
 
+  /* The serialiser field is an enumeration, not a bit set, so during
+   * rawsocket client initiation the client cannot advertise more than one
+   * protocol (like websocket is able to do).  So reject attempt if the
+   * protocol is not uniquely specified.*/
   int codecs = 0;
-  codecs |= (m_options.serialisers & serialiser_type::json)? e_JSON : 0;
-  codecs |= (m_options.serialisers & serialiser_type::msgpack)? e_MSGPACK : 0;
+  int count = 0;
+  for (auto s : {serialiser_type::json, serialiser_type::msgpack,
+                 serialiser_type::cbor})
+    if (m_options.serialisers & s) {
+      codecs = to_rawsocket_flag(s);
+      count++;
+    }
 
-  /* During rawsocket client initiation the client cannot advertise more than
-   * one protocol (like websocket is able to do).  So reject attempt if the
-   * protocol is not uniquely specified.*/
-  if (codecs != e_JSON && codecs != e_MSGPACK)
+  if (count != 1)
     throw std::runtime_error("rawsocket client must choose only one serialiser");
   
   format_handshake( handshake, m_options.inbound_max_msg_size, codecs);
@@ -127,9 +135,7 @@ void rawsocket_protocol::io_on_read(char* src, size_t len)
 
           /* determine the protocols common to both client and server */
 
-          int common = m_options.serialisers &
-            (((rd_1 & 0x0F & e_JSON)? serialiser_type::json : serialiser_type::none) |
-             ((rd_1 & 0x0F & e_MSGPACK)? serialiser_type::msgpack : serialiser_type::none));
+          int common = m_options.serialisers & to_serialiser(rd_1 & 0x0F);
 
           /* create the actual codec */
 
@@ -244,24 +250,85 @@ void rawsocket_protocol::io_on_read(char* src, size_t len)
 
 
 void rawsocket_protocol::send_msg(const json_array& ja)
+{
+  send_encoded(ja, nullptr);
+}
+
+
+void rawsocket_protocol::send_msg(const json_array& head,
+                                  const encoded_args& tail)
+{
+  send_encoded(head, &tail);
+}
+
+
+/* The framed message is encoded once, and then shared by each rawsocket
+ * session of the same serialisation. */
+const std::vector<char>& rawsocket_protocol::prepared_frame(prepared_message& pm)
+{
+  const serialiser_type st = m_codec->type();
+  const auto ff = prepared_message::frame_format::rawsocket;
+  const std::vector<char>* frame = pm.find(st, ff);
+
+  if (!frame) {
+    LOG_TRACE("fd: " << fd() << ", json_tx: " << pm.message());
+
+    std::vector<char> bytes;
+    encode(pm.message(), pm.tail(), bytes, FRAME_PREFIX_SIZE);
+    uint32_t msglen = htonl(bytes.size() - FRAME_PREFIX_SIZE);
+    memcpy(bytes.data(), &msglen, sizeof(msglen));
+    frame = &pm.store(st, ff, std::move(bytes));
+  }
+
+  return *frame;
+}
+
+
+void rawsocket_protocol::send_msg(prepared_message& pm)
 {
   if (!have_codec())
     return;
 
-  LOG_TRACE("fd: " << fd() << ", json_tx: " << ja);
+  const std::vector<char>& frame = prepared_frame(pm);
+  m_socket->write(frame.data(), frame.size());
+}
+
+
+void rawsocket_protocol::send_msg(std::vector<prepared_message*>& msgs)
+{
+  if (!have_codec())
+    return;
+
+  std::vector<std::pair<const char*, size_t>> bufs;
+  bufs.reserve(msgs.size());
+  for (auto pm : msgs) {
+    const std::vector<char>& frame = prepared_frame(*pm);
+    bufs.push_back({frame.data(), frame.size()});
+  }
 
-  auto bytes = encode(ja);
+  if (!bufs.empty())
+    m_socket->write(bufs.data(), bufs.size());
+}
+
+
+void rawsocket_protocol::send_encoded(const json_array& ja,
+                                      const encoded_args* tail)
+{
+  if (!have_codec())
+    return;
+
+  LOG_TRACE("fd: " << fd() << ", json_tx: " << ja);
 
-  std::pair<const char*, size_t> bufs[2];
+  std::lock_guard<std::mutex> guard(m_encode_lock);
 
-  uint32_t msglen = htonl(bytes.size());
-  bufs[0].first  = (char*)&msglen;
-  bufs[0].second = sizeof(msglen);
+  /* encode after space for the frame prefix, which is then filled in place,
+   * so that the whole frame is written as one contiguous buffer */
+  encode(ja, tail, m_encode_buf, FRAME_PREFIX_SIZE);
 
-  bufs[1].first  = bytes.data();
-  bufs[1].second = bytes.size();
+  uint32_t msglen = htonl(m_encode_buf.size() - FRAME_PREFIX_SIZE);
+  memcpy(m_encode_buf.data(), &msglen, sizeof(msglen));
 
-  m_socket->write(bufs, 2);
+  m_socket->write(m_encode_buf.data(), m_encode_buf.size());
 }
 
 
@@ -291,6 +358,7 @@ serialiser_type rawsocket_protocol::to_serialiser(uint8_t s)
     case serialiser_flag::e_INVALID : return serialiser_type::none;
     case serialiser_flag::e_JSON : return serialiser_type::json;
     case serialiser_flag::e_MSGPACK : return serialiser_type::msgpack;
+    case serialiser_flag::e_CBOR : return serialiser_type::cbor;
   }
 
   return serialiser_type::none;
@@ -303,6 +371,9 @@ int rawsocket_protocol::to_rawsocket_flag(serialiser_type p)
     case serialiser_type::none: return 0;
     case serialiser_type::json: return e_JSON;
     case serialiser_type::msgpack: return e_MSGPACK;
+    case serialiser_type::cbor: return e_CBOR;
+    case serialiser_type::json_batched: return 0; /* websocket only */
+    case serialiser_type::msgpack_batched: return 0;
   }
   return 0;
 }
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2017 Darren Smith
+ *
+ * wampcc is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "wampcc/simd.h"
+
+#include <stdexcept>
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define WAMPCC_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(WAMPCC_HAS_SSE2) && defined(__GNUC__)
+#define WAMPCC_HAS_AVX2
+#include <immintrin.h>
+#define WAMPCC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace wampcc
+{
+
+namespace
+{
+
+/* Validate the UTF-8 sequence starting at 'i', one code point at a time.
+ * Returns the position after it, or 'len'+1 if the input is invalid. */
+inline size_t utf8_step(const unsigned char* s, size_t i, size_t len)
+{
+  const unsigned char c = s[i];
+  if (c < 0x80)
+    return i + 1;
+
+  size_t n;
+  unsigned char lo = 0x80, hi = 0xBF;
+  if (c >= 0xC2 && c <= 0xDF)
+    n = 1;
+  else if (c == 0xE0) {
+    n = 2;
+    lo = 0xA0;
+  } else if ((c >= 0xE1 && c <= 0xEC) || c == 0xEE || c == 0xEF)
+    n = 2;
+  else if (c == 0xED) {
+    n = 2;
+    hi = 0x9F;
+  } else if (c == 0xF0) {
+    n = 3;
+    lo = 0x90;
+  } else if (c >= 0xF1 && c <= 0xF3)
+    n = 3;
+  else if (c == 0xF4) {
+    n = 3;
+    hi = 0x8F;
+  } else
+    return len + 1;
+
+  if (len - i - 1 < n)
+    return len + 1;
+
+  if (s[i + 1] < lo || s[i + 1] > hi)
+    return len + 1;
+  for (size_t k = 2; k <= n; k++)
+    if ((s[i + k] & 0xC0) != 0x80)
+      return len + 1;
+
+  return i + n + 1;
+}
+
+
+/* Validate the code points that start within [i, end), which may run past
+ * 'end'; returns the position after the last, or 'len'+1 if invalid. */
+inline size_t utf8_steps(const unsigned char* s, size_t i, size_t end,
+                         size_t len)
+{
+  while (i < end)
+    i = utf8_step(s, i, len);
+  return i;
+}
+
+
+void unmask_scalar(char* data, size_t len, const uint8_t (&key)[4])
+{
+  uint32_t k32;
+  memcpy(&k32, key, 4);
+  uint64_t k64 = (uint64_t(k32) << 32) | k32;
+
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, data + i, 8);
+    v ^= k64;
+    memcpy(data + i, &v, 8);
+  }
+  for (; i < len; i++)
+    data[i] ^= key[i & 3];
+}
+
+
+/* ASCII fast path: eight bytes are tested at a time, and a word holding any
+ * other byte is validated one code point at a time. */
+bool utf8_scalar(const char* data, size_t len)
+{
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i + 8 <= len) {
+    uint64_t v;
+    memcpy(&v, s + i, 8);
+    if (v & 0x8080808080808080ULL)
+      i = utf8_steps(s, i, i + 8, len);
+    else
+      i += 8;
+  }
+  i = utf8_steps(s, i, len, len);
+  return i == len;
+}
+
+
+#ifdef WAMPCC_HAS_SSE2
+
+void unmask_sse2(char* data, size_t len, const uint8_t (&key)[4])
+{
+  int32_t k32;
+  memcpy(&k32, key, 4);
+  const __m128i k = _mm_set1_epi32(k32);
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i* p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k));
+  }
+  for (; i < len; i++)
+    data[i] ^= key[i & 3];
+}
+
+
+/* ASCII fast path, as utf8_scalar, sixteen bytes at a time.  SSE2 has no byte
+ * shuffle for the table lookups of utf8_avx2. */
+bool utf8_sse2(const char* data, size_t len)
+{
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i + 16 <= len) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    if (_mm_movemask_epi8(v))
+      i = utf8_steps(s, i, i + 16, len);
+    else
+      i += 16;
+  }
+  i = utf8_steps(s, i, len, len);
+  return i == len;
+}
+
+#endif
+
+
+#ifdef WAMPCC_HAS_AVX2
+
+WAMPCC_TARGET_AVX2
+void unmask_avx2(char* data, size_t len, const uint8_t (&key)[4])
+{
+  int32_t k32;
+  memcpy(&k32, key, 4);
+  const __m256i k = _mm256_set1_epi32(k32);
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k));
+  }
+  for (; i < len; i++)
+    data[i] ^= key[i & 3];
+}
+
+
+/* Error classes of a pair of adjacent bytes, for utf8_avx2.  Each is set in
+ * the table entries for the first byte's high and low nibbles and the second
+ * byte's high nibble that can give that error, so the pair is in error where
+ * the three entries have a class in common.  From "Validating UTF-8 in less
+ * than one instruction per byte" (Keiser and Lemire, 2021). */
+enum : uint8_t
+{
+  TOO_SHORT = 1 << 0,      /* 11______ 0_______, or 11______ 11______ */
+  TOO_LONG = 1 << 1,       /* 0_______ 10______ */
+  OVERLONG_3 = 1 << 2,     /* 11100000 100_____ */
+  TOO_LARGE = 1 << 3,      /* 11110100 1001____, and above */
+  SURROGATE = 1 << 4,      /* 11101101 101_____ */
+  OVERLONG_2 = 1 << 5,     /* 1100000_ 10______ */
+  TOO_LARGE_1000 = 1 << 6, /* 11110101 1000____, and above */
+  OVERLONG_4 = 1 << 6,     /* 11110000 1000____ */
+  TWO_CONTS = 1 << 7,      /* 10______ 10______ */
+  CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+const uint8_t utf8_byte_1_high[16] = {
+  /* 0_______ ASCII */
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+  /* 10______ continuation */
+  TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+  /* 1100____, 1101____ two byte lead */
+  TOO_SHORT | OVERLONG_2,
+  TOO_SHORT,
+  /* 1110____ three byte lead */
+  TOO_SHORT | OVERLONG_3 | SURROGATE,
+  /* 1111____ four byte lead */
+  TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+const uint8_t utf8_byte_1_low[16] = {
+  CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, /* ____0000 */
+  CARRY | OVERLONG_2,                           /* ____0001 */
+  CARRY,
+  CARRY,
+  CARRY | TOO_LARGE,                            /* ____0100 */
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, /* ____1101 */
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+const uint8_t utf8_byte_2_high[16] = {
+  /* 0_______ ASCII */
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+  /* 1000____ */
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+  /* 1001____ */
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+  /* 101_____ */
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+  /* 11______ lead */
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+
+/* The 32 bytes ending N bytes before the end of 'input', where 'prev' holds
+ * the bytes preceding 'input'. */
+template <int N>
+WAMPCC_TARGET_AVX2
+inline __m256i avx2_prev(__m256i input, __m256i prev)
+{
+  return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21),
+                            16 - N);
+}
+
+
+WAMPCC_TARGET_AVX2
+inline __m256i avx2_table(const uint8_t (&table)[16])
+{
+  return _mm256_broadcastsi128_si256(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+
+/* Validate 32 bytes at a time, classifying each pair of adjacent bytes by
+ * table lookups, rather than a code point at a time; blocks of only ASCII are
+ * skipped.  The input is followed by a block of zeros, so that a sequence
+ * truncated at the end is found as too short. */
+WAMPCC_TARGET_AVX2
+bool utf8_avx2(const char* data, size_t len)
+{
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+
+  const __m256i byte_1_high = avx2_table(utf8_byte_1_high);
+  const __m256i byte_1_low = avx2_table(utf8_byte_1_low);
+  const __m256i byte_2_high = avx2_table(utf8_byte_2_high);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i third_byte = _mm256_set1_epi8(char(0xE0 - 0x80));
+  const __m256i fourth_byte = _mm256_set1_epi8(char(0xF0 - 0x80));
+  const __m256i high_bit = _mm256_set1_epi8(char(0x80));
+
+  /* greatest values of the last three bytes of a block that do not start a
+   * sequence continuing into the next block */
+  const __m256i max_complete = _mm256_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+
+  for (size_t i = 0;; i += 32) {
+    const bool is_last = (i + 32 > len);
+    __m256i input;
+    if (is_last) {
+      unsigned char tail[32] = {};
+      memcpy(tail, s + i, len - i);
+      input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+    }
+    else
+      input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+
+    if (_mm256_movemask_epi8(input) == 0)
+      error = _mm256_or_si256(error, prev_incomplete);
+    else {
+      const __m256i prev1 = avx2_prev<1>(input, prev_input);
+      const __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+          _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(
+                                _mm256_srli_epi16(prev1, 4), nibble)),
+          _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(
+                              _mm256_srli_epi16(input, 4), nibble)));
+
+      /* a byte two after a three or four byte lead, or three after a four byte
+       * lead, must be a continuation, which the pair check cannot see */
+      const __m256i must_be_23_cont = _mm256_and_si256(
+        _mm256_or_si256(
+          _mm256_subs_epu8(avx2_prev<2>(input, prev_input), third_byte),
+          _mm256_subs_epu8(avx2_prev<3>(input, prev_input), fourth_byte)),
+        high_bit);
+
+      error = _mm256_or_si256(error,
+                              _mm256_xor_si256(must_be_23_cont, special));
+      prev_incomplete = _mm256_subs_epu8(input, max_complete);
+    }
+    prev_input = input;
+
+    if (is_last)
+      break;
+  }
+
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error) != 0;
+}
+
+#endif
+
+
+struct simd_impl
+{
+  void (*unmask)(char*, size_t, const uint8_t (&)[4]);
+  bool (*is_valid_utf8)(const char*, size_t);
+  const char* name;
+};
+
+
+const simd_impl scalar_impl = {unmask_scalar, utf8_scalar, "scalar"};
+#ifdef WAMPCC_HAS_SSE2
+const simd_impl sse2_impl = {unmask_sse2, utf8_sse2, "sse2"};
+#endif
+#ifdef WAMPCC_HAS_AVX2
+const simd_impl avx2_impl = {unmask_avx2, utf8_avx2, "avx2"};
+#endif
+
+
+/* The implementation of a level, or null if it is not supported */
+const simd_impl* level_impl(simd_level level)
+{
+  switch (level) {
+    case simd_level::scalar:
+      return &scalar_impl;
+    case simd_level::sse2:
+#ifdef WAMPCC_HAS_SSE2
+      return &sse2_impl;
+#else
+      return nullptr;
+#endif
+    case simd_level::avx2:
+#ifdef WAMPCC_HAS_AVX2
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+        return &avx2_impl;
+#endif
+      return nullptr;
+  }
+  return nullptr;
+}
+
+
+const simd_impl& select_impl()
+{
+  for (auto level : {simd_level::avx2, simd_level::sse2})
+    if (const simd_impl* ptr = level_impl(level))
+      return *ptr;
+  return scalar_impl;
+}
+
+
+const simd_impl& impl()
+{
+  static const simd_impl& selected = select_impl();
+  return selected;
+}
+
+
+const simd_impl& checked_impl(simd_level level)
+{
+  const simd_impl* ptr = level_impl(level);
+  if (!ptr)
+    throw std::runtime_error("simd implementation not supported");
+  return *ptr;
+}
+
+} // anonymous namespace
+
+
+void simd_unmask(char* data, size_t len, const uint8_t (&key)[4])
+{
+  impl().unmask(data, len, key);
+}
+
+
+bool simd_is_valid_utf8(const char* data, size_t len)
+{
+  return impl().is_valid_utf8(data, len);
+}
+
+
+const char* simd_impl_name() { return impl().name; }
+
+
+bool simd_supported(simd_level level)
+{
+  return level_impl(level) != nullptr;
+}
+
+
+void simd_unmask(simd_level level, char* data, size_t len,
+                 const uint8_t (&key)[4])
+{
+  checked_impl(level).unmask(data, len, key);
+}
+
+
+bool simd_is_valid_utf8(simd_level level, const char* data, size_t len)
+{
+  return checked_impl(level).is_valid_utf8(data, len);
+}
+
+} // namespace wampcc
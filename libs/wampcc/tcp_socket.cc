@@ -6,6 +6,7 @@
  */
 
 #include "wampcc/io_loop.h"
+#include "wampcc/event_loop.h"
 #include "wampcc/kernel.h"
 #include "wampcc/log_macros.h"
 #include "wampcc/socket_address.h"
@@ -14,6 +15,7 @@
 
 #include <uv.h>
 
+#include <algorithm>
 #include <assert.h>
 
 namespace wampcc
@@ -21,6 +23,21 @@ namespace wampcc
 
 constexpr std::chrono::seconds tcp_socket::options::default_keep_alive_delay;
 
+
+/* Contiguous store of bytes written while a socket is corked. */
+struct tcp_socket::cork_buffer
+{
+  std::mutex lock;
+  tcp_socket* owner; /* reset on socket close; only read on the IO thread */
+  char* data = nullptr;
+  size_t len = 0;
+  size_t capacity = 0;
+  bool flush_pending = false;
+
+  cork_buffer(tcp_socket* p) : owner(p) {}
+  ~cork_buffer() { delete[] data; }
+};
+
 tcp_socket_guard::tcp_socket_guard(std::unique_ptr<tcp_socket>& __sock)
   : sock(__sock)
 {
@@ -88,7 +105,9 @@ static void iohandle_alloc_buffer(uv_handle_t* /* handle */,
 tcp_socket::options::options()
   : tcp_no_delay_enable(default_tcp_no_delay_enable),
     keep_alive_enable(default_keep_alive_enable),
-    keep_alive_delay(default_keep_alive_delay) {
+    keep_alive_delay(default_keep_alive_delay),
+    cork_enable(default_cork_enable),
+    cork_window(0) {
 }
 
 
@@ -104,7 +123,8 @@ tcp_socket::tcp_socket(kernel* k, uv_tcp_t* h, socket_state ss,
     m_bytes_pending_write(0),
     m_bytes_written(0),
     m_bytes_read(0),
-    m_self (this, [](tcp_socket*){/* null deleter */})
+    m_self (this, [](tcp_socket*){/* null deleter */}),
+    m_cork(opts.cork_enable? new cork_buffer(this) : nullptr)
 {
   if (m_uv_tcp) {
     assert(m_uv_tcp->data == nullptr);
@@ -261,6 +281,10 @@ void tcp_socket::close_impl()
   decltype(m_user_close_fn) user_close_fn;
   decltype(m_io_closed_promise) closed_promise;
 
+  /* detach from any flush request still in flight */
+  if (m_cork)
+    m_cork->owner = nullptr;
+
   /* Once the state is set to closed, this tcp_socket object may be immediately
    * deleted by another thread. So this must be the last action that makes use
    * of the tcp_socket members. */
@@ -311,6 +335,7 @@ std::shared_future<void> tcp_socket::close()
   std::lock_guard<std::mutex> guard(m_state_lock);
 
   if (m_state != socket_state::closing && m_state != socket_state::closed) {
+    uncork();
     m_state = socket_state::closing;
     m_kernel->get_io()->push_fn([this]() { this->begin_close(); }); // can throw
   }
@@ -352,6 +377,7 @@ bool tcp_socket::close(on_close_cb user_on_close_fn)
   m_user_close_fn = user_on_close_fn;
 
   if (m_state != socket_state::closing) {
+    uncork();
     m_state = socket_state::closing;
     m_kernel->get_io()->push_fn([this]() { this->begin_close(); }); // can throw
   }
@@ -442,6 +468,12 @@ void tcp_socket::on_read_cb(ssize_t nread, const uv_buf_t* buf)
 
 void tcp_socket::write(const char* src, size_t len)
 {
+  if (m_cork) {
+    std::pair<const char*, size_t> srcbuf(src, len);
+    cork_write(&srcbuf, 1);
+    return;
+  }
+
   uv_buf_t buf;
 
   scope_guard buf_guard([&buf]() {
@@ -469,6 +501,11 @@ void tcp_socket::write(const char* src, size_t len)
 
 void tcp_socket::write(std::pair<const char*, size_t>* srcbuf, size_t count)
 {
+  if (m_cork) {
+    cork_write(srcbuf, count);
+    return;
+  }
+
   // improve memory usage here
   std::vector<uv_buf_t> bufs;
 
@@ -502,6 +539,115 @@ void tcp_socket::write(std::pair<const char*, size_t>* srcbuf, size_t count)
 }
 
 
+void tcp_socket::cork_write(std::pair<const char*, size_t>* srcbuf,
+                            size_t count)
+{
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++)
+    total += srcbuf[i].second;
+
+  std::lock_guard<std::mutex> guard(m_state_lock);
+  if (m_state == socket_state::closing || m_state == socket_state::closed)
+    throw tcp_socket::error("tcp_socket::write() when closing or closed");
+
+  const size_t pend_max = m_kernel->get_config().socket_max_pending_write_bytes;
+
+  bool schedule_flush;
+  bool over_limit;
+  {
+    std::lock_guard<std::mutex> cork_guard(m_cork->lock);
+    cork_buffer& cb = *m_cork;
+
+    if (cb.len + total > cb.capacity) {
+      size_t capacity = (std::max)((std::max)(cb.capacity * 2, cb.len + total),
+                                   size_t(4096));
+      char* data = new char[capacity];
+      if (cb.len)
+        memcpy(data, cb.data, cb.len);
+      delete[] cb.data;
+      cb.data = data;
+      cb.capacity = capacity;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      memcpy(cb.data + cb.len, srcbuf[i].first, srcbuf[i].second);
+      cb.len += srcbuf[i].second;
+    }
+
+    /* corked bytes count towards the pending write limit */
+    over_limit = cb.len + m_bytes_pending_write > pend_max;
+
+    schedule_flush = !cb.flush_pending && !over_limit;
+    cb.flush_pending |= schedule_flush;
+  }
+
+  if (over_limit) {
+    /* Flush now rather than let the buffer grow until the EV thread gets to
+     * it; the IO thread then applies the limit, as for uncorked writes. */
+    uncork();
+    return;
+  }
+
+  if (schedule_flush) {
+    /* The flush is requested via the EV thread, so that it runs only after the
+     * EV thread has completed its current batch of work (or after the cork
+     * window), by which time many more messages may have been added. */
+    std::weak_ptr<cork_buffer> wp = m_cork;
+    kernel* k = m_kernel;
+    auto flush_fn = [wp, k]() {
+      /* EV thread */
+      if (auto sp = wp.lock()) {
+        try {
+          k->get_io()->push_fn([sp]() {
+            /* IO thread */
+            if (sp->owner && sp->owner->take_corked())
+              sp->owner->service_pending_write();
+          });
+        } catch (io_loop_closed&) { /* socket will not be written */ }
+      }
+    };
+
+    if (m_sockopts.cork_window.count() > 0)
+      m_kernel->get_event_loop()->dispatch_after(m_sockopts.cork_window,
+                                                 std::move(flush_fn));
+    else
+      m_kernel->get_event_loop()->dispatch(std::move(flush_fn));
+  }
+}
+
+
+/* Move any coalesced bytes onto the pending-write queue, as a single buffer.
+ * Returns true if there were bytes to move. */
+bool tcp_socket::take_corked()
+{
+  uv_buf_t buf;
+  {
+    std::lock_guard<std::mutex> guard(m_cork->lock);
+    m_cork->flush_pending = false;
+    if (m_cork->len == 0)
+      return false;
+
+    buf = uv_buf_init(m_cork->data, m_cork->len);
+    m_cork->data = nullptr;
+    m_cork->len = 0;
+    m_cork->capacity = 0;
+  }
+
+  std::lock_guard<std::mutex> guard(m_pending_write_lock);
+  m_pending_write.push_back(buf);
+  return true;
+}
+
+
+/* Flush corked bytes ahead of a socket close, so that they are treated no
+ * differently to uncorked writes. Must be called with the state lock held. */
+void tcp_socket::uncork()
+{
+  if (m_cork && take_corked())
+    m_kernel->get_io()->push_fn([this]() { service_pending_write(); });
+}
+
+
 void tcp_socket::do_write(std::vector<uv_buf_t>& bufs)
 {
   /* IO thread */
@@ -104,6 +104,21 @@ void wamp_router::publish(const std::string& realm, const std::string& topic,
 {
   /* USER thread */
 
+  /* the args are copied into the dispatched function, and then for each
+   * subscriber; freezing makes those copies shallow */
+  args.freeze();
+
+  if (m_pubsub->shard_threads())
+  {
+    /* pubsub_man stops its shard threads before it is destroyed */
+    pubsub_man* pubsub = m_pubsub.get();
+    m_pubsub->dispatch(m_pubsub->shard_of(topic),
+                       [pubsub, topic, realm, args, options]() {
+      pubsub->publish(realm, topic, options, args);
+    });
+    return;
+  }
+
   std::weak_ptr<wamp_router> wp = this->shared_from_this();
 
   // TODO: how to use bind here, to pass options in as a move operation?
@@ -114,6 +129,53 @@ void wamp_router::publish(const std::string& realm, const std::string& topic,
 }
 
 
+void wamp_router::publish_batch(const std::string& realm,
+                                std::vector<publish_item> items)
+{
+  /* USER thread */
+
+  for (auto & item : items)
+    item.args.freeze();
+
+  if (m_pubsub->shard_threads())
+  {
+    /* each shard publishes its part of the batch on its own thread */
+    std::map<size_t, std::vector<publish_item>> parts;
+    for (auto & item : items)
+      parts[m_pubsub->shard_of(item.uri)].push_back(std::move(item));
+
+    pubsub_man* pubsub = m_pubsub.get();
+    for (auto & part : parts)
+    {
+      auto batch = std::make_shared<std::vector<publish_item>>(std::move(part.second));
+      m_pubsub->dispatch(part.first, [pubsub, realm, batch]() {
+        pubsub->publish_batch(realm, *batch);
+      });
+    }
+    return;
+  }
+
+  auto batch = std::make_shared<std::vector<publish_item>>(std::move(items));
+
+  std::weak_ptr<wamp_router> wp = this->shared_from_this();
+
+  m_kernel->get_event_loop()->dispatch([wp, realm, batch]() {
+    if (auto sp = wp.lock())
+      sp->m_pubsub->publish_batch(realm, *batch);
+  });
+}
+
+
+void wamp_router::set_event_history(const std::string& realm,
+                                    const std::string& uri,
+                                    event_history_options options)
+{
+  /* USER thread */
+
+  m_pubsub->set_event_history(realm, uri, options);
+}
+
+
 void wamp_router::rpc_registered_cb(const rpc_details& r)
 {
   std::lock_guard<std::recursive_mutex> guard(m_lock);
@@ -184,6 +246,9 @@ void wamp_router::handle_inbound_call(
 
         if (rpc.user_cb) {
 
+          /* internal procedures need the decoded arguments */
+          args.decode();
+
           call_info info { request_id,
               options, // TODO: should details be passed instead of options?
               std::move(args),
@@ -209,13 +274,14 @@ void wamp_router::handle_inbound_call(
               if (auto caller = caller_wp.lock())
               {
                 if (info)
-                  caller->result(caller_request_id, info.args.args_list, info.args.args_dict);
+                  caller->result_args(caller_request_id, json_object(),
+                                      std::move(info.args));
                 else
                   caller->call_error(caller_request_id, info.error_uri, info.additional, info.args.args_list, info.args.args_dict);
               }
             };
 
-          callee->invocation(rpc.registration_id, std::move(details), args, fn);
+          callee->invocation(rpc.registration_id, std::move(details), std::move(args), fn);
         }
         else
           throw wamp_error(WAMP_ERROR_NO_ELIGIBLE_CALLEE);
@@ -227,6 +293,28 @@ void wamp_router::handle_inbound_call(
     else if (uri == WAMP_REFLECTION_TOPIC_LIST) {
       ws->result(request_id, m_pubsub->get_topics(ws->realm()));
     }
+    else if (uri == WAMP_SUBSCRIPTION_GET_EVENTS) {
+      /* arguments: subscription id, and optionally the event limit */
+      args.decode();
+      json_value* sub_id = json_get_ptr(args.args_list, 0);
+      json_value* limit = json_get_ptr(args.args_list, 1);
+      if (!sub_id || !sub_id->is_uint64())
+        throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "expected subscription id");
+      ws->result(request_id,
+                 m_pubsub->get_events(ws->realm(), sub_id->as_uint(),
+                                      (limit && limit->is_uint64()) ? limit->as_uint() : 0));
+    }
+    else if (uri == WAMP_TOPIC_HISTORY_LAST) {
+      /* arguments: topic uri, and optionally the event limit */
+      args.decode();
+      json_value* topic = json_get_ptr(args.args_list, 0);
+      json_value* limit = json_get_ptr(args.args_list, 1);
+      if (!topic || !topic->is_string())
+        throw wamp_error(WAMP_ERROR_INVALID_ARGUMENT, "expected topic uri");
+      ws->result(request_id,
+                 m_pubsub->get_history(ws->realm(), topic->as_string(),
+                                       (limit && limit->is_uint64()) ? limit->as_uint() : 0));
+    }
     else
     {
       /* RPC uri lookup failed */
@@ -378,6 +466,30 @@ std::future<uverr> wamp_router::listen(auth_provider auth,
         json_value* ptr = json_get_ptr(options, WAMP_ACKNOWLEDGE);
         bool acknowledge = ptr && ptr->is_true();
 
+        if (m_pubsub->shard_threads())
+        {
+          /* publish on the thread of the topic's shard, which then replies */
+          pubsub_man* pubsub = m_pubsub.get();
+          std::weak_ptr<wamp_session> wp = ws.shared_from_this();
+          std::string realm = ws.realm();
+          args.freeze();
+          m_pubsub->dispatch(m_pubsub->shard_of(uri),
+                             [pubsub, wp, realm, uri, details, args,
+                              request_id, acknowledge]() {
+            try {
+              auto publication_id = pubsub->publish(realm, uri, details, args);
+              if (acknowledge)
+                if (auto sp = wp.lock())
+                  sp->published(request_id, publication_id);
+            }
+            catch (const wamp_error& e) {
+              if (auto sp = wp.lock())
+                sp->publish_error(request_id, e.error_uri(), e.details());
+            }
+          });
+          return;
+        }
+
         auto publication_id = m_pubsub->publish(
           ws.realm(), uri, std::move(details), std::move(args));
 
@@ -440,12 +552,16 @@ std::future<uverr> wamp_router::listen(auth_provider auth,
       return up;
     };
 
+    /* arguments are mostly forwarded, not inspected */
+    wamp_session::options session_opts;
+    session_opts.defer_args_decode = true;
+
     std::shared_ptr<wamp_session> sp =
         wamp_session::create(m_kernel, std::move(sock),
                              [this](wamp_session&s, bool b) {
                                this->handle_session_state_change(s, b);
                              },
-                             builder_fn, handlers, auth);
+                             builder_fn, handlers, auth, session_opts);
     {
       std::lock_guard<std::mutex> guard(m_sessions_lock);
       m_sessions[sp->unique_id()] = sp;
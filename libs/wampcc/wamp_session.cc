@@ -23,6 +23,7 @@
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <list>
 
 #include <string.h>
 #include <assert.h>
@@ -230,6 +231,7 @@ wamp_session::wamp_session(kernel* __kernel,
     m_server_requires_auth(true), /* assume server requires auth by default */
     m_notify_state_change_fn(std::move(state_cb)),
     m_server_handler(handler),
+    m_has_conflation(false),
     m_options(std::move(opts)),
     m_user(user)
 {
@@ -292,6 +294,19 @@ std::shared_ptr<wamp_session> wamp_session::create_impl(kernel* k,
     rawptr->m_kernel->get_event_loop()->dispatch(std::move(fn));
   };
 
+  /* As on_msg_cb, for messages with arguments left encoded */
+  auto on_deferred_args_msg_cb = [rawptr](json_array msg, json_uint_t msg_type,
+                                          std::shared_ptr<const encoded_args> args) {
+    /* IO thread */
+    std::weak_ptr<wamp_session> wp = rawptr->handle();
+    auto fn = [wp,msg,msg_type,args]() mutable
+    {
+      if (auto sp = wp.lock())
+        sp->process_message(msg, msg_type, std::move(args));
+    };
+    rawptr->m_kernel->get_event_loop()->dispatch(std::move(fn));
+  };
+
   auto upgrade_cb = [rawptr](std::unique_ptr<protocol>&new_proto) {
     /* IO thread */
     rawptr->upgrade_protocol(new_proto);
@@ -337,18 +352,39 @@ std::shared_ptr<wamp_session> wamp_session::create_impl(kernel* k,
     }
   };
 
+  auto request_flush_fn = [rawptr]() {
+    /* ANY thread */
+    /* Protocol is holding back outbound messages; flush them once the EV
+     * thread has completed its current batch of work. */
+    std::weak_ptr<wamp_session> wp = rawptr->handle();
+    auto fn = [wp]() {
+      if (auto sp = wp.lock()) {
+        try {
+          sp->m_proto->flush();
+        } catch (...) { /* socket closing */ }
+      }
+    };
+    rawptr->m_kernel->get_event_loop()->dispatch(std::move(fn));
+  };
+
   // Create the protocol, using the builder function passed in. Here we use only
   // the raw pointer, not the shared pointer. If we use the latter (ie if they
   // were captured by the lambdas), the wamp_session would hold references to
   // itself, and so would be tricky to delete.
 
+  protocol::protocol_callbacks callbacks {
+    std::move(upgrade_cb),
+    std::move(request_timer_cb),
+    std::move(protocol_closed_fn),
+    std::move(request_flush_fn),
+    nullptr
+  };
+  if (sp->m_options.defer_args_decode)
+    callbacks.deferred_args_msg = std::move(on_deferred_args_msg_cb);
+
   sp->m_proto = protocol_builder(sp->m_socket.get(),
                                  std::move(on_msg_cb),
-                                 {
-                                   std::move(upgrade_cb),
-                                   std::move(request_timer_cb),
-                                   std::move(protocol_closed_fn)
-                                  });
+                                 std::move(callbacks));
 
   // Enable the socket for read events; this can only take place once the
   // session's weak self pointer has been set up.
@@ -575,7 +611,8 @@ void wamp_session::process_inbound_goodbye(json_array &)
 
 
 void wamp_session::process_message(json_array& ja,
-                                   json_uint_t message_type)
+                                   json_uint_t message_type,
+                                   std::shared_ptr<const encoded_args> encoded)
 {
   /* EV thread */
 
@@ -614,15 +651,15 @@ void wamp_session::process_message(json_array& ja,
       switch (message_type)
       {
         case msg_type::wamp_msg_call :
-          process_inbound_call(ja);
+          process_inbound_call(ja, std::move(encoded));
           return;
 
         case msg_type::wamp_msg_yield :
-          process_inbound_yield(ja);
+          process_inbound_yield(ja, std::move(encoded));
           return;
 
         case msg_type::wamp_msg_publish :
-          process_inbound_publish(ja);
+          process_inbound_publish(ja, std::move(encoded));
           return;
 
         case msg_type::wamp_msg_subscribe :
@@ -696,7 +733,7 @@ void wamp_session::process_message(json_array& ja,
           return;
 
         case msg_type::wamp_msg_event :
-          process_inbound_event(ja);
+          process_inbound_event(ja, std::move(encoded));
           return;
 
         case msg_type::wamp_msg_result :
@@ -767,7 +804,7 @@ void wamp_session::handle_exception()
 }
 
 
-void wamp_session::send_msg(const json_array& jv)
+void wamp_session::send_msg(const json_array& jv, const encoded_args* tail)
 {
   {
     std::lock_guard<std::mutex> guard(m_state_lock);
@@ -777,7 +814,194 @@ void wamp_session::send_msg(const json_array& jv)
 
   update_state_for_outbound(jv);
 
-  m_proto->send_msg(jv);
+  if (tail)
+    m_proto->send_msg(jv, *tail);
+  else
+    m_proto->send_msg(jv);
+}
+
+
+/* As send_msg, for a message shared with other sessions */
+void wamp_session::send_msg(prepared_message& pm)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_state_lock);
+    if (is_in(m_state, state::closing, state::closed, state::closing_wait))
+      return;
+  }
+
+  if (m_has_conflation && conflate(pm))
+    return;
+
+  update_state_for_outbound(pm.message());
+
+  m_proto->send_msg(pm);
+}
+
+
+/* As send_msg, for several messages, which are written together */
+void wamp_session::send_msg(std::vector<prepared_message*>& msgs)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_state_lock);
+    if (is_in(m_state, state::closing, state::closed, state::closing_wait))
+      return;
+  }
+
+  if (m_has_conflation)
+  {
+    msgs.erase(std::remove_if(msgs.begin(), msgs.end(),
+                              [this](prepared_message* pm) {
+                                return conflate(*pm);
+                              }),
+               msgs.end());
+    if (msgs.empty())
+      return;
+  }
+
+  for (auto pm : msgs)
+    update_state_for_outbound(pm->message());
+
+  m_proto->send_msg(msgs);
+}
+
+
+/* Interval at which a backlogged socket is checked, while EVENTs are held */
+static const std::chrono::milliseconds conflation_poll_interval(10);
+
+
+void wamp_session::conflate_subscription(t_subscription_id sub_id,
+                                         std::string key)
+{
+  std::lock_guard<std::mutex> guard(m_conflation_lock);
+  m_conflated_subscriptions[sub_id] = std::move(key);
+  m_has_conflation = true;
+}
+
+
+void wamp_session::unconflate_subscription(t_subscription_id sub_id)
+{
+  std::lock_guard<std::mutex> guard(m_conflation_lock);
+  if (m_conflated_subscriptions.erase(sub_id) == 0)
+    return;
+
+  /* no events are delivered once unsubscribed */
+  for (auto it = m_conflated_events.begin(); it != m_conflated_events.end();)
+  {
+    if (it->msg[1].as_uint() == sub_id)
+    {
+      m_conflated_index.erase(it->key);
+      it = m_conflated_events.erase(it);
+    }
+    else
+      ++it;
+  }
+
+  m_has_conflation = !m_conflated_subscriptions.empty();
+}
+
+
+/* Hold back an EVENT of a conflating subscription if the socket is backlogged,
+ * or if earlier EVENTs are already held, replacing any held EVENT of the same
+ * topic and key.  Returns true if the EVENT was held, rather than to be sent
+ * now. */
+bool wamp_session::conflate(prepared_message& pm)
+{
+  const json_array& msg = pm.message();
+  if (msg.empty() || msg[0].as_uint() != msg_type::wamp_msg_event)
+    return false;
+
+  t_subscription_id sub_id = msg[1].as_uint();
+
+  std::lock_guard<std::mutex> guard(m_conflation_lock);
+
+  auto sub = m_conflated_subscriptions.find(sub_id);
+  if (sub == m_conflated_subscriptions.end())
+    return false;
+
+  if (m_conflated_events.empty() &&
+      m_socket->bytes_pending_write() <=
+        m_kernel->get_config().socket_conflation_threshold_bytes)
+    return false;
+
+  conflated_event ev;
+  ev.msg = msg;
+  if (pm.tail())
+    ev.tail = std::make_shared<encoded_args>(*pm.tail());
+
+  /* The key is the subscription, then the concrete topic, for a pattern
+   * subscription, then the value of the chosen ArgumentsKw field. */
+  ev.key = std::to_string(sub_id);
+  const json_value* topic = json_get_ptr(msg[3].as_object(), "topic");
+  if (topic && topic->is_string())
+    ev.key += '\0' + topic->as_string();
+  if (!sub->second.empty())
+  {
+    wamp_args args;
+    args.encoded = ev.tail;
+    args.decode();
+    if (msg.size() > 5)
+      args.args_dict = msg[5].as_object();
+    const json_value* field = json_get_ptr(args.args_dict, sub->second);
+    ev.key += '\0';
+    if (field)
+      ev.key += json_encode_any(*field);
+  }
+
+  auto existing = m_conflated_index.find(ev.key);
+  if (existing != m_conflated_index.end())
+  {
+    *existing->second = std::move(ev);
+  }
+  else
+  {
+    std::string key = ev.key;
+    m_conflated_events.push_back(std::move(ev));
+    m_conflated_index[std::move(key)] = std::prev(m_conflated_events.end());
+  }
+
+  if (!m_conflation_drain_scheduled)
+  {
+    m_conflation_drain_scheduled = true;
+    std::weak_ptr<wamp_session> wp = handle();
+    m_kernel->get_event_loop()->dispatch(
+      conflation_poll_interval, [wp]() -> std::chrono::milliseconds {
+        if (auto sp = wp.lock())
+          return sp->drain_conflated();
+        return std::chrono::milliseconds(0); /* cancel timer */
+      });
+  }
+
+  return true;
+}
+
+
+/* Send the held EVENTs once the socket backlog has cleared; otherwise return
+ * the interval after which to check again. */
+std::chrono::milliseconds wamp_session::drain_conflated()
+{
+  /* EV thread */
+
+  /* Sent with the lock held, so that a concurrent EVENT of a conflated
+   * subscription cannot overtake those held. */
+  std::lock_guard<std::mutex> guard(m_conflation_lock);
+
+  if (!m_conflated_events.empty() && !m_socket->is_closed() &&
+      m_socket->bytes_pending_write() >
+        m_kernel->get_config().socket_conflation_threshold_bytes)
+    return conflation_poll_interval;
+
+  std::list<conflated_event> events;
+  events.swap(m_conflated_events);
+  m_conflated_index.clear();
+  m_conflation_drain_scheduled = false;
+
+  try {
+    for (auto & ev : events)
+      send_msg(ev.msg, ev.tail.get());
+  } catch (...) { /* socket closing */ }
+
+  return std::chrono::milliseconds(0);
 }
 
 
@@ -978,7 +1202,7 @@ void wamp_session::handle_CHALLENGE(json_array& ja)
       std::string key = m_client_secret_fn();
 
       auto iter_salt = extra.find("salt");
-      if (iter_salt != end(extra)) {
+      if (iter_salt != extra.end()) {
         int keylen = (int) json_get_ref(extra, "keylen").as_int();
         int iterations = (int) json_get_ref(extra, "iterations").as_int();
         const std::string& salt = iter_salt->second.as_string();
@@ -1643,7 +1867,8 @@ void wamp_session::process_inbound_published(json_array & msg)
 }
 
 
-void wamp_session::process_inbound_event(json_array & msg)
+void wamp_session::process_inbound_event(json_array & msg,
+                                         std::shared_ptr<const encoded_args> encoded)
 {
   /* EV thread */
 
@@ -1652,8 +1877,12 @@ void wamp_session::process_inbound_event(json_array & msg)
   json_value * ptr_args_list = json_get_ptr(msg, 4); // optional
   json_value * ptr_args_dict = json_get_ptr(msg, 5); // optional
 
-  const json_array  & args_list = ptr_args_list? ptr_args_list->as_array()  : json_array();
-  const json_object & args_dict = ptr_args_dict? ptr_args_dict->as_object() : json_object();
+  wamp_args args;
+  if (ptr_args_list)
+    args.args_list = std::move(ptr_args_list->as_array());
+  if (ptr_args_dict)
+    args.args_dict = std::move(ptr_args_dict->as_object());
+  args.encoded = std::move(encoded);
 
   // find the subscription & invoke user callback
   auto iter = m_subscriptions.find(subscription_id);
@@ -1664,7 +1893,7 @@ void wamp_session::process_inbound_event(json_array & msg)
       {
         event_info info { subscription_id,
             std::move( details ),
-            { args_list, args_dict },
+            std::move( args ),
             iter->second.user
               };
         iter->second.event_cb(*this, std::move(info));
@@ -2070,7 +2299,56 @@ t_request_id wamp_session::publish(const std::string& uri,
 }
 
 
-void wamp_session::process_inbound_call(json_array & msg)
+std::vector<t_request_id> wamp_session::publish_batch(std::vector<publish_item> items,
+                                                      on_published_fn req_cb,
+                                                      void * user)
+{
+  /* USER thread */
+
+  std::vector<json_array> msgs;
+  msgs.reserve(items.size());
+  for (auto & item : items)
+    msgs.push_back({msg_type::wamp_msg_publish, 0, std::move(item.options),
+                    std::move(item.uri), std::move(item.args.args_list),
+                    std::move(item.args.args_dict)});
+
+  std::vector<t_request_id> request_ids;
+  request_ids.reserve(msgs.size());
+  {
+    std::lock_guard<std::mutex> guard(m_request_lock);
+
+    std::list<prepared_message> prepared;
+    std::vector<prepared_message*> ptrs;
+    ptrs.reserve(msgs.size());
+
+    for (auto & msg : msgs)
+    {
+      t_request_id request_id = m_next_request_id++;
+      msg[1] = request_id;
+      request_ids.push_back(request_id);
+
+      prepared.emplace_back(msg);
+      ptrs.push_back(&prepared.back());
+    }
+
+    if (req_cb)
+    {
+      std::lock_guard<std::mutex> guard(m_pending_lock);
+      for (auto request_id : request_ids)
+        m_pending_publish[request_id] = publish_request{req_cb, user};
+    }
+    send_msg(ptrs);
+  }
+
+  LOG_INFO(m_log_prefix << "sending publish batch of " << request_ids.size()
+           << " items");
+
+  return request_ids;
+}
+
+
+void wamp_session::process_inbound_call(json_array & msg,
+                                        std::shared_ptr<const encoded_args> encoded)
 {
   /* EV thread */
 
@@ -2085,10 +2363,11 @@ void wamp_session::process_inbound_call(json_array & msg)
   std::string procedure_uri = std::move(msg[3].as_string());
 
   wamp_args my_wamp_args;
+  my_wamp_args.encoded = std::move(encoded);
   if ( msg.size() > 4 )
-    my_wamp_args.args_list = msg[4].as_array();
+    my_wamp_args.args_list = std::move(msg[4].as_array());
   if ( msg.size() > 5 )
-    my_wamp_args.args_dict = msg[5].as_object();
+    my_wamp_args.args_dict = std::move(msg[5].as_object());
 
   session_handle wp = this->handle();
   auto reply_fn = [wp, request_id](wamp_args args,
@@ -2139,8 +2418,16 @@ t_request_id wamp_session::invocation(t_registration_id registration_id,
 {
   /* EV & USER thread */
 
-  json_array msg {msg_type::wamp_msg_invocation, 0, registration_id, options,
-      args.args_list, args.args_dict};
+  json_array msg;
+  msg.reserve(6);
+  msg.push_back(msg_type::wamp_msg_invocation);
+  msg.push_back(0);
+  msg.push_back(registration_id);
+  msg.push_back(options);
+  if (!args.encoded) {
+    msg.push_back(std::move(args.args_list));
+    msg.push_back(std::move(args.args_dict));
+  }
 
   t_request_id request_id;
   invocation_request request {std::move(fn), user};
@@ -2156,14 +2443,15 @@ t_request_id wamp_session::invocation(t_registration_id registration_id,
       m_pending_invocation[request_id] = std::move(request);
     }
 
-    send_msg( msg );
+    send_msg( msg, args.encoded.get() );
   }
 
   return  request_id;
 }
 
 
-void wamp_session::process_inbound_yield(json_array & msg)
+void wamp_session::process_inbound_yield(json_array & msg,
+                                         std::shared_ptr<const encoded_args> encoded)
 {
   /* EV thread */
 
@@ -2193,6 +2481,7 @@ void wamp_session::process_inbound_yield(json_array & msg)
   // invoke user callback if permitted, and handle exception
   if (orig_request.yield_cb && user_cb_allowed()) {
     wamp_args args;
+    args.encoded = std::move(encoded);
     if ( msg.size() > 3 )
       args.args_list = std::move(msg[3].as_array());
     if ( msg.size() > 4 )
@@ -2209,7 +2498,8 @@ void wamp_session::process_inbound_yield(json_array & msg)
 }
 
 
-void wamp_session::process_inbound_publish(json_array & msg)
+void wamp_session::process_inbound_publish(json_array & msg,
+                                           std::shared_ptr<const encoded_args> encoded)
 {
   /* EV thread */
 
@@ -2223,11 +2513,15 @@ void wamp_session::process_inbound_publish(json_array & msg)
   if (!msg[3].is_string()) throw protocol_error("topic uri must be string");
 
   wamp_args args;
+  args.encoded = std::move(encoded);
   if ( msg.size() > 4 )
     args.args_list = std::move(msg[4].as_array());
   if ( msg.size() > 5 )
     args.args_dict = std::move(msg[5].as_object());
 
+  /* the router may copy the args for each subscriber or retained event */
+  args.freeze();
+
   try
   {
     m_server_handler.on_publish(*this, request_id, msg[3].as_string(), msg[2].as_object(), args);
@@ -2615,6 +2909,15 @@ void wamp_session::result(t_request_id id, json_object dt, json_array ja, json_o
   send_msg({msg_type::wamp_msg_result, id, std::move(dt), std::move(ja), std::move(jo)});
 }
 
+void wamp_session::result_args(t_request_id id, json_object dt, wamp_args args)
+{
+  if (args.encoded)
+    send_msg({msg_type::wamp_msg_result, id, std::move(dt)}, args.encoded.get());
+  else
+    send_msg({msg_type::wamp_msg_result, id, std::move(dt),
+              std::move(args.args_list), std::move(args.args_dict)});
+}
+
 void wamp_session::call_error(t_request_id id, std::string uri)
 {
   send_msg({msg_type::wamp_msg_error, msg_type::wamp_msg_call, id, json_value::make_object(), std::move(uri)});
@@ -2788,6 +3091,12 @@ void wamp_session::publish_error(t_request_id id, std::string uri, json_object d
 
 void wamp_session::event(t_subscription_id sub_id, t_publication_id pub_id, json_object details, wamp_args args)
 {
+  if (args.encoded) {
+    send_msg({msg_type::wamp_msg_event, sub_id, pub_id, std::move(details)},
+             args.encoded.get());
+    return;
+  }
+
   json_array msg {msg_type::wamp_msg_event, sub_id, pub_id,
       std::move(details),
       std::move(args.args_list),
@@ -13,6 +13,7 @@
 #include "wampcc/http_parser.h"
 #include "wampcc/log_macros.h"
 #include "wampcc/websocketpp_impl.h"
+#include "wampcc/simd.h"
 
 #include "apache/base64.h" // from 3rdparty
 
@@ -29,6 +30,16 @@ static constexpr char html_body[] = HTML_BODY;
 static constexpr int html_body_len = sizeof(html_body) - 1;
 static_assert(html_body_len==HTML_BODY_LEN , "length check");
 
+/* Serialisers that can be negotiated as websocket subprotocols, in order of
+ * client preference. */
+static const wampcc::serialiser_type websocket_serialisers[] = {
+  wampcc::serialiser_type::json,
+  wampcc::serialiser_type::msgpack,
+  wampcc::serialiser_type::cbor,
+  wampcc::serialiser_type::json_batched,
+  wampcc::serialiser_type::msgpack_batched
+};
+
 static const std::string http_200_response =
   "HTTP/1.1 200 OK\r\n"
   "Connection: close\r\n"
@@ -62,8 +73,14 @@ websocket_protocol::websocket_protocol(kernel* k,
     m_options(std::move(opts)),
     m_websock_impl(new websocketpp_impl(mode)),
     m_last_pong(std::chrono::steady_clock::now()),
-    m_missed_pings(0)
+    m_missed_pings(0),
+    m_in_fragmented_msg(false),
+    m_mask_rng(std::random_device()())
 {
+  /* allow a complete frame of maximum size to be buffered, so that
+   * unfragmented data frames can be processed in place */
+  m_buf.update_max_size(websocket_config::max_message_size + MAX_FRAME_HEADER_SIZE);
+
   // register to receive heartbeat callbacks
   if (m_options.ping_interval.count() > 0)
     callbacks.request_timer(m_options.ping_interval);
@@ -105,41 +122,267 @@ static bool header_contains(const std::string & source,
 
 
 void websocket_protocol::send_msg(const json_array& ja)
+{
+  send_encoded(ja, nullptr);
+}
+
+
+void websocket_protocol::send_msg(const json_array& head,
+                                  const encoded_args& tail)
+{
+  send_encoded(head, &tail);
+}
+
+
+void websocket_protocol::send_encoded(const json_array& ja,
+                                      const encoded_args* tail)
 {
   if (!have_codec())
     return;
 
   LOG_TRACE("fd: " << fd() << ", json_tx: " << ja);
 
-  websocketpp::frame::opcode::value op{};
-  switch (m_codec->type())
+  if (m_codec->type() == serialiser_type::json_batched ||
+      m_codec->type() == serialiser_type::msgpack_batched) {
+    /* Hold the message back, so that it can share a frame with others sent in
+     * quick succession. The first message of a batch requests a flush. */
+    bool request_flush;
+    bool flush_now;
+    {
+      std::lock_guard<std::mutex> guard(m_batch_lock);
+      request_flush = m_batch.empty();
+      if (request_flush)
+        encode(ja, tail, m_batch, MAX_FRAME_HEADER_SIZE);
+      else if (tail)
+        m_codec->encode(ja, *tail, m_batch);
+      else
+        m_codec->encode(ja, m_batch);
+      flush_now = m_batch.size() >= MAX_BATCH_SIZE + MAX_FRAME_HEADER_SIZE;
+    }
+
+    if (flush_now || !m_callbacks.request_flush)
+      flush();
+    else if (request_flush)
+      m_callbacks.request_flush();
+  }
+  else {
+    std::lock_guard<std::mutex> guard(m_encode_lock);
+    encode(ja, tail, m_encode_buf, MAX_FRAME_HEADER_SIZE);
+    send_data_frame(m_encode_buf, MAX_FRAME_HEADER_SIZE);
+  }
+}
+
+
+void websocket_protocol::flush()
+{
+  /* hold the encode lock throughout, so that concurrent flushes cannot
+   * reorder batches */
+  std::lock_guard<std::mutex> guard(m_encode_lock);
   {
-    case serialiser_type::none: return;
-    case serialiser_type::json: op = websocketpp::frame::opcode::text; break;
-    case serialiser_type::msgpack: op = websocketpp::frame::opcode::binary; break;
+    std::lock_guard<std::mutex> guard(m_batch_lock);
+    m_encode_buf.swap(m_batch);
+    m_batch.clear();
   }
 
-  auto bytes = encode(ja);
+  if (!m_encode_buf.empty())
+    send_data_frame(m_encode_buf, MAX_FRAME_HEADER_SIZE);
+}
 
-  auto msg_ptr = m_websock_impl->msg_manager()->get_message(op,bytes.size());
-  msg_ptr->append_payload(bytes.data(), bytes.size());
-  auto out_msg_ptr = m_websock_impl->msg_manager()->get_message();
 
-  if (out_msg_ptr == nullptr)
-    throw std::runtime_error("failed to obtain msg object");
+/* Format the header of an unfragmented websocket frame into 'hdr', which must
+ * have space for MAX_FRAME_HEADER_SIZE bytes. Returns the header length. */
+static size_t format_frame_header(char* hdr, int opcode, uint64_t len,
+                                  const uint8_t* mask)
+{
+  const char mask_bit = mask ? (char) 0x80 : 0;
+  size_t n = 0;
+
+  hdr[n++] = (char)(0x80 | opcode); /* FIN */
+  if (len < 126)
+    hdr[n++] = mask_bit | (char) len;
+  else if (len <= 0xFFFF) {
+    hdr[n++] = mask_bit | 126;
+    hdr[n++] = (char)(len >> 8);
+    hdr[n++] = (char) len;
+  } else {
+    hdr[n++] = mask_bit | 127;
+    for (int i = 7; i >= 0; i--)
+      hdr[n++] = (char)(len >> (8 * i));
+  }
 
-  auto ec = m_websock_impl->processor()->prepare_data_frame(msg_ptr, out_msg_ptr);
-  if (ec)
-    throw std::runtime_error(ec.message());
+  if (mask) {
+    memcpy(hdr + n, mask, 4);
+    n += 4;
+  }
 
-  LOG_TRACE("fd: " << fd() << ", frame_tx: " <<
-            websocketpp_impl::frame_to_string(out_msg_ptr));
+  return n;
+}
+
+
+void websocket_protocol::send_data_frame(std::vector<char>& frame,
+                                         size_t headroom)
+{
+  /* Caller holds m_encode_lock */
+  char* payload = frame.data() + headroom;
+  const size_t len = frame.size() - headroom;
+
+  /* client to server frames must be masked */
+  uint8_t mask[4];
+  const bool masked = (mode() == connect_mode::active);
+  if (masked) {
+    uint32_t key = m_mask_rng();
+    memcpy(mask, &key, sizeof(mask));
+    simd_unmask(payload, len, mask);
+  }
+
+  char hdr[MAX_FRAME_HEADER_SIZE];
+  const size_t hdrlen = format_frame_header(hdr, to_opcode(m_codec->type()),
+                                            len, masked ? mask : nullptr);
+  memcpy(payload - hdrlen, hdr, hdrlen);
+
+  LOG_TRACE("fd: " << fd() << ", frame_tx: opcode=" << to_opcode(m_codec->type())
+            << ", len=" << len << ", mask=" << masked);
+
+  m_socket->write(payload - hdrlen, hdrlen + len);
+}
+
+
+/* Find, or make and store, the encoding of a prepared message for this
+ * session's serialisation in the given frame format. */
+const std::vector<char>& websocket_protocol::prepared_bytes(
+  prepared_message& pm, prepared_message::frame_format ff)
+{
+  const serialiser_type st = m_codec->type();
+  const std::vector<char>* bytes = pm.find(st, ff);
+
+  if (!bytes) {
+    LOG_TRACE("fd: " << fd() << ", json_tx: " << pm.message());
+
+    std::vector<char> encoded;
+    if (ff == prepared_message::frame_format::websocket) {
+      encode(pm.message(), pm.tail(), encoded, MAX_FRAME_HEADER_SIZE);
+      char hdr[MAX_FRAME_HEADER_SIZE];
+      const size_t len = encoded.size() - MAX_FRAME_HEADER_SIZE;
+      const size_t hdrlen = format_frame_header(hdr, to_opcode(st), len, nullptr);
+      encoded.erase(encoded.begin(),
+                    encoded.begin() + (MAX_FRAME_HEADER_SIZE - hdrlen));
+      memcpy(encoded.data(), hdr, hdrlen);
+    }
+    else
+      encode(pm.message(), pm.tail(), encoded, 0);
+    bytes = &pm.store(st, ff, std::move(encoded));
+  }
+
+  return *bytes;
+}
+
+
+/* Append already encoded messages to the batch of a batched serialiser,
+ * flushing whenever the batch becomes full. */
+void websocket_protocol::append_batch(const std::vector<char>** items,
+                                      size_t count)
+{
+  bool request_flush = false;
+  size_t i = 0;
+
+  while (i < count) {
+    bool flush_now = false;
+    {
+      std::lock_guard<std::mutex> guard(m_batch_lock);
+      if (m_batch.empty()) {
+        request_flush = true;
+        m_batch.resize(MAX_FRAME_HEADER_SIZE);
+      }
+      for (; i < count && !flush_now; i++) {
+        m_batch.insert(m_batch.end(), items[i]->begin(), items[i]->end());
+        flush_now = m_batch.size() >= MAX_BATCH_SIZE + MAX_FRAME_HEADER_SIZE;
+      }
+    }
+
+    if (flush_now || !m_callbacks.request_flush) {
+      flush();
+      request_flush = false;
+    }
+  }
+
+  if (request_flush)
+    m_callbacks.request_flush();
+}
+
+
+/* As send_encoded, but reusing the encoding of a message shared by many
+ * sessions.  Server sessions, whose frames are not masked, share the whole
+ * frame; batched sessions share the message as it is appended to a batch;
+ * client sessions share the payload, which is then copied for masking. */
+void websocket_protocol::send_msg(prepared_message& pm)
+{
+  if (!have_codec())
+    return;
+
+  typedef prepared_message::frame_format frame_format;
+  const serialiser_type st = m_codec->type();
+  const bool batched = (st == serialiser_type::json_batched ||
+                        st == serialiser_type::msgpack_batched);
+  const bool masked = (mode() == connect_mode::active);
+  const frame_format ff = (batched || masked) ? frame_format::none
+                                              : frame_format::websocket;
+
+  const std::vector<char>& bytes = prepared_bytes(pm, ff);
+
+  if (ff == frame_format::websocket) {
+    m_socket->write(bytes.data(), bytes.size());
+  }
+  else if (batched) {
+    const std::vector<char>* item = &bytes;
+    append_batch(&item, 1);
+  }
+  else {
+    std::lock_guard<std::mutex> guard(m_encode_lock);
+    m_encode_buf.resize(MAX_FRAME_HEADER_SIZE);
+    m_encode_buf.insert(m_encode_buf.end(), bytes.begin(), bytes.end());
+    send_data_frame(m_encode_buf, MAX_FRAME_HEADER_SIZE);
+  }
+}
+
+
+/* Send several prepared messages; unmasked frames are written together, and
+ * batched messages are appended to the batch together. */
+void websocket_protocol::send_msg(std::vector<prepared_message*>& msgs)
+{
+  if (!have_codec())
+    return;
+
+  typedef prepared_message::frame_format frame_format;
+  const serialiser_type st = m_codec->type();
+  const bool batched = (st == serialiser_type::json_batched ||
+                        st == serialiser_type::msgpack_batched);
+  const bool masked = (mode() == connect_mode::active);
+
+  if (masked && !batched) {
+    protocol::send_msg(msgs);
+    return;
+  }
+
+  const frame_format ff = batched ? frame_format::none : frame_format::websocket;
 
-  std::pair<const char*, size_t> bufs[2] = {
-    { out_msg_ptr->get_header().data(), out_msg_ptr->get_header().size() },
-    { out_msg_ptr->get_payload().data(), out_msg_ptr->get_payload().size()  } };
+  std::vector<const std::vector<char>*> items;
+  items.reserve(msgs.size());
+  for (auto pm : msgs)
+    items.push_back(&prepared_bytes(*pm, ff));
+
+  if (items.empty())
+    return;
 
-  m_socket->write(bufs, 2);
+  if (batched) {
+    append_batch(items.data(), items.size());
+  }
+  else {
+    std::vector<std::pair<const char*, size_t>> bufs;
+    bufs.reserve(items.size());
+    for (auto item : items)
+      bufs.push_back({item->data(), item->size()});
+    m_socket->write(bufs.data(), bufs.size());
+  }
 }
 
 
@@ -197,12 +440,13 @@ void websocket_protocol::io_on_read(char* src, size_t len)
               auto& websock_sub = header_field("sec-websocket-protocol");
 
               /* determine the protocols common to both client and server */
-              int common = m_options.serialisers &
-                ((has_token(websock_sub,WAMPV2_JSON_SUBPROTOCOL)?serialiser_type::json:serialiser_type::none) |
-                 (has_token(websock_sub,WAMPV2_MSGPACK_SUBPROTOCOL)?serialiser_type::msgpack:serialiser_type::none));
+              int offered = 0;
+              for (auto st : websocket_serialisers)
+                if (header_contains(websock_sub, to_header(st)))
+                  offered |= static_cast<int>(st);
 
               /* create the actual codec */
-              create_codec(common);
+              create_codec(m_options.serialisers & offered);
             }
             else
               create_codec(static_cast<int>(serialiser_type::json));
@@ -282,8 +526,9 @@ void websocket_protocol::io_on_read(char* src, size_t len)
         }
       }
       else {
-        /* for all other websocket states, use the websocketpp parser */
-        process_frame_bytes(rd);
+        /* for all other websocket states, process frames */
+        if (!process_frame_bytes(rd))
+          break; /* wait for more bytes */
       }
     }
 
@@ -332,13 +577,12 @@ void websocket_protocol::initiate(t_initiate_cb cb)
     "Sec-WebSocket-Key: " << sec_websocket_key  << "\r\n"
     "Sec-WebSocket-Protocol: ";
 
-  if (m_options.serialisers & serialiser_type::json)
-    oss << WAMPV2_JSON_SUBPROTOCOL;
-  if ((m_options.serialisers & serialiser_type::json) &&
-      (m_options.serialisers & serialiser_type::msgpack))
-    oss << ",";
-  if (m_options.serialisers & serialiser_type::msgpack)
-    oss << WAMPV2_MSGPACK_SUBPROTOCOL;
+  const char* delim = "";
+  for (auto st : websocket_serialisers)
+    if (m_options.serialisers & st) {
+      oss << delim << to_header(st);
+      delim = ",";
+    }
   oss << "\r\n";
 
   oss << "Sec-WebSocket-Version: " << RFC6455 << "\r\n";
@@ -358,6 +602,9 @@ void websocket_protocol::initiate(t_initiate_cb cb)
 
 void websocket_protocol::send_impl(const websocketpp_msg& msg)
 {
+  /* control frames must not overtake batched messages */
+  flush();
+
   LOG_TRACE("fd: " << fd() << ", frame_tx: " <<
             websocketpp_impl::frame_to_string(msg.ptr));
 
@@ -422,6 +669,12 @@ serialiser_type websocket_protocol::to_serialiser(const std::string& s)
     return serialiser_type::json;
   else if (s==WAMPV2_MSGPACK_SUBPROTOCOL)
     return serialiser_type::msgpack;
+  else if (s==WAMPV2_JSON_BATCHED_SUBPROTOCOL)
+    return serialiser_type::json_batched;
+  else if (s==WAMPV2_MSGPACK_BATCHED_SUBPROTOCOL)
+    return serialiser_type::msgpack_batched;
+  else if (s==WAMPV2_CBOR_SUBPROTOCOL)
+    return serialiser_type::cbor;
   else
     return serialiser_type::none;
 }
@@ -434,19 +687,127 @@ const char* websocket_protocol::to_header(serialiser_type p)
     case serialiser_type::none: return "";
     case serialiser_type::json: return WAMPV2_JSON_SUBPROTOCOL;
     case serialiser_type::msgpack: return WAMPV2_MSGPACK_SUBPROTOCOL;
+    case serialiser_type::json_batched: return WAMPV2_JSON_BATCHED_SUBPROTOCOL;
+    case serialiser_type::msgpack_batched: return WAMPV2_MSGPACK_BATCHED_SUBPROTOCOL;
+    case serialiser_type::cbor: return WAMPV2_CBOR_SUBPROTOCOL;
   }
   return "";
 }
 
 
-void websocket_protocol::process_frame_bytes(buffer::read_pointer& rd)
+int websocket_protocol::to_opcode(serialiser_type p)
 {
-  /* Feed bytes into the websocketpp stream parser. The parser will take only
-   * the bytes required to build the next websocket message; it won't slurp all
-   * the available bytes (i.e. its possible the consumed-count can be non-zero
-   * after the consume() operation). */
+  switch (p)
+  {
+    case serialiser_type::none: return websocketpp::frame::opcode::binary;
+    case serialiser_type::json: return websocketpp::frame::opcode::text;
+    case serialiser_type::msgpack: return websocketpp::frame::opcode::binary;
+    case serialiser_type::json_batched: return websocketpp::frame::opcode::text;
+    case serialiser_type::msgpack_batched: return websocketpp::frame::opcode::binary;
+    case serialiser_type::cbor: return websocketpp::frame::opcode::binary;
+  }
+  return websocketpp::frame::opcode::binary;
+}
+
+
+/* Attempt to process the websocket frame at the head of the read pointer.
+ * Returns false if more bytes are needed before the frame can be processed.
+ *
+ * Complete, unfragmented data frames -- by far the most common frame type --
+ * are unmasked and validated in place, directly in the inbound buffer, using
+ * vectorised routines. All other frames (control frames, fragments, and frames
+ * with unexpected header bits) are fed into the websocketpp stream parser. */
+bool websocket_protocol::process_frame_bytes(buffer::read_pointer& rd)
+{
+  const size_t avail = rd.avail();
+  if (avail < 2)
+    return false;
+
+  const uint8_t b0 = rd[0];
+  const uint8_t b1 = rd[1];
+  const bool fin = b0 & 0x80;
+  const bool rsv = b0 & 0x70;
+  const int opcode = b0 & 0x0F;
+  const bool masked = b1 & 0x80;
+  const bool mask_expected = (mode() == connect_mode::passive);
+
+  /* for a malformed header, let websocketpp diagnose the error */
+  auto reject_frame = [&]() {
+    websocketpp::lib::error_code ec;
+    m_websock_impl->processor()->consume((uint8_t*) rd.ptr(), rd.avail(), ec);
+    throw std::runtime_error(
+      ec ? ec.message() : std::string("websocket parser fatal error"));
+  };
+
+  if (rsv || (masked != mask_expected))
+    reject_frame();
+
+  size_t header_len = 2 + (masked ? 4 : 0);
+  uint64_t payload_len = b1 & 0x7F;
+  if (payload_len == 126)
+    header_len += 2;
+  else if (payload_len == 127)
+    header_len += 8;
+
+  if (avail < header_len)
+    return false;
+
+  if (payload_len == 126) {
+    payload_len = (uint64_t(uint8_t(rd[2])) << 8) | uint8_t(rd[3]);
+    if (payload_len < 126)
+      reject_frame();
+  }
+  else if (payload_len == 127) {
+    payload_len = 0;
+    for (int i = 2; i < 10; i++)
+      payload_len = (payload_len << 8) | uint8_t(rd[i]);
+    if (payload_len <= 0xFFFF)
+      reject_frame();
+  }
+
+  if (payload_len > websocket_config::max_message_size)
+    throw std::runtime_error("websocket frame exceeds maximum message size");
+
+  if (avail - header_len < payload_len)
+    return false;
+
+  const size_t frame_len = header_len + payload_len;
+
+  // treat arrival of any data as reseting the missed pings counter
+  m_missed_pings.store(0);
+
+  if (fin && !m_in_fragmented_msg &&
+      (opcode == websocketpp::frame::opcode::text ||
+       opcode == websocketpp::frame::opcode::binary)) {
+    char* payload = rd.ptr() + header_len;
+    if (masked) {
+      uint8_t key[4];
+      memcpy(key, payload - 4, sizeof(key));
+      simd_unmask(payload, payload_len, key);
+    }
+    rd.advance(frame_len);
+
+    LOG_TRACE("fd: " << fd() << ", frame_rx: fin 1, opcode " << opcode <<
+              ", payload_len " << payload_len);
+
+    if (m_state == state::closed)
+      return true; // ingore bytes after protocol closed
+
+    if (opcode == websocketpp::frame::opcode::text &&
+        !simd_is_valid_utf8(payload, payload_len))
+      throw std::runtime_error("invalid UTF-8 in websocket text frame");
+
+    decode(payload, payload_len);
+    return true;
+  }
+
+  if (!websocketpp::frame::opcode::is_control(
+        websocketpp::frame::opcode::value(opcode)))
+    m_in_fragmented_msg = !fin;
+
+  /* Feed the complete frame into the websocketpp stream parser. */
   websocketpp::lib::error_code ec;
-  size_t consumed = m_websock_impl->processor()->consume((uint8_t*) rd.ptr(), rd.avail(), ec);
+  size_t consumed = m_websock_impl->processor()->consume((uint8_t*) rd.ptr(), frame_len, ec);
   rd.advance(consumed);
 
   if (ec)
@@ -455,9 +816,6 @@ void websocket_protocol::process_frame_bytes(buffer::read_pointer& rd)
   if (m_websock_impl->processor()->get_error())
     throw std::runtime_error("websocket parser fatal error");
 
-  // treat arrival of any data as reseting the missed pings counter
-  m_missed_pings.store(0);
-
   if (m_websock_impl->processor()->ready())
   {
     // shared_ptr<message_buffer::message<...> >
@@ -470,10 +828,10 @@ void websocket_protocol::process_frame_bytes(buffer::read_pointer& rd)
               websocketpp_impl::frame_to_string(msg));
 
     if (m_state == state::closed)
-      return; // ingore bytes after protocol closed
+      return true; // ingore bytes after protocol closed
 
     if (!is_control(msg->get_opcode())) {
-      // data message, dispatch to user
+      // reassembled data message, dispatch to user
       if ((msg->get_opcode() == websocketpp::frame::opcode::binary) ||
           (msg->get_opcode() == websocketpp::frame::opcode::text)) {
         decode(msg->get_payload().data(), msg->get_payload().size());
@@ -488,7 +846,6 @@ void websocket_protocol::process_frame_bytes(buffer::read_pointer& rd)
             (now-m_last_pong >= m_options.pong_min_interval)) {
           m_last_pong = now;
           send_pong(msg->get_payload());
-          return;
         }
       } else if (op == websocketpp::frame::opcode::PONG) {
         // no-op
@@ -507,6 +864,8 @@ void websocket_protocol::process_frame_bytes(buffer::read_pointer& rd)
       }
     }
   }
+
+  return true;
 }
 
 
@@ -2,6 +2,11 @@
 #include <iostream>
 #include <stdexcept>
 #include <list>
+#include <limits>
+#include <vector>
+
+#include <locale.h>
+#include <string.h>
 
 
 #include "mini_test.h"
@@ -447,6 +452,627 @@ TEST_CASE( "compare_unint_and_int" )
   REQUIRE(wampcc::json_value::make_uint(1) == wampcc::json_value::make_int(1));
 }
 
+//----------------------------------------------------------------------
+TEST_CASE( "decode_integer_limits" )
+{
+  const char* src = "[9223372036854775807, -9223372036854775808,"
+    " 18446744073709551615, 9223372036854775808, 18446744073709551616]";
+  wampcc::json_array msg = wampcc::json_decode(src).as_array();
+
+  REQUIRE( msg[0].is_int() );
+  REQUIRE( msg[0].as_int() == (std::numeric_limits<long long>::max)() );
+  REQUIRE( msg[1].as_int() == (std::numeric_limits<long long>::min)() );
+  REQUIRE( msg[2].is_uint() );
+  REQUIRE( msg[2].as_uint() == (std::numeric_limits<unsigned long long>::max)() );
+  REQUIRE( msg[3].as_uint() == 9223372036854775808ULL );
+  REQUIRE( msg[4].is_real() );
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "decode_reals" )
+{
+  const char* src = "[1.5, -0.25, 1e3, 2.5E-3, 0.1, 123456789.123456789, 1e-320]";
+  wampcc::json_array msg = wampcc::json_decode(src).as_array();
+
+  REQUIRE( msg[0].as_real() == 1.5 );
+  REQUIRE( msg[1].as_real() == -0.25 );
+  REQUIRE( msg[2].as_real() == 1000.0 );
+  REQUIRE( msg[3].as_real() == 2.5e-3 );
+  REQUIRE( msg[4].as_real() == 0.1 );
+  REQUIRE( msg[5].as_real() == 123456789.123456789 );
+  REQUIRE( msg[6].as_real() == 1e-320 );
+}
+
+/* Select an LC_NUMERIC locale with a comma decimal point, restoring the
+ * original locale on destruction. */
+struct comma_locale
+{
+  comma_locale()
+    : original(setlocale(LC_NUMERIC, nullptr)),
+      name(nullptr)
+  {
+    for (const char* candidate : {"de_DE.UTF-8", "de_DE.utf8", "de_DE",
+                                  "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR"})
+      if (setlocale(LC_NUMERIC, candidate) &&
+          strcmp(localeconv()->decimal_point, ",") == 0) {
+        name = candidate;
+        break;
+      }
+    if (!name)
+      std::cout << "no comma decimal point locale installed, "
+                << "testing in the C locale only" << std::endl;
+  }
+
+  ~comma_locale() { setlocale(LC_NUMERIC, original.c_str()); }
+
+  std::string original;
+  const char* name;
+};
+
+//----------------------------------------------------------------------
+TEST_CASE( "decode_reals_in_locale" )
+{
+  /* the slow path, with too many digits for an exact conversion */
+  const char* src = "[0.12345678901234567890, 1.5e-300, 1.5]";
+  wampcc::json_array expected = wampcc::json_decode(src).as_array();
+
+  comma_locale locale;
+  wampcc::json_array msg = wampcc::json_decode(src).as_array();
+
+  REQUIRE( msg == expected );
+  REQUIRE( msg[0].as_real() > 0.123 );
+  REQUIRE( msg[1].as_real() > 1e-300 );
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "decode_strings" )
+{
+  const char* src = "[\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\", \"\\u00e9\\u20AC\","
+    " \"\\ud83d\\ude00\", \"\xc3\xa9\", \"\\u0000x\"]";
+  wampcc::json_array msg = wampcc::json_decode(src).as_array();
+
+  REQUIRE( msg[0].as_string() == "a\"b\\c/d\b\f\n\r\t" );
+  REQUIRE( msg[1].as_string() == "\xc3\xa9\xe2\x82\xac" );
+  REQUIRE( msg[2].as_string() == "\xf0\x9f\x98\x80" );
+  REQUIRE( msg[3].as_string() == "\xc3\xa9" );
+  REQUIRE( msg[4].as_string() == std::string("\0x", 2) );
+
+  /* long strings exercise the vectorised scan */
+  std::string text(1000, 'x');
+  text[500] = '"';
+  std::string json = "[\"" + text.substr(0, 500) + "\\\"" + text.substr(501) + "\"]";
+  REQUIRE( wampcc::json_decode(json.c_str()).as_array()[0].as_string() == text );
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "decode_buffer_not_null_terminated" )
+{
+  const char src[] = {'[', '1', ',', '2', ']', '9'};
+  wampcc::json_value jv = wampcc::json_decode(src, 5);
+  REQUIRE( jv == wampcc::json_array({1, 2}) );
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "decode_errors" )
+{
+  std::vector<std::string> bad {
+    "",
+    "1",
+    "\"x\"",
+    "[1,]",
+    "[01]",
+    "[1.]",
+    "[-]",
+    "[1e]",
+    "{\"a\" 1}",
+    "{\"a\":1,}",
+    "{1:1}",
+    "[1] x",
+    "[tru]",
+    "[\"abc]",
+    "[\"\x01\"]",
+    "[\"\xc3\"]",
+    "[\"\xed\xa0\x80\"]",
+    "[\"\\ud800\"]",
+    "[\"\\udc00\"]",
+    "[\"\\x\"]",
+    "[1e400]",
+    std::string(5000, '[')
+  };
+
+  for (auto & item : bad) {
+    bool caught = false;
+    try {
+      wampcc::json_decode(item.c_str(), item.size());
+    } catch (wampcc::parse_error&) {
+      caught = true;
+    }
+    REQUIRE(caught);
+  }
+
+  try {
+    wampcc::json_decode("[1,\n  2,, 3]");
+    REQUIRE(false);
+  } catch (wampcc::parse_error& e) {
+    REQUIRE( e.line == 2 );
+    REQUIRE( e.column == 4 );
+    REQUIRE( e.position == 8 );
+  }
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "encode_numbers" )
+{
+  wampcc::json_array msg {
+    wampcc::json_value::make_int(0),
+    wampcc::json_value::make_int(-1),
+    wampcc::json_value::make_int((std::numeric_limits<long long>::min)()),
+    wampcc::json_value::make_uint((std::numeric_limits<unsigned long long>::max)()),
+    wampcc::json_value::make_double(0.1),
+    wampcc::json_value::make_double(1.0),
+    wampcc::json_value::make_double(-2.5e-8),
+    wampcc::json_value::make_double(1.0/3.0)
+  };
+
+  std::string enc = wampcc::json_encode(msg);
+  REQUIRE(enc == "[0, -1, -9223372036854775808, 18446744073709551615, 0.1, 1.0, "
+                 "-2.5e-08, 0.3333333333333333]");
+
+  /* every double must survive a round trip */
+  wampcc::json_array doubles;
+  double d = 1.0;
+  for (int i = 0; i < 1000; i++) {
+    doubles.push_back(d);
+    doubles.push_back(1.0 / d);
+    d *= 1.3;
+  }
+  REQUIRE(wampcc::json_decode(wampcc::json_encode(doubles).c_str()) == doubles);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "encode_strings" )
+{
+  wampcc::json_array msg { "a\"b\\c/d\b\f\n\r\t\x01\x1f", "\xc3\xa9",
+      std::string("\0x", 2) };
+
+  std::string enc = wampcc::json_encode(msg);
+  REQUIRE(enc == "[\"a\\\"b\\\\c/d\\b\\f\\n\\r\\t\\u0001\\u001f\", \"\xc3\xa9\", \"\\u0000x\"]");
+  REQUIRE(wampcc::json_decode(enc.c_str()) == msg);
+
+  std::string text(1000, 'x');
+  text[700] = '\n';
+  std::string expect = "[\"" + text.substr(0, 700) + "\\n" + text.substr(701) + "\"]";
+  REQUIRE(wampcc::json_encode(wampcc::json_array{text}) == expect);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "encode_numbers_in_locale" )
+{
+  wampcc::json_array msg { 1.5, 0.1, -2.5e-8, 1.0, 1.0/3.0 };
+  std::string expected = wampcc::json_encode(msg);
+
+  comma_locale locale;
+  std::string enc = wampcc::json_encode(msg);
+
+  REQUIRE(enc == expected);
+  REQUIRE(enc == "[1.5, 0.1, -2.5e-08, 1.0, 0.3333333333333333]");
+  REQUIRE(wampcc::json_decode(enc.c_str()) == msg);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "encode_invalid_utf8" )
+{
+  /* a truncated sequence, an overlong encoding and a surrogate */
+  for (const char* s : {"abc\xc3", "\xc0\xaf", "x\xed\xa0\x80y"}) {
+    bool threw = false;
+    try {
+      wampcc::json_encode(wampcc::json_array{std::string(s)});
+    } catch (wampcc::json_error&) {
+      threw = true;
+    }
+    REQUIRE(threw);
+  }
+
+  /* as an object key, and past the first 16 bytes */
+  bool threw = false;
+  try {
+    wampcc::json_encode(wampcc::json_object{{std::string(20, 'k') + "\xff", 1}});
+  } catch (wampcc::json_error&) {
+    threw = true;
+  }
+  REQUIRE(threw);
+
+  /* valid multibyte sequences, of each length, pass through */
+  std::string valid = std::string(20, 'a') + "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+  REQUIRE(wampcc::json_encode(wampcc::json_array{valid}) == "[\"" + valid + "\"]");
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "encode_compact" )
+{
+  wampcc::json_array msg {1, wampcc::json_object{{"a", 1}, {"b", "c"}}};
+  std::vector<char> dest;
+  wampcc::json_encode(msg, dest, true);
+  REQUIRE(std::string(dest.data(), dest.size()) == "[1,{\"a\":1,\"b\":\"c\"}]");
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "json_object_flat" )
+{
+  wampcc::json_object obj {{"c", 3}, {"a", 1}, {"b", 2}, {"a", 99}};
+
+  /* sorted by key, first duplicate wins, as with std::map */
+  REQUIRE(obj.size() == 3);
+  std::string keys;
+  for (auto& item : obj)
+    keys += item.first;
+  REQUIRE(keys == "abc");
+  REQUIRE(obj["a"] == 1);
+
+  REQUIRE(obj.find("b") != obj.end());
+  REQUIRE(obj.find("x") == obj.end());
+  REQUIRE(obj.count("c") == 1);
+
+  auto r = obj.insert({"b", 20});
+  REQUIRE(r.second == false);
+  REQUIRE(r.first->second == 2);
+
+  obj["aa"] = "x";
+  REQUIRE(std::next(obj.begin())->first == "aa");
+
+  REQUIRE(obj.erase("a") == 1);
+  REQUIRE(obj.erase("a") == 0);
+  REQUIRE(obj.begin()->first == "aa");
+
+  bool thrown = false;
+  try {
+    obj.at("a");
+  } catch (std::out_of_range&) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+
+  wampcc::json_object other {{"aa", "x"}, {"b", 2}, {"c", 3}};
+  REQUIRE(obj == other);
+  REQUIRE(wampcc::json_value(obj) == wampcc::json_value(other));
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "arena_decode" )
+{
+  const char* text =
+    "[1, {\"a\": [\"x\", \"a rather longer string value\"], \"b\": {}}, \"s\"]";
+
+  wampcc::json_value expected = wampcc::json_decode(text, strlen(text));
+  wampcc::json_value retained;
+  wampcc::json_value copied;
+
+  {
+    /* a tiny block size forces nodes to span several blocks */
+    wampcc::json_arena arena(64);
+    wampcc::json_value jv = wampcc::json_decode(text, strlen(text), arena);
+    REQUIRE(jv == expected);
+
+    copied = jv;
+    retained = std::move(jv.as_array()[1]);
+    jv.as_array()[1] = "replaced";
+  }
+
+  /* nodes outlive the arena which created them */
+  REQUIRE(retained == expected.as_array()[1]);
+  REQUIRE(copied == expected);
+  retained.as_object()["c"] = 3;
+  REQUIRE(retained.as_object().size() == 3);
+
+  wampcc::json_arena arena;
+  std::vector<char> mp;
+  wampcc::json_msgpack_encode(expected, mp);
+  REQUIRE(wampcc::json_msgpack_decode(mp.data(), mp.size(), arena) == expected);
+
+  std::vector<char> cb = wampcc::json_cbor_encode(expected);
+  REQUIRE(wampcc::json_cbor_decode(cb.data(), cb.size(), arena) == expected);
+}
+
+//----------------------------------------------------------------------
+TEST_CASE( "frozen_values" )
+{
+  wampcc::json_value jv = wampcc::json_decode(
+    "{\"list\": [1, 2, {\"k\": \"v\"}], \"s\": \"a long string, beyond any small string buffer\"}");
+  wampcc::json_value expected = jv;
+
+  jv.freeze();
+  REQUIRE(jv.is_frozen());
+  REQUIRE(jv == expected);
+
+  /* copies share storage */
+  const wampcc::json_value copy = jv;
+  REQUIRE(copy.is_frozen());
+  REQUIRE(&copy.as_object() == &static_cast<const wampcc::json_value&>(jv).as_object());
+  REQUIRE(copy.as_object().at("list").is_frozen());
+
+  /* mutable access detaches, leaving other copies unchanged */
+  jv["list"][2]["k"] = "changed";
+  REQUIRE(!jv.is_frozen());
+  REQUIRE(!jv["list"].is_frozen());
+  REQUIRE(copy == expected);
+  REQUIRE(jv["list"][2]["k"] == "changed");
+
+  /* patching a copy of a frozen value */
+  wampcc::json_value patched = copy;
+  wampcc::json_value patch = wampcc::json_decode(
+    "[{\"op\": \"add\", \"path\": \"/list/2/x\", \"value\": 1}]");
+  REQUIRE(patched.patch(patch.as_array()));
+  REQUIRE(copy == expected);
+  REQUIRE(patched["list"][2]["x"] == 1);
+
+  /* sole owner */
+  wampcc::json_value single = wampcc::json_value::make_string("abc");
+  single.freeze();
+  single.as_string() += "d";
+  REQUIRE(single == "abcd");
+}
+
+//----------------------------------------------------------------------
+
+static size_t decode_three(const wampcc::json_value& first)
+{
+  return first == 48 ? 3 : 100;
+}
+
+TEST_CASE( "decode_prefix" )
+{
+  wampcc::json_value msg = wampcc::json_decode(
+    "[48, 7, {\"a\":1}, [1, \"x\", [2]], {\"k\": {\"n\": null}}]");
+
+  for (int format = 0; format < 3; format++)
+  {
+    std::vector<char> bytes;
+    if (format == 0)
+      wampcc::json_encode(msg, bytes);
+    else if (format == 1)
+      wampcc::json_msgpack_encode(msg, bytes);
+    else
+      wampcc::json_cbor_encode(msg, bytes);
+
+    auto decode_prefix = [format](const char* p, size_t n,
+                                  wampcc::json_prefix_fn fn,
+                                  wampcc::json_encoded_items& rest) {
+      if (format == 0)
+        return wampcc::json_decode_prefix(p, n, fn, rest);
+      else if (format == 1)
+        return wampcc::json_msgpack_decode_prefix(p, n, fn, rest);
+      else
+        return wampcc::json_cbor_decode_prefix(p, n, fn, rest);
+    };
+
+    wampcc::json_encoded_items rest;
+    wampcc::json_value head = decode_prefix(bytes.data(), bytes.size(),
+                                            decode_three, rest);
+
+    REQUIRE(head.as_array().size() == 3);
+    REQUIRE(head.as_array()[2] == msg.as_array()[2]);
+    REQUIRE(rest.count() == 2);
+    REQUIRE(rest.types[0] == wampcc::eARRAY);
+    REQUIRE(rest.types[1] == wampcc::eOBJECT);
+    REQUIRE(rest.ptr + rest.len == bytes.data() + bytes.size() - (format == 0));
+
+    /* the remaining items, once decoded, match the original */
+    if (format == 0) {
+      std::string tail = "[" + std::string(rest.ptr, rest.len) + "]";
+      wampcc::json_value items = wampcc::json_decode(tail.c_str());
+      REQUIRE(items.as_array()[0] == msg.as_array()[3]);
+      REQUIRE(items.as_array()[1] == msg.as_array()[4]);
+    }
+
+    /* all items are decoded when requested */
+    wampcc::json_encoded_items none;
+    wampcc::json_value all = decode_prefix(bytes.data(), bytes.size(),
+                                           [](const wampcc::json_value&) {
+                                             return (size_t) 100;
+                                           }, none);
+    REQUIRE(all == msg);
+    REQUIRE(none.count() == 0);
+
+    /* undecoded items are still validated */
+    bytes.pop_back();
+    bool threw = false;
+    try {
+      decode_prefix(bytes.data(), bytes.size(), decode_three, rest);
+    }
+    catch (const wampcc::json_error&) {
+      threw = true;
+    }
+    REQUIRE(threw);
+  }
+}
+
+//----------------------------------------------------------------------
+
+TEST_CASE( "binary_values" )
+{
+  const unsigned char raw[] = {0x00, 0xff, 0x10, 'a', 0x80};
+
+  for (size_t n = 0; n <= sizeof(raw); n++)
+  {
+    wampcc::json_value bin = wampcc::json_value::make_binary(raw, n);
+    REQUIRE(bin.is_binary());
+    REQUIRE(bin.as_binary().size() == n);
+
+    wampcc::json_array msg {1, bin, "text"};
+    wampcc::json_value copy = msg;
+    copy.freeze();
+    REQUIRE(copy == msg);
+
+    /* JSON carries binary as a NUL prefixed base64 string */
+    std::string text = wampcc::json_encode(msg);
+    REQUIRE(text.find("\\u0000") != std::string::npos);
+    REQUIRE(wampcc::json_decode(text.c_str()) == msg);
+
+    std::vector<char> bytes;
+    wampcc::json_msgpack_encode(msg, bytes);
+    REQUIRE(wampcc::json_msgpack_decode(bytes.data(), bytes.size()) == msg);
+
+    bytes = wampcc::json_cbor_encode(msg);
+    REQUIRE(wampcc::json_cbor_decode(bytes.data(), bytes.size()) == msg);
+
+    wampcc::json_arena arena;
+    REQUIRE(wampcc::json_decode(text.c_str(), text.size(), arena) == msg);
+  }
+
+  REQUIRE(wampcc::json_encode(wampcc::json_array{
+        wampcc::json_value::make_binary("abcd", 4)}) == "[\"\\u0000YWJjZA==\"]");
+
+  /* a NUL prefixed string which is not base64 remains a string */
+  wampcc::json_value jv = wampcc::json_decode("[\"\\u0000not base64\"]");
+  REQUIRE(jv[0].is_string());
+  REQUIRE(jv[0].as_string() == std::string("\0not base64", 11));
+}
+
+//----------------------------------------------------------------------
+
+/* Rebuilds a json_value from decode events */
+struct build_handler : wampcc::json_event_handler
+{
+  wampcc::json_value root;
+  std::vector<wampcc::json_value*> stack;
+  std::string pending_key;
+
+  bool add(wampcc::json_value v)
+  {
+    wampcc::json_value* dest = &root;
+    if (stack.empty())
+      root = std::move(v);
+    else if (stack.back()->is_array()) {
+      stack.back()->as_array().push_back(std::move(v));
+      dest = &stack.back()->as_array().back();
+    }
+    else
+      dest = &(stack.back()->as_object()[pending_key] = std::move(v));
+    if (dest->is_array() || dest->is_object())
+      stack.push_back(dest);
+    return true;
+  }
+
+  bool null_value() override { return add(wampcc::json_value::make_null()); }
+  bool bool_value(bool b) override { return add(wampcc::json_value::make_bool(b)); }
+  bool int_value(wampcc::json_int_t v) override { return add(wampcc::json_value::make_int(v)); }
+  bool uint_value(wampcc::json_uint_t v) override { return add(wampcc::json_value::make_uint(v)); }
+  bool real_value(double d) override { return add(wampcc::json_value::make_double(d)); }
+  bool string_value(const char* p, size_t n) override
+  {
+    return add(wampcc::json_value::make_string(p, n));
+  }
+  bool binary_value(const unsigned char* p, size_t n) override
+  {
+    return add(wampcc::json_value::make_binary(p, n));
+  }
+  bool key(const char* p, size_t n) override
+  {
+    pending_key.assign(p, n);
+    return true;
+  }
+  bool start_object() override { return add(wampcc::json_value::make_object()); }
+  bool start_array() override { return add(wampcc::json_value::make_array()); }
+  bool end_object() override { stack.pop_back(); return true; }
+  bool end_array() override { stack.pop_back(); return true; }
+};
+
+/* Stops at the first key with a given name, having read its value */
+struct find_handler : wampcc::json_event_handler
+{
+  std::string wanted;
+  bool found = false;
+  bool next_is_wanted = false;
+  int events = 0;
+  double value = 0;
+
+  bool key(const char* p, size_t n) override
+  {
+    events++;
+    next_is_wanted = (wanted == std::string(p, n));
+    return true;
+  }
+  bool real_value(double d) override
+  {
+    events++;
+    if (next_is_wanted) {
+      value = d;
+      found = true;
+      return false;
+    }
+    return true;
+  }
+};
+
+TEST_CASE( "decode_events" )
+{
+  wampcc::json_value src = wampcc::json_array{
+    wampcc::json_value::make_null(), true, false, -5, 7, 2.5, "text", "",
+    wampcc::json_value::make_binary("\x01\x02", 2),
+    wampcc::json_array{}, wampcc::json_object{},
+    wampcc::json_object{{"a", wampcc::json_array{1, wampcc::json_object{{"b", "c"}}}},
+                        {"esc\"aped", "\u00e9\n"}}
+  };
+
+  {
+    build_handler h;
+    std::string text = wampcc::json_encode(src);
+    REQUIRE(wampcc::json_decode_events(text.data(), text.size(), h));
+    REQUIRE(h.root == src);
+  }
+  {
+    build_handler h;
+    std::vector<char> bytes;
+    wampcc::json_msgpack_encode(src, bytes);
+    REQUIRE(wampcc::json_msgpack_decode_events(bytes.data(), bytes.size(), h));
+    REQUIRE(h.root == src);
+  }
+  {
+    build_handler h;
+    std::vector<char> bytes = wampcc::json_cbor_encode(src);
+    REQUIRE(wampcc::json_cbor_decode_events(bytes.data(), bytes.size(), h));
+    REQUIRE(h.root == src);
+  }
+  {
+    build_handler h;
+    REQUIRE(wampcc::json_emit_events(src, h));
+    REQUIRE(h.root == src);
+  }
+
+  /* the handler can stop the decode, after which input is not validated */
+  wampcc::json_object big;
+  for (int i = 0; i < 200; i++)
+    big["f" + std::to_string(i)] = i + 0.5;
+  std::string text = wampcc::json_encode(big);
+  {
+    find_handler h;
+    h.wanted = "f105";
+    text.resize(text.size() - 1); /* lose the closing brace */
+    REQUIRE(wampcc::json_decode_events(text.data(), text.size(), h) == false);
+    REQUIRE(h.found);
+    REQUIRE(h.value == 105.5);
+    REQUIRE(h.events < 400);
+  }
+  {
+    find_handler h;
+    h.wanted = "f105";
+    std::vector<char> bytes;
+    wampcc::json_msgpack_encode(big, bytes);
+    REQUIRE(wampcc::json_msgpack_decode_events(bytes.data(), bytes.size(), h) == false);
+    REQUIRE(h.value == 105.5);
+  }
+
+  /* malformed input throws, as for the full decoders */
+  find_handler h;
+  bool threw = false;
+  try {
+    wampcc::json_decode_events("[1, 2", 5, h);
+  } catch (wampcc::json_error&) {
+    threw = true;
+  }
+  REQUIRE(threw);
+}
+
 //----------------------------------------------------------------------
 // TEST_CASE( demo_test )
 // {
@@ -0,0 +1,138 @@
+#include "wampcc/json.h"
+#include <iostream>
+#include <stdexcept>
+#include <list>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "mini_test.h"
+#include "test_values.h"
+
+void test_json_value(const wampcc::json_value& src)
+{
+  std::vector<char> bytes = wampcc::json_cbor_encode(src);
+
+  auto dest = wampcc::json_cbor_decode(bytes.data(), bytes.size());
+
+  REQUIRE(src == dest);
+}
+
+TEST_CASE( "cbor_encode_decode" )
+{
+  for (auto & item : test_inputs())
+    test_json_value( item );
+}
+
+TEST_CASE( "cbor_integer_limits" )
+{
+  auto i64max = (std::numeric_limits<long long>::max)();
+  auto i64min = (std::numeric_limits<long long>::min)();
+  auto u64max = (std::numeric_limits<unsigned long long>::max)();
+
+  wampcc::json_value jin = wampcc::json_value::make_array();
+  jin.as_array().push_back(0);
+  jin.as_array().push_back(-1);
+  jin.as_array().push_back(23);
+  jin.as_array().push_back(-24);
+  jin.as_array().push_back(-25);
+  jin.as_array().push_back(255);
+  jin.as_array().push_back(65535);
+  jin.as_array().push_back(4294967295);
+  jin.as_array().push_back(563234340645992);
+  jin.as_array().push_back(i64max);
+  jin.as_array().push_back(i64min);
+  jin.as_array().push_back(wampcc::json_value::make_uint(u64max));
+
+  std::vector<char> bytes = wampcc::json_cbor_encode(jin);
+  wampcc::json_value jout = wampcc::json_cbor_decode(bytes.data(), bytes.size());
+
+  REQUIRE(jin == jout);
+  REQUIRE(jout.as_array()[11].as_uint() == u64max);
+}
+
+TEST_CASE( "cbor_encoding" )
+{
+  /* examples from RFC 7049, appendix A */
+  REQUIRE(wampcc::json_cbor_encode(wampcc::json_value::make_uint(1000000)) ==
+          (std::vector<char>{'\x1a', '\x00', '\x0f', '\x42', '\x40'}));
+  REQUIRE(wampcc::json_cbor_encode(wampcc::json_value::make_int(-1000)) ==
+          (std::vector<char>{'\x39', '\x03', '\xe7'}));
+  REQUIRE(wampcc::json_cbor_encode(wampcc::json_value::make_double(1.5)) ==
+          (std::vector<char>{'\xfa', '\x3f', '\xc0', '\x00', '\x00'}));
+  REQUIRE(wampcc::json_cbor_encode(wampcc::json_value::make_double(1.1)) ==
+          (std::vector<char>{'\xfb', '\x3f', '\xf1', '\x99', '\x99',
+                             '\x99', '\x99', '\x99', '\x9a'}));
+  REQUIRE(wampcc::json_cbor_encode(wampcc::json_array{"a", wampcc::json_object{{"b", "c"}}}) ==
+          (std::vector<char>{'\x82', '\x61', 'a', '\xa1', '\x61', 'b', '\x61', 'c'}));
+}
+
+TEST_CASE( "cbor_decoding" )
+{
+  /* half precision float, tag, indefinite length containers and strings,
+   * undefined */
+  const char half[] = {'\xf9', '\x3e', '\x00'};
+  REQUIRE(wampcc::json_cbor_decode(half, sizeof(half)).as_real() == 1.5);
+
+  const char tagged[] = {'\xc1', '\x1a', '\x51', '\x4b', '\x67', '\xb0'};
+  REQUIRE(wampcc::json_cbor_decode(tagged, sizeof(tagged)).as_uint() == 1363896240);
+
+  const char indef[] = {'\xbf', '\x61', 'a', '\x9f', '\x01', '\xff',
+                        '\x7f', '\x61', 'b', '\x62', 'c', 'd', '\xff',
+                        '\xf7', '\xff'};
+  wampcc::json_value jv = wampcc::json_cbor_decode(indef, sizeof(indef));
+  REQUIRE(jv.as_object()["a"] == wampcc::json_array{1});
+  REQUIRE(jv.as_object()["bcd"].is_null());
+
+  const char bytes[] = {'\x43', 'x', 'y', 'z'};
+  REQUIRE(wampcc::json_cbor_decode(bytes, sizeof(bytes)).as_binary() ==
+          wampcc::json_binary({'x', 'y', 'z'}));
+}
+
+TEST_CASE( "cbor_decode_errors" )
+{
+  std::vector<std::vector<char>> bad {
+    {},
+    {'\x18'},                    // truncated uint8
+    {'\x62', 'a'},               // truncated text
+    {'\x82', '\x01'},            // truncated array
+    {'\xa1', '\x01', '\x02'},    // non-text map key
+    {'\x01', '\x02'},            // trailing bytes
+    {'\x1c'},                    // reserved additional information
+    {'\xf8', '\x20'},            // unsupported simple value
+    {'\x3b', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff'},
+    {'\x9b', '\x7f', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff', '\xff'}
+  };
+
+  for (auto & item : bad) {
+    bool caught = false;
+    try {
+      wampcc::json_cbor_decode(item.data(), item.size());
+    } catch (wampcc::cbor_error&) {
+      caught = true;
+    }
+    REQUIRE(caught);
+  }
+
+  /* nesting limit */
+  std::vector<char> deep(10000, '\x81');
+  deep.push_back('\x01');
+  bool caught = false;
+  try {
+    wampcc::json_cbor_decode(deep.data(), deep.size());
+  } catch (wampcc::cbor_error&) {
+    caught = true;
+  }
+  REQUIRE(caught);
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    int result = minitest::run(argc, argv);
+    return (result < 0xFF ? result : 0xFF );
+  } catch (std::exception& e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -5,117 +5,7 @@
 #include <cstring>
 
 #include "mini_test.h"
-
-wampcc::json_value create_input_object()
-{
-  wampcc::json_object jv {
-    {"k00",wampcc::json_value::make_null()},
-    {"k01",wampcc::json_value::make_array()},
-    {"k02",wampcc::json_value::make_object()},
-    {"k03",wampcc::json_value::make_string("hello")},
-    {"k04",wampcc::json_value::make_string("")},
-    {"k05",wampcc::json_value::make_bool(true)},
-    {"k06",wampcc::json_value::make_bool(false)},
-    {"k07",wampcc::json_value::make_int(-99)},
-    {"k08",wampcc::json_value::make_int(0)},
-    {"k09",wampcc::json_value::make_int(99)},
-    {"k10",wampcc::json_value::make_uint(0)},
-    {"k11",wampcc::json_value::make_uint(99)},
-    {"k12",wampcc::json_value::make_double(0.0)},
-    {"k13",wampcc::json_value::make_double(3.14)},
-    {"k14",wampcc::json_object{{"o1",1},{"o2",2},{"o3",3}} },
-    {"k15",wampcc::json_array{"a1",1,"a2",2,"a3",3}},
-      };
-  return jv;
-}
-
-wampcc::json_value create_input_array()
-{
-  wampcc::json_array jv {
-      wampcc::json_value::make_null(),
-      wampcc::json_value::make_array(),
-      wampcc::json_value::make_object(),
-      wampcc::json_value::make_string("hello"),
-      wampcc::json_value::make_string(""),
-      wampcc::json_value::make_bool(true),
-      wampcc::json_value::make_bool(false),
-      wampcc::json_value::make_int(-99),
-      wampcc::json_value::make_int(0),
-      wampcc::json_value::make_int(99),
-      wampcc::json_value::make_uint(0),
-      wampcc::json_value::make_uint(99),
-      wampcc::json_value::make_double(0.0),
-      wampcc::json_value::make_double(3.14),
-      wampcc::json_object{{"o1",1},{"o2",2},{"o3",3}},
-      wampcc::json_array{"a1",1,"a2",2,"a3",3},
-      };
-  return jv;
-}
-
-wampcc::json_array recurse_create_array(int depth)
-{
-  wampcc::json_array obj {
-    create_input_array(),
-    create_input_array(),
-    wampcc::json_value::make_array(),
-    wampcc::json_value::make_array() };
-
-  if (depth>0)
-    obj.push_back( recurse_create_array(depth-1) );
-  else
-    obj.push_back( wampcc::json_array() );
-
-  return obj;
-}
-
-wampcc::json_object recurse_create_object(int depth)
-{
-  wampcc::json_object obj;
-  obj.insert({"d01", create_input_object()});
-  obj.insert({"d02", create_input_array()});
-  obj.insert({"d03", wampcc::json_value::make_object()});
-  obj.insert({"d04", wampcc::json_value::make_array()});
-
-  if (depth>0)
-    obj.insert({"d05", recurse_create_object(depth-1)});
-  else
-    obj.insert({"d05", wampcc::json_object()});
-
-  return obj;
-}
-
-
-std::list<wampcc::json_value> test_inputs()
-{
-  std::list<wampcc::json_value> rv;
-
-  rv.push_back(wampcc::json_value::make_null());
-  rv.push_back(wampcc::json_value::make_array());
-  rv.push_back(wampcc::json_value::make_object());
-  rv.push_back(wampcc::json_value::make_string(""));
-  rv.push_back(wampcc::json_value::make_string("hello"));
-  rv.push_back(wampcc::json_value::make_bool(true));
-  rv.push_back(wampcc::json_value::make_bool(false));
-  rv.push_back(wampcc::json_value::make_int(-99));
-  rv.push_back(wampcc::json_value::make_int(0));
-  rv.push_back(wampcc::json_value::make_int(99));
-  rv.push_back(wampcc::json_value::make_uint(0));
-  rv.push_back(wampcc::json_value::make_uint(99));
-  rv.push_back(wampcc::json_value::make_double(0.0));
-  rv.push_back(wampcc::json_value::make_double(3.14));
-  rv.push_back(create_input_array());
-  rv.push_back(create_input_object());
-  rv.push_back(recurse_create_object(0));
-  rv.push_back(recurse_create_object(1));
-  rv.push_back(recurse_create_object(10));
-  rv.push_back(recurse_create_object(100));
-  rv.push_back(recurse_create_array(0));
-  rv.push_back(recurse_create_array(1));
-  rv.push_back(recurse_create_array(10));
-  rv.push_back(recurse_create_array(100));
-
-  return rv;
-}
+#include "test_values.h"
 
 void test_json_value(const wampcc::json_value& src)
 {
@@ -167,6 +57,75 @@ TEST_CASE( "msgpack_signed_integer_limits" )
   REQUIRE(jin == jout);
 }
 
+TEST_CASE( "msgpack_encode_append" )
+{
+  /* encoding into a caller buffer must leave existing bytes untouched */
+  wampcc::json_value jin = create_input_object();
+  auto region = wampcc::json_msgpack_encode(jin);
+
+  std::vector<char> dest {'a', 'b', 'c', 'd'};
+  wampcc::json_msgpack_encode(jin, dest);
+
+  REQUIRE(dest.size() == 4 + region->second);
+  REQUIRE(memcmp(dest.data(), "abcd", 4) == 0);
+  REQUIRE(memcmp(dest.data() + 4, region->first, region->second) == 0);
+  REQUIRE(wampcc::json_msgpack_decode(dest.data() + 4, dest.size() - 4) == jin);
+}
+
+TEST_CASE( "msgpack_wire_format" )
+{
+  /* items are encoded in their smallest form, except reals */
+  auto bytes_of = [](const wampcc::json_value& jv) {
+    std::vector<char> dest;
+    wampcc::json_msgpack_encode(jv, dest);
+    return std::string(dest.begin(), dest.end());
+  };
+
+  REQUIRE(bytes_of(wampcc::json_array{}) == std::string("\x90", 1));
+  REQUIRE(bytes_of(wampcc::json_array{1, -1}) == std::string("\x92\x01\xff", 3));
+  REQUIRE(bytes_of(wampcc::json_array{200}) == std::string("\x91\xcc\xc8", 3));
+  REQUIRE(bytes_of(wampcc::json_array{-200}) == std::string("\x91\xd1\xff\x38", 4));
+  REQUIRE(bytes_of(wampcc::json_object{{"a", wampcc::json_value::make_null()}}) ==
+          std::string("\x81\xa1" "a" "\xc0", 4));
+  REQUIRE(bytes_of(wampcc::json_array{1.0}) ==
+          std::string("\x91\xcb\x3f\xf0\0\0\0\0\0\0", 10));
+
+  wampcc::json_array bin{wampcc::json_value::make_binary("\x01\x02", 2)};
+  REQUIRE(bytes_of(bin) == std::string("\x91\xc4\x02\x01\x02", 5));
+  REQUIRE(wampcc::json_msgpack_decode("\x91\xc4\x02\x01\x02", 5) == bin);
+
+  /* float 32 and signed formats holding non-negative values */
+  auto jv = wampcc::json_msgpack_decode("\x92\xca\x3f\x80\0\0\xd0\x05", 8);
+  REQUIRE(jv.as_array()[0].as_real() == 1.0);
+  REQUIRE(jv.as_array()[1].is_uint());
+  REQUIRE(jv.as_array()[1].as_uint() == 5);
+}
+
+TEST_CASE( "msgpack_invalid_input" )
+{
+  auto rejects = [](const char* p, size_t len) {
+    try {
+      wampcc::json_msgpack_decode(p, len);
+      return false;
+    } catch (wampcc::msgpack_error&) {
+      return true;
+    }
+  };
+
+  REQUIRE(rejects("", 0));
+  REQUIRE(rejects("\x92\x01", 2));            // truncated array
+  REQUIRE(rejects("\xa5" "abc", 4));           // truncated string
+  REQUIRE(rejects("\x91\x01\x01", 3));       // trailing bytes
+  REQUIRE(rejects("\xc1", 1));                 // never used
+  REQUIRE(rejects("\x91\xd4\x01\x00", 4));  // ext
+  REQUIRE(rejects("\x81\x01\x01", 3));       // non-string key
+  REQUIRE(rejects("\xdd\xff\xff\xff\xff", 5)); // oversized header
+
+  std::string deep(5000, '\x91');
+  deep.push_back('\xc0');
+  REQUIRE(rejects(deep.data(), deep.size()));
+}
+
 int main(int argc, char** argv)
 {
   try {
@@ -19,7 +19,8 @@ std::vector<protocol_type> protocols{protocol_type::websocket,
                                      protocol_type::rawsocket};
 
 std::vector<serialiser_type> serialisers{serialiser_type::json,
-                                         serialiser_type::msgpack};
+                                         serialiser_type::msgpack,
+                                         serialiser_type::cbor};
 
 std::string protocol_str(protocol_type p)
 {
@@ -36,6 +37,9 @@ std::string serialiser_str(serialiser_type p)
     case serialiser_type::none : return "none";
     case serialiser_type::json : return "json";
     case serialiser_type::msgpack : return "msgpack";
+    case serialiser_type::json_batched : return "json.batched";
+    case serialiser_type::msgpack_batched : return "msgpack.batched";
+    case serialiser_type::cbor : return "cbor";
   }
   return "unknown";
 }
@@ -171,6 +175,257 @@ TEST_CASE("basic_generic_server")
     run_rpc_test(generic_server, pt, serialiser_type::msgpack, true);
 }
 
+TEST_CASE("batched_serialisers")
+{
+  /* batched serialisers are only available with websocket */
+  auto generic_server = create_server(++global_port);
+
+  for (auto st : {serialiser_type::json_batched, serialiser_type::msgpack_batched}) {
+    run_rpc_test(generic_server, protocol_type::websocket, st, true);
+    run_rpc_test(generic_server, protocol_type::rawsocket, st, false);
+  }
+}
+
+/* The router forwards CALL and YIELD arguments without decoding them when
+ * caller and callee share a serialiser, and transcodes them otherwise. */
+void run_forwarding_test(std::shared_ptr<internal_server>& server,
+                         serialiser_type callee_serialiser,
+                         serialiser_type caller_serialiser)
+{
+  std::unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+
+  auto callee = establish_session(the_kernel, server->port(),
+                                  static_cast<int>(protocol_type::websocket),
+                                  static_cast<int>(callee_serialiser));
+  perform_realm_logon(callee);
+
+  std::promise<void> registered;
+  callee->provide("echo", {},
+                  [&registered](wamp_session&, registered_info) {
+                    registered.set_value();
+                  },
+                  [](wamp_session& ws, invocation_info info) {
+                    ws.yield(info.request_id, info.args.args_list,
+                             info.args.args_dict);
+                  });
+  if (registered.get_future().wait_for(std::chrono::milliseconds(200)) !=
+      std::future_status::ready)
+    throw std::runtime_error("timeout waiting for registration");
+
+  auto caller = establish_session(the_kernel, server->port(),
+                                  static_cast<int>(protocol_type::websocket),
+                                  static_cast<int>(caller_serialiser));
+  perform_realm_logon(caller);
+
+  wamp_args call_args;
+  call_args.args_list = json_array({1, "two", 3.5, json_array({true})});
+  call_args.args_dict = json_object({{"k", "v"}, {"n", -9}});
+
+  result_info result = sync_rpc_all(caller, "echo", call_args,
+                                    rpc_result_expect::success);
+
+  if (result.args != call_args)
+    throw std::runtime_error("forwarded arguments do not match, callee " +
+                             serialiser_str(callee_serialiser) + ", caller " +
+                             serialiser_str(caller_serialiser));
+
+  caller->close().wait();
+  callee->close().wait();
+}
+
+TEST_CASE("forwarded_arguments")
+{
+  auto server = create_server(++global_port);
+
+  std::vector<serialiser_type> all(serialisers);
+  all.push_back(serialiser_type::json_batched);
+  all.push_back(serialiser_type::msgpack_batched);
+
+  for (auto callee_st : all)
+    for (auto caller_st : all)
+      run_forwarding_test(server, callee_st, caller_st);
+}
+
+/* Records the events of a decode, as a compact trace */
+struct trace_handler : json_event_handler
+{
+  std::string trace;
+
+  bool null_value() override { trace += "n "; return true; }
+  bool bool_value(bool b) override { trace += b ? "t " : "f "; return true; }
+  bool int_value(json_int_t v) override { return number(v); }
+  bool uint_value(json_uint_t v) override { return number(v); }
+  bool real_value(double d) override { return number(d); }
+  bool string_value(const char* p, size_t n) override
+  {
+    trace += "s:" + std::string(p, n) + " ";
+    return true;
+  }
+  bool key(const char* p, size_t n) override
+  {
+    trace += "k:" + std::string(p, n) + " ";
+    return true;
+  }
+  bool start_object() override { trace += "{ "; return true; }
+  bool end_object() override { trace += "} "; return true; }
+  bool start_array() override { trace += "[ "; return true; }
+  bool end_array() override { trace += "] "; return true; }
+
+  template <typename T> bool number(T v)
+  {
+    std::ostringstream os;
+    os << v << " ";
+    trace += os.str();
+    return true;
+  }
+};
+
+/* A subscriber with defer_args_decode receives EVENT arguments encoded, and
+ * reads them with decode_events, for each serialiser. */
+void run_event_decode_test(std::shared_ptr<internal_server>& server,
+                           serialiser_type st)
+{
+  std::unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+
+  wamp_session::options opts;
+  opts.defer_args_decode = true;
+  auto subscriber = establish_session(the_kernel, server->port(),
+                                      static_cast<int>(protocol_type::websocket),
+                                      static_cast<int>(st), opts);
+  perform_realm_logon(subscriber);
+
+  std::promise<void> subscribed;
+  std::promise<std::pair<bool, std::string>> received;
+  subscriber->subscribe("ticks", {},
+                        [&subscribed](wamp_session&, subscribed_info) {
+                          subscribed.set_value();
+                        },
+                        [&received](wamp_session&, event_info info) {
+                          trace_handler handler;
+                          info.args.decode_events(handler);
+                          received.set_value({info.args.encoded != nullptr,
+                                              handler.trace});
+                        });
+  if (subscribed.get_future().wait_for(std::chrono::milliseconds(200)) !=
+      std::future_status::ready)
+    throw std::runtime_error("timeout waiting for subscription");
+
+  auto publisher = establish_session(the_kernel, server->port(),
+                                     static_cast<int>(protocol_type::websocket),
+                                     static_cast<int>(st));
+  perform_realm_logon(publisher);
+
+  wamp_args args;
+  args.args_list = json_array({1, "two", json_array({true})});
+  args.args_dict = json_object({{"bid", 2.5}, {"sym", "ABC"}});
+  publisher->publish("ticks", {}, args);
+
+  auto fut = received.get_future();
+  if (fut.wait_for(std::chrono::milliseconds(500)) != std::future_status::ready)
+    throw std::runtime_error("timeout waiting for event");
+
+  auto result = fut.get();
+  REQUIRE(result.first == true);
+  REQUIRE(result.second ==
+          "[ [ 1 s:two [ t ] ] { k:bid 2.5 k:sym s:ABC } ] ");
+
+  publisher->close().wait();
+  subscriber->close().wait();
+}
+
+TEST_CASE("event_decode_events")
+{
+  auto server = create_server(++global_port);
+
+  for (auto st : serialisers)
+    run_event_decode_test(server, st);
+
+  /* arguments already decoded give the same events */
+  wamp_args args;
+  args.args_list = json_array({1, "two", json_array({true})});
+  args.args_dict = json_object({{"bid", 2.5}, {"sym", "ABC"}});
+  trace_handler handler;
+  REQUIRE(args.decode_events(handler));
+  REQUIRE(handler.trace == "[ [ 1 s:two [ t ] ] { k:bid 2.5 k:sym s:ABC } ] ");
+
+  /* encoded arguments compare by value */
+  auto encode = [](const json_array& items) {
+    std::string text = json_encode(items);
+    std::shared_ptr<encoded_args> ea(new encoded_args());
+    ea->serialiser = serialiser_type::json;
+    ea->bytes.assign(text.begin(), text.end());
+    ea->items_begin = 0;
+    ea->items_end = ea->bytes.size();
+    ea->count = items.size();
+    return ea;
+  };
+  wamp_args encoded;
+  encoded.encoded = encode(json_array({args.args_list, args.args_dict}));
+  wamp_args other;
+  other.encoded = encode(json_array({json_array({2})}));
+
+  REQUIRE(encoded == args);
+  REQUIRE(args == encoded);
+  REQUIRE(encoded == encoded);
+  REQUIRE(encoded != other);
+  REQUIRE(encoded != wamp_args());
+  REQUIRE(other == wamp_args({json_array({2})}));
+}
+
+/* An EVENT is encoded once per serialisation and framing, and shared by each
+ * subscriber; check each kind of subscriber receives it intact. */
+TEST_CASE("event_fan_out")
+{
+  auto server = create_server(++global_port);
+  std::unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+
+  std::vector<std::pair<protocol_type, serialiser_type>> kinds;
+  for (auto st : serialisers)
+    for (auto pt : protocols)
+      kinds.push_back({pt, st});
+  kinds.push_back({protocol_type::websocket, serialiser_type::json_batched});
+  kinds.push_back({protocol_type::websocket, serialiser_type::msgpack_batched});
+
+  const size_t per_kind = 3;
+  std::vector<std::shared_ptr<wamp_session>> sessions;
+  std::vector<std::promise<wamp_args>> received(kinds.size() * per_kind);
+
+  for (size_t i = 0; i < received.size(); i++) {
+    auto& kind = kinds[i / per_kind];
+    auto session = establish_session(the_kernel, server->port(),
+                                     static_cast<int>(kind.first),
+                                     static_cast<int>(kind.second));
+    perform_realm_logon(session);
+
+    std::promise<void> subscribed;
+    std::promise<wamp_args>& event = received[i];
+    session->subscribe("fan.out", {},
+                       [&subscribed](wamp_session&, subscribed_info) {
+                         subscribed.set_value();
+                       },
+                       [&event](wamp_session&, event_info info) {
+                         event.set_value(info.args);
+                       });
+    subscribed.get_future().wait();
+    sessions.push_back(session);
+  }
+
+  wamp_args args;
+  args.args_list = json_array({1, "two", json_array({3.5, json_value::make_null()})});
+  args.args_dict = json_object({{"k", "v"}});
+  server->router()->publish("default_realm", "fan.out", {}, args);
+
+  for (auto& event : received) {
+    auto fut = event.get_future();
+    REQUIRE(fut.wait_for(std::chrono::milliseconds(500)) ==
+            std::future_status::ready);
+    REQUIRE(fut.get() == args);
+  }
+
+  for (auto& session : sessions)
+    session->close().wait();
+}
+
 int main(int argc, char** argv)
 {
   try {
@@ -67,8 +67,9 @@ enum test_outcome { e_expected, e_unexpected };
 class internal_server
 {
 public:
-  internal_server(logger log = logger::nolog()) // alt: debug_logger()
-    : m_kernel(new kernel({}, log)),
+  internal_server(logger log = logger::nolog(), // alt: debug_logger()
+                  config conf = {})
+    : m_kernel(new kernel(conf, log)),
       m_router(new wamp_router(m_kernel.get(), nullptr)),
       m_port(0),
       m_user_password("secret2"),
@@ -283,7 +284,8 @@ std::unique_ptr<tcp_socket> tcp_connect(kernel& k, int port)
 std::shared_ptr<wamp_session> establish_session(
   std::unique_ptr<kernel>& the_kernel, int port,
   int protocols = wampcc::all_protocols,
-  int serialisers = static_cast<int>(serialiser_type::none))
+  int serialisers = static_cast<int>(serialiser_type::none),
+  wamp_session::options session_opts = {})
 {
   static int count = 0;
   count++;
@@ -314,21 +316,21 @@ std::shared_ptr<wamp_session> establish_session(
   {
     case static_cast<int>(protocol_type::websocket) : {
       session = wamp_session::create<websocket_protocol>(
-        the_kernel.get(), std::move(sock), session_cb, ws_opts);
+        the_kernel.get(), std::move(sock), session_cb, ws_opts, session_opts);
       break;
     }
     case static_cast<int>(protocol_type::rawsocket) : {
       session = wamp_session::create<rawsocket_protocol>(
-        the_kernel.get(), std::move(sock), session_cb, rs_opts);
+        the_kernel.get(), std::move(sock), session_cb, rs_opts, session_opts);
       break;
     }
     case wampcc::all_protocols : {
       if (count % 2)
         session = wamp_session::create<rawsocket_protocol>(
-          the_kernel.get(), std::move(sock), session_cb, rs_opts);
+          the_kernel.get(), std::move(sock), session_cb, rs_opts, session_opts);
       else
         session = wamp_session::create<websocket_protocol>(
-          the_kernel.get(), std::move(sock), session_cb, ws_opts);
+          the_kernel.get(), std::move(sock), session_cb, ws_opts, session_opts);
       break;
     }
   }
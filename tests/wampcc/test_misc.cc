@@ -11,6 +11,7 @@
 #include "wampcc/platform.h"
 #include "wampcc/wampcc.h"
 #include "wampcc/http_parser.h"
+#include "wampcc/simd.h"
 
 #include <sys/socket.h>
 
@@ -313,6 +314,280 @@ TEST_CASE("socket_address")
   REQUIRE(sa10 != sa11);
 }
 
+static std::vector<simd_level> supported_levels()
+{
+  std::vector<simd_level> levels;
+  for (auto level : {simd_level::scalar, simd_level::sse2, simd_level::avx2})
+    if (simd_supported(level))
+      levels.push_back(level);
+  return levels;
+}
+
+TEST_CASE("test_simd_unmask")
+{
+  const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+
+  REQUIRE(simd_supported(simd_level::scalar));
+
+  for (auto level : supported_levels()) {
+    /* cover lengths either side of the vector widths */
+    for (size_t len = 0; len < 100; len++) {
+      std::vector<char> orig(len), data(len);
+      for (size_t i = 0; i < len; i++)
+        orig[i] = data[i] = (char)(i * 7);
+
+      simd_unmask(level, data.data(), len, key);
+      for (size_t i = 0; i < len; i++)
+        REQUIRE(data[i] == (char)(orig[i] ^ key[i % 4]));
+
+      simd_unmask(level, data.data(), len, key);
+      REQUIRE(data == orig);
+    }
+  }
+}
+
+TEST_CASE("test_simd_is_valid_utf8")
+{
+  const std::vector<std::string> valid = {
+    "",
+    "hello",
+    "caf\xc3\xa9",
+    "\xe2\x82\xac",                             // U+20AC
+    "\xf0\x9f\x98\x80",                         // U+1F600
+    "\xf4\x8f\xbf\xbf",                         // U+10FFFF
+    "\xed\x9f\xbf\xee\x80\x80"                  // either side of surrogates
+  };
+  const std::vector<std::string> invalid = {
+    "\x80",                                     // lone continuation
+    "\xc3\xa9\xa9",                             // extra continuation
+    "\xc0\xaf",                                 // overlong
+    "\xe0\x80\xaf",                             // overlong
+    "\xf0\x80\x80\xaf",                         // overlong
+    "\xed\xa0\x80",                             // surrogate
+    "\xf4\x90\x80\x80",                         // above U+10FFFF
+    "\xf5\x80\x80\x80",
+    "\xe2\x82",                                 // truncated
+    "\xf0\x9f\x98",
+    "\xe2\x82" "a",
+    "\xff"
+  };
+
+  /* a long run of three byte sequences, as in CJK text */
+  std::string cjk;
+  for (int i = 0; i < 100; i++)
+    cjk += "\xe4\xb8\xad";
+
+  for (auto level : supported_levels()) {
+    auto valid_utf8 = [level](const std::string& s) {
+      return simd_is_valid_utf8(level, s.data(), s.size());
+    };
+
+    /* place each case at every offset around the vector widths, and at the
+     * end of the input */
+    for (size_t pad = 0; pad < 70; pad++) {
+      std::string padding(pad, 'a');
+      for (auto& s : valid) {
+        REQUIRE(valid_utf8(padding + s));
+        REQUIRE(valid_utf8(padding + s + padding));
+        REQUIRE(valid_utf8(cjk.substr(0, pad * 3) + s + padding));
+      }
+      for (auto& s : invalid) {
+        REQUIRE(!valid_utf8(padding + s));
+        REQUIRE(!valid_utf8(padding + s + padding));
+        REQUIRE(!valid_utf8(cjk.substr(0, pad * 3) + s + padding));
+      }
+    }
+
+    REQUIRE(valid_utf8(cjk));
+    for (size_t i = 0; i < cjk.size(); i++) {
+      std::string broken = cjk;
+      broken[i] = 'a';
+      REQUIRE(!valid_utf8(broken));
+    }
+  }
+
+  /* each implementation agrees with the scalar one on random input, mostly
+   * valid UTF-8 with occasional bad bytes */
+  const char* pieces[] = {"a", "\xc3\xa9", "\xe4\xb8\xad", "\xf0\x9f\x98\x80",
+                          "\x80", "\xc0", "\xed\xa0\x80", "\xf4\x90"};
+  std::mt19937 gen(1234);
+  for (int n = 0; n < 5000; n++) {
+    std::string s;
+    size_t count = gen() % 80;
+    for (size_t i = 0; i < count; i++)
+      s += pieces[(gen() % 64 == 0) ? 4 + gen() % 4 : gen() % 4];
+    bool expected = simd_is_valid_utf8(simd_level::scalar, s.data(), s.size());
+    for (auto level : supported_levels())
+      REQUIRE(simd_is_valid_utf8(level, s.data(), s.size()) == expected);
+  }
+}
+
+
+/* A websocket client built on a bare tcp_socket, so that the frames sent to
+ * the router can be chosen exactly. */
+struct raw_websocket
+{
+  raw_websocket(kernel& k, int port)
+    : sock(tcp_connect(k, port))
+  {
+    sock->start_read(
+      [this](char* src, size_t len) {
+        std::lock_guard<std::mutex> guard(mutex);
+        received.append(src, len);
+        cond.notify_all();
+      },
+      [this](uverr) {
+        std::lock_guard<std::mutex> guard(mutex);
+        closed = true;
+        cond.notify_all();
+      });
+
+    std::string request =
+      "GET / HTTP/1.1\r\n"
+      "Host: 127.0.0.1\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n"
+      "Sec-WebSocket-Protocol: wamp.2.json\r\n\r\n";
+    sock->write(request.data(), request.size());
+
+    std::unique_lock<std::mutex> guard(mutex);
+    if (!cond.wait_for(guard, std::chrono::seconds(5), [this]() {
+          return received.find("\r\n\r\n") != std::string::npos; }))
+      throw std::runtime_error("timeout waiting for websocket handshake");
+    if (received.compare(0, 12, "HTTP/1.1 101") != 0)
+      throw std::runtime_error("websocket handshake failed");
+    received.erase(0, received.find("\r\n\r\n") + 4);
+  }
+
+  /* Send a masked frame */
+  void send(bool fin, int opcode, const std::string& payload)
+  {
+    const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    std::string frame;
+    frame += (char)((fin ? 0x80 : 0) | opcode);
+    if (payload.size() < 126)
+      frame += (char)(0x80 | payload.size());
+    else {
+      frame += (char)(0x80 | 126);
+      frame += (char)(payload.size() >> 8);
+      frame += (char)(payload.size() & 0xFF);
+    }
+    frame.append((const char*) key, 4);
+    for (size_t i = 0; i < payload.size(); i++)
+      frame += (char)(payload[i] ^ key[i % 4]);
+    sock->write(frame.data(), frame.size());
+  }
+
+  /* Wait for the next frame from the router, returning its opcode and
+   * payload; the opcode is -1 if the connection closes instead. */
+  std::pair<int, std::string> next_frame()
+  {
+    std::unique_lock<std::mutex> guard(mutex);
+    size_t header_len = 0, payload_len = 0;
+    auto complete = [&]() {
+      if (received.size() < 2)
+        return false;
+      payload_len = (uint8_t) received[1] & 0x7F;
+      header_len = 2;
+      if (payload_len == 126) {
+        header_len = 4;
+        if (received.size() < header_len)
+          return false;
+        payload_len = ((uint8_t) received[2] << 8) | (uint8_t) received[3];
+      }
+      return received.size() >= header_len + payload_len;
+    };
+
+    if (!cond.wait_for(guard, std::chrono::seconds(5),
+                       [&]() { return complete() || closed; }))
+      throw std::runtime_error("timeout waiting for websocket frame");
+    if (!complete())
+      return {-1, {}};
+
+    std::pair<int, std::string> frame((uint8_t) received[0] & 0x0F,
+                                      received.substr(header_len, payload_len));
+    received.erase(0, header_len + payload_len);
+    return frame;
+  }
+
+  std::unique_ptr<tcp_socket> sock;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::string received;
+  bool closed = false;
+};
+
+
+/* Unfragmented data frames are unmasked and validated in place, while
+ * fragmented messages and control frames are left to websocketpp. */
+TEST_CASE("test_websocket_frames")
+{
+  std::mutex log_mutex;
+  std::vector<std::string> warnings;
+  logger log;
+  log.wants_level = [](logger::Level l) { return l == logger::eWarn; };
+  log.write = [&](logger::Level, const std::string& msg, const char*, int) {
+    std::lock_guard<std::mutex> guard(log_mutex);
+    warnings.push_back(msg);
+  };
+
+  internal_server iserver(log);
+  int port = iserver.start(25100);
+  kernel the_kernel;
+
+  /* a HELLO long enough to need a 16 bit length, with multibyte UTF-8 */
+  std::string hello = "[1,\"default_realm\",{\"authid\":\"peter\","
+    "\"authmethods\":[\"wampcra\"],\"roles\":{\"subscriber\":{}},"
+    "\"agent\":\"" + std::string(100, 'x') + "caf\xc3\xa9 \xe4\xb8\xad\"}]";
+  const std::string challenge = "[4,\"wampcra\"";
+
+  {
+    raw_websocket ws(the_kernel, port);
+    ws.send(true, 0x1, hello);
+    auto frame = ws.next_frame();
+    REQUIRE(frame.first == 0x1);
+    REQUIRE(frame.second.compare(0, challenge.size(), challenge) == 0);
+  }
+
+  {
+    /* fragments, with a PING between them, reassembled by websocketpp; PONGs
+     * are sent only after the router's minimum interval */
+    raw_websocket ws(the_kernel, port);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    ws.send(false, 0x1, hello.substr(0, 60));
+    ws.send(true, 0x9, "ping");
+    ws.send(true, 0x0, hello.substr(60));
+
+    auto pong = ws.next_frame();
+    REQUIRE(pong.first == 0xA);
+    REQUIRE(pong.second == "ping");
+
+    auto frame = ws.next_frame();
+    REQUIRE(frame.first == 0x1);
+    REQUIRE(frame.second.compare(0, challenge.size(), challenge) == 0);
+  }
+
+  {
+    /* a text frame of invalid UTF-8 is rejected, and the session aborted */
+    raw_websocket ws(the_kernel, port);
+    std::string bad = hello;
+    bad[bad.find("\xc3")] = (char) 0xff;
+    ws.send(true, 0x1, bad);
+    auto frame = ws.next_frame();
+    REQUIRE(frame.first == 0x1);
+    REQUIRE(frame.second.compare(0, 3, "[3,") == 0);
+
+    std::lock_guard<std::mutex> guard(log_mutex);
+    bool found = false;
+    for (auto& msg : warnings)
+      found |= msg.find("invalid UTF-8 in websocket text frame") !=
+        std::string::npos;
+    REQUIRE(found);
+  }
+}
+
 int main(int argc, char** argv)
 {
   try {
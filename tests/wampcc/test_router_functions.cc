@@ -9,6 +9,9 @@
 
 #include "mini_test.h"
 
+#include "wampcc/io_loop.h"
+#include "wampcc/pubsub_man.h"
+
 using namespace wampcc;
 using namespace std;
 
@@ -181,6 +184,986 @@ TEST_CASE("test_all_bulk_v2")
 }
 
 
+/* Subscriptions with the prefix and wildcard match policies receive events
+ * for each matching topic, with the concrete topic in the event details. */
+TEST_CASE("test_pattern_subscriptions")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+  std::unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+
+  auto session = establish_session(the_kernel, port,
+                                   static_cast<int>(protocol_type::rawsocket),
+                                   static_cast<int>(serialiser_type::json));
+  perform_realm_logon(session);
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<std::pair<t_subscription_id, json_object>> events;
+
+  auto subscribe = [&](const char* uri, const char* match) {
+    json_object options;
+    if (match)
+      options["match"] = match;
+    std::promise<subscribed_info> subscribed;
+    session->subscribe(uri, options,
+                       [&subscribed](wamp_session&, subscribed_info info) {
+                         subscribed.set_value(info);
+                       },
+                       [&](wamp_session&, event_info info) {
+                         std::lock_guard<std::mutex> guard(mutex);
+                         events.push_back({info.subscription_id, info.details});
+                         cond.notify_all();
+                       });
+    return subscribed.get_future().get();
+  };
+
+  auto wait_for_events = [&](size_t count) {
+    std::unique_lock<std::mutex> guard(mutex);
+    cond.wait_for(guard, std::chrono::milliseconds(500),
+                  [&]() { return events.size() >= count; });
+    return events.size();
+  };
+
+  subscribed_info exact = subscribe("com.app.status.cpu", nullptr);
+  subscribed_info prefix = subscribe("com.app.stat", "prefix");
+  subscribed_info wildcard = subscribe("com..status.cpu", "wildcard");
+  REQUIRE(!exact.was_error);
+  REQUIRE(!prefix.was_error);
+  REQUIRE(!wildcard.was_error);
+  REQUIRE(prefix.subscription_id != exact.subscription_id);
+  REQUIRE(wildcard.subscription_id != prefix.subscription_id);
+
+  REQUIRE(subscribe("com.app.", "regex").was_error);
+  REQUIRE(subscribe("com..app", "prefix").was_error);
+
+  iserver.router()->publish("default_realm", "com.app.status.cpu", {}, {});
+  REQUIRE(wait_for_events(3) == 3);
+
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto& item : events) {
+      if (item.first == exact.subscription_id)
+        REQUIRE(item.second.find("topic") == item.second.end());
+      else
+        REQUIRE(item.second["topic"] == "com.app.status.cpu");
+    }
+    events.clear();
+  }
+
+  /* matched only by the wildcard */
+  iserver.router()->publish("default_realm", "com.other.status.cpu", {}, {});
+  /* matched by neither pattern */
+  iserver.router()->publish("default_realm", "com.other.status", {}, {});
+  /* matched only by the prefix, which can end within a component */
+  iserver.router()->publish("default_realm", "com.app.statistics", {}, {});
+  REQUIRE(wait_for_events(2) == 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    REQUIRE(events.size() == 2);
+    REQUIRE(events[0].first == wildcard.subscription_id);
+    REQUIRE(events[0].second["topic"] == "com.other.status.cpu");
+    REQUIRE(events[1].first == prefix.subscription_id);
+    REQUIRE(events[1].second["topic"] == "com.app.statistics");
+  }
+
+  session->close().wait();
+}
+
+
+/* Publish to several topics from concurrent threads; each subscription must
+ * receive every event, in order for each topic. */
+TEST_CASE("test_concurrent_publishers")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+  std::unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+
+  auto session = establish_session(the_kernel, port,
+                                   static_cast<int>(protocol_type::rawsocket),
+                                   static_cast<int>(serialiser_type::msgpack));
+  perform_realm_logon(session);
+
+  const int num_topics = 4;
+  const int per_topic = 250;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::map<t_subscription_id, std::vector<std::pair<std::string, int>>> received;
+  size_t total = 0;
+
+  auto subscribe = [&](std::string uri, json_object options) {
+    std::promise<t_subscription_id> subscribed;
+    session->subscribe(uri, options,
+                       [&subscribed](wamp_session&, subscribed_info info) {
+                         subscribed.set_value(info.subscription_id);
+                       },
+                       [&, uri](wamp_session&, event_info info) {
+                         auto iter = info.details.find("topic");
+                         std::string topic = (iter != info.details.end())
+                           ? iter->second.as_string() : uri;
+                         std::lock_guard<std::mutex> guard(mutex);
+                         received[info.subscription_id].push_back(
+                           {topic, (int) info.args.args_list[0].as_int()});
+                         total++;
+                         cond.notify_all();
+                       });
+    return subscribed.get_future().get();
+  };
+
+  std::vector<t_subscription_id> exact;
+  for (int i = 0; i < num_topics; i++)
+    exact.push_back(subscribe("conc.topic" + std::to_string(i), {}));
+  t_subscription_id prefix = subscribe("conc.", {{"match", "prefix"}});
+
+  std::vector<std::thread> publishers;
+  for (int i = 0; i < num_topics; i++)
+    publishers.emplace_back([&iserver, i]() {
+        std::string topic = "conc.topic" + std::to_string(i);
+        for (int j = 0; j < per_topic; j++) {
+          wamp_args args;
+          args.args_list = json_array({j});
+          iserver.router()->publish("default_realm", topic, {}, args);
+        }
+      });
+  for (auto& t : publishers)
+    t.join();
+
+  const size_t expected = 2 * num_topics * per_topic;
+  {
+    std::unique_lock<std::mutex> guard(mutex);
+    cond.wait_for(guard, std::chrono::seconds(5),
+                  [&]() { return total >= expected; });
+    REQUIRE(total == expected);
+
+    for (auto id : exact) {
+      auto& events = received[id];
+      REQUIRE(events.size() == per_topic);
+      for (int j = 0; j < per_topic; j++)
+        REQUIRE(events[j].second == j);
+    }
+
+    std::map<std::string, int> next;
+    for (auto& item : received[prefix])
+      REQUIRE(item.second == next[item.first]++);
+    REQUIRE(next.size() == num_topics);
+  }
+
+  session->close().wait();
+}
+
+
+/* Topics are reclaimed once they have no subscribers and no image. */
+TEST_CASE("test_topic_reclaim")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+  auto other = establish_session(the_kernel, port);
+  perform_realm_logon(other);
+
+  auto subscribe = [](std::shared_ptr<wamp_session>& ws, const char* uri,
+                      json_object options) {
+    std::promise<subscribed_info> subscribed;
+    ws->subscribe(uri, options,
+                  [&subscribed](wamp_session&, subscribed_info info) {
+                    subscribed.set_value(info);
+                  },
+                  [](wamp_session&, event_info) {});
+    return subscribed.get_future().get();
+  };
+
+  auto unsubscribe = [](std::shared_ptr<wamp_session>& ws, t_subscription_id id) {
+    std::promise<void> unsubscribed;
+    ws->unsubscribe(id,
+                    [&unsubscribed](wamp_session&, unsubscribed_info) {
+                      unsubscribed.set_value();
+                    });
+    unsubscribed.get_future().wait();
+  };
+
+  auto topics = [&session]() {
+    auto result = sync_rpc_all(session, WAMP_REFLECTION_TOPIC_LIST, {},
+                               rpc_result_expect::success);
+    std::set<std::string> uris;
+    for (auto& item : result.args.args_list)
+      uris.insert(item.as_string());
+    return uris;
+  };
+
+  subscribe(session, "gc.a", {});
+  auto b = subscribe(session, "gc.b", {});
+  subscribe(other, "gc.b", {});
+  subscribe(other, "gc.c", {});
+  auto prefix = subscribe(session, "gc.", {{"match", "prefix"}});
+
+  /* a topic with an image is retained without subscribers */
+  wamp_args patch;
+  patch.args_list = json_array(
+    {json_array({json_object({{"op", "replace"}, {"path", ""}, {"value", 1}})})});
+  iserver.router()->publish("default_realm", "gc.image", {{"_p", 1}}, patch);
+
+  /* publishing to a topic without subscribers does not create it */
+  iserver.router()->publish("default_realm", "gc.none", {}, {});
+
+  /* a topic whose patches cannot be applied has no image */
+  wamp_args bad_patch;
+  bad_patch.args_list = json_array(
+    {json_array({json_object({{"op", "remove"}, {"path", "/missing"}})})});
+  iserver.router()->publish("default_realm", "gc.bad", {{"_p", 1}}, bad_patch);
+  subscribe(other, "gc.bad", {});
+
+  REQUIRE(topics() == std::set<std::string>({"gc.a", "gc.b", "gc.bad", "gc.c",
+                                             "gc.image"}));
+
+  unsubscribe(session, b.subscription_id);
+  REQUIRE(topics() == std::set<std::string>({"gc.a", "gc.b", "gc.bad", "gc.c",
+                                             "gc.image"}));
+
+  other->close().wait();
+  other.reset();
+  REQUIRE(topics() == std::set<std::string>({"gc.a", "gc.image"}));
+
+  /* a reclaimed pattern is replaced by a new subscription */
+  unsubscribe(session, prefix.subscription_id);
+  auto renewed = subscribe(session, "gc.", {{"match", "prefix"}});
+  REQUIRE(renewed.subscription_id != prefix.subscription_id);
+
+  session->close().wait();
+}
+
+
+/* Batches published by the router, and by a client session, reach each kind
+ * of subscriber in publication order. */
+TEST_CASE("test_publish_batch")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+  std::unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+
+  std::vector<std::pair<protocol_type, serialiser_type>> kinds;
+  for (auto st : {serialiser_type::json, serialiser_type::msgpack,
+                  serialiser_type::cbor})
+    for (auto pt : {protocol_type::websocket, protocol_type::rawsocket})
+      kinds.push_back({pt, st});
+  kinds.push_back({protocol_type::websocket, serialiser_type::json_batched});
+  kinds.push_back({protocol_type::websocket, serialiser_type::msgpack_batched});
+
+  struct subscriber
+  {
+    std::shared_ptr<wamp_session> session;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::pair<std::string, int>> events;
+  };
+
+  std::vector<std::unique_ptr<subscriber>> subscribers;
+  for (auto& kind : kinds) {
+    std::unique_ptr<subscriber> sub(new subscriber);
+    sub->session = establish_session(the_kernel, port,
+                                     static_cast<int>(kind.first),
+                                     static_cast<int>(kind.second));
+    perform_realm_logon(sub->session);
+
+    subscriber* ptr = sub.get();
+    std::promise<void> subscribed;
+    sub->session->subscribe("batch.", {{"match", "prefix"}},
+                            [&subscribed](wamp_session&, subscribed_info) {
+                              subscribed.set_value();
+                            },
+                            [ptr](wamp_session&, event_info info) {
+                              std::lock_guard<std::mutex> guard(ptr->mutex);
+                              ptr->events.push_back(
+                                {info.details["topic"].as_string(),
+                                 (int) info.args.args_list[0].as_int()});
+                              ptr->cond.notify_all();
+                            });
+    subscribed.get_future().wait();
+    subscribers.push_back(std::move(sub));
+  }
+
+  auto make_items = [](int first) {
+    std::vector<publish_item> items;
+    for (int i = first; i < first + 6; i++) {
+      publish_item item;
+      item.uri = (i % 2) ? "batch.odd" : "batch.even";
+      item.args.args_list = json_array({i});
+      items.push_back(std::move(item));
+    }
+    return items;
+  };
+
+  iserver.router()->publish_batch("default_realm", make_items(0));
+
+  auto publisher = establish_session(the_kernel, port,
+                                     static_cast<int>(protocol_type::rawsocket),
+                                     static_cast<int>(serialiser_type::json));
+  perform_realm_logon(publisher);
+
+  std::mutex acked_mutex;
+  std::condition_variable acked_cond;
+  std::set<t_request_id> acked;
+  auto items = make_items(6);
+  for (auto& item : items)
+    item.options[WAMP_ACKNOWLEDGE] = true;
+  auto request_ids = publisher->publish_batch(
+    std::move(items), [&](wamp_session&, published_info info) {
+      std::lock_guard<std::mutex> guard(acked_mutex);
+      if (!info.was_error)
+        acked.insert(info.request_id);
+      acked_cond.notify_all();
+    });
+  REQUIRE(request_ids.size() == 6);
+
+  for (auto& sub : subscribers) {
+    std::unique_lock<std::mutex> guard(sub->mutex);
+    sub->cond.wait_for(guard, std::chrono::milliseconds(500),
+                       [&]() { return sub->events.size() >= 12; });
+    REQUIRE(sub->events.size() == 12);
+    for (int i = 0; i < 12; i++) {
+      REQUIRE(sub->events[i].first == ((i % 2) ? "batch.odd" : "batch.even"));
+      REQUIRE(sub->events[i].second == i);
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> guard(acked_mutex);
+    acked_cond.wait_for(guard, std::chrono::milliseconds(500),
+                        [&]() { return acked.size() >= request_ids.size(); });
+    REQUIRE(acked == std::set<t_request_id>(request_ids.begin(), request_ids.end()));
+  }
+
+  publisher->close().wait();
+  for (auto& sub : subscribers)
+    sub->session->close().wait();
+}
+
+
+/* A batch with an invalid patch is rejected as a whole, so no item of it is
+ * retained or sent to subscribers. */
+TEST_CASE("test_publish_batch_bad_patch")
+{
+  auto make_batch = [](bool bad) {
+    std::vector<publish_item> items(2);
+    items[0].uri = "h.a";
+    items[0].args.args_list = json_array({1});
+    items[1].uri = "h.b";
+    items[1].options = {{"_p", 1}};
+    if (bad)
+      items[1].args.args_list = json_array({"not-an-array"});
+    else
+      items[1].args.args_list = json_array({json_array()});
+    return items;
+  };
+
+  event_history_options history;
+  history.max_events = 10;
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  {
+    pubsub_man pubsub(the_kernel.get());
+    pubsub.set_event_history("default_realm", "h.a", history);
+
+    auto items = make_batch(true);
+    bool rejected = false;
+    try {
+      pubsub.publish_batch("default_realm", items);
+    }
+    catch (const wamp_error& e) {
+      rejected = e.error_uri() == WAMP_ERROR_INVALID_ARGUMENT;
+    }
+    REQUIRE(rejected);
+    REQUIRE(pubsub.get_history("default_realm", "h.a", 0).empty());
+    REQUIRE(pubsub.get_topics("default_realm") == json_array({"h.a"}));
+  }
+
+  /* through the router, where the error is only logged, a subscriber sees,
+   * and the history retains, just the later, valid, batch */
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+  iserver.router()->set_event_history("default_realm", "h.a", history);
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<int> received;
+  std::promise<void> subscribed;
+  session->subscribe("h.a", {},
+                     [&subscribed](wamp_session&, subscribed_info) {
+                       subscribed.set_value();
+                     },
+                     [&](wamp_session&, event_info info) {
+                       std::lock_guard<std::mutex> guard(mutex);
+                       received.push_back(info.args.args_list[0].as_int());
+                       cond.notify_all();
+                     });
+  subscribed.get_future().wait();
+
+  iserver.router()->publish_batch("default_realm", make_batch(true));
+  auto good = make_batch(false);
+  good[0].args.args_list = json_array({2});
+  iserver.router()->publish_batch("default_realm", std::move(good));
+
+  {
+    std::unique_lock<std::mutex> guard(mutex);
+    cond.wait_for(guard, std::chrono::seconds(5),
+                  [&]() { return !received.empty(); });
+    REQUIRE(received == std::vector<int>({2}));
+  }
+
+  auto last = sync_rpc_all(session, WAMP_TOPIC_HISTORY_LAST, {{"h.a"}},
+                           rpc_result_expect::success);
+  REQUIRE(last.args.args_list.size() == 1);
+  REQUIRE(last.args.args_list[0].as_object().at("args") == json_array({2}));
+
+  session->close().wait();
+}
+
+
+/* A subscription made as its session closes, which session_closed has not
+ * seen, is still removed. */
+TEST_CASE("test_subscribe_closed_session")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+  session->close().wait();
+
+  pubsub_man pubsub(the_kernel.get());
+  json_object options;
+  pubsub.subscribe(session.get(), 1, "gc.closed", options);
+
+  REQUIRE(pubsub.get_topics(session->realm()).empty());
+}
+
+
+/* Retained events are replayed to subscribers that request them, and are
+ * returned by the event history meta procedures. */
+TEST_CASE("test_event_history")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  event_history_options history;
+  history.max_events = 3;
+  iserver.router()->set_event_history("default_realm", "history.a", history);
+
+  for (int i = 0; i < 5; i++)
+  {
+    wamp_args args;
+    args.args_list = json_array({i});
+    iserver.router()->publish("default_realm", "history.a", {}, args);
+  }
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  auto values = [](const json_array& events) {
+    std::vector<int> dest;
+    for (auto& ev : events)
+      dest.push_back(ev.as_object().at("args").as_array()[0].as_int());
+    return dest;
+  };
+
+  auto last = sync_rpc_all(session, WAMP_TOPIC_HISTORY_LAST, {{"history.a"}},
+                           rpc_result_expect::success);
+  REQUIRE(values(last.args.args_list) == std::vector<int>({2, 3, 4}));
+
+  last = sync_rpc_all(session, WAMP_TOPIC_HISTORY_LAST, {{"history.a", 2}},
+                      rpc_result_expect::success);
+  REQUIRE(values(last.args.args_list) == std::vector<int>({3, 4}));
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<int> received;
+
+  std::promise<subscribed_info> subscribed;
+  session->subscribe("history.a", {{WAMP_GET_RETAINED, true}},
+                     [&subscribed](wamp_session&, subscribed_info info) {
+                       subscribed.set_value(info);
+                     },
+                     [&](wamp_session&, event_info info) {
+                       std::lock_guard<std::mutex> guard(mutex);
+                       received.push_back(info.args.args_list[0].as_int());
+                       cond.notify_all();
+                     });
+  auto sub = subscribed.get_future().get();
+
+  {
+    std::unique_lock<std::mutex> guard(mutex);
+    cond.wait_for(guard, std::chrono::seconds(5),
+                  [&]() { return received.size() >= 3; });
+    REQUIRE(received == std::vector<int>({2, 3, 4}));
+  }
+
+  auto events = sync_rpc_all(session, WAMP_SUBSCRIPTION_GET_EVENTS,
+                             {{sub.subscription_id}},
+                             rpc_result_expect::success);
+  REQUIRE(values(events.args.args_list) == std::vector<int>({2, 3, 4}));
+
+  /* a topic without history has no retained events */
+  auto none = sync_rpc_all(session, WAMP_TOPIC_HISTORY_LAST, {{"history.b"}},
+                           rpc_result_expect::success);
+  REQUIRE(none.args.args_list.empty());
+
+  session->close().wait();
+}
+
+
+/* A subscriber given a snapshot is replayed only the retained events that are
+ * not patches, since the snapshot already includes those; without a snapshot
+ * it is replayed every retained event. */
+TEST_CASE("test_retained_patches")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  event_history_options history;
+  history.max_events = 10;
+  iserver.router()->set_event_history("default_realm", "history.p", history);
+
+  auto make_patch = [](const char* path, json_value value) {
+    wamp_args args;
+    args.args_list = json_array({json_array({json_object(
+      {{"op", "replace"}, {"path", path}, {"value", std::move(value)}})})});
+    return args;
+  };
+
+  iserver.router()->publish("default_realm", "history.p", {{"_p", 1}},
+                            make_patch("", json_object({{"n", 1}})));
+  iserver.router()->publish("default_realm", "history.p", {},
+                            wamp_args({json_array({"note"})}));
+  iserver.router()->publish("default_realm", "history.p", {{"_p", 1}},
+                            make_patch("/n", 2));
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto with_snapshot = establish_session(the_kernel, port);
+  perform_realm_logon(with_snapshot);
+  auto without = establish_session(the_kernel, port);
+  perform_realm_logon(without);
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::map<wamp_session*, std::vector<std::string>> received;
+  json_value image;
+
+  auto subscribe = [&](std::shared_ptr<wamp_session>& ws, json_object options) {
+    std::promise<subscribed_info> subscribed;
+    ws->subscribe("history.p", options,
+                       [&subscribed](wamp_session&, subscribed_info info) {
+                         subscribed.set_value(info);
+                       },
+                       [&](wamp_session& self, event_info info) {
+                         std::lock_guard<std::mutex> guard(mutex);
+                         std::string kind;
+                         if (info.details.find("_snap") != info.details.end()) {
+                           kind = "snap";
+                           image = info.args.args_list.at(0).as_array().at(0)
+                             .as_object().at("value");
+                         }
+                         else if (info.details.find("_p") != info.details.end())
+                           kind = "patch";
+                         else
+                           kind = info.args.args_list.at(0).as_string();
+                         received[&self].push_back(kind);
+                         cond.notify_all();
+                       });
+    subscribed.get_future().wait();
+  };
+
+  subscribe(with_snapshot, {{"_p", 1}, {WAMP_GET_RETAINED, true}});
+  subscribe(without, {{WAMP_GET_RETAINED, true}});
+
+  iserver.router()->publish("default_realm", "history.p", {{"_p", 1}},
+                            make_patch("/n", 3));
+
+  std::unique_lock<std::mutex> guard(mutex);
+  cond.wait_for(guard, std::chrono::seconds(5), [&]() {
+    return received[with_snapshot.get()].size() >= 3 &&
+      received[without.get()].size() >= 4;
+  });
+  REQUIRE(image == json_value(json_object({{"n", 2}})));
+  REQUIRE(received[with_snapshot.get()] ==
+          std::vector<std::string>({"snap", "note", "patch"}));
+  REQUIRE(received[without.get()] ==
+          std::vector<std::string>({"patch", "note", "patch", "patch"}));
+  guard.unlock();
+
+  without->close().wait();
+  with_snapshot->close().wait();
+}
+
+
+/* The patches published to a topic are folded into its image when a
+ * subscriber needs a snapshot, and a patch that cannot be applied is
+ * discarded. */
+TEST_CASE("test_patch_image")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  auto make_patch = [](const char* op, const char* path, json_value value) {
+    wamp_args args;
+    json_object operation({{"op", op}, {"path", path}});
+    if (!value.is_null())
+      operation["value"] = std::move(value);
+    args.args_list = json_array({json_array({std::move(operation)})});
+    return args;
+  };
+
+  iserver.router()->publish("default_realm", "model.a", {{"_p", 1}},
+                            make_patch("replace", "",
+                                       json_object({{"count", 0}, {"name", "a"}})));
+  for (int i = 1; i < 300; i++)
+    iserver.router()->publish("default_realm", "model.a", {{"_p", 1}},
+                              make_patch("replace", "/count", i));
+  iserver.router()->publish("default_realm", "model.a", {{"_p", 1}},
+                            make_patch("move", "/name", json_value()));
+  iserver.router()->publish("default_realm", "model.a", {{"_p", 1}},
+                            make_patch("replace", "/name", "b"));
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  /* subscribe, and return the image given by the snapshot */
+  auto snapshot_image = [](std::shared_ptr<wamp_session>& ws) {
+    auto snapshot = std::make_shared<std::promise<event_info>>();
+    auto first = std::make_shared<bool>(true);
+    ws->subscribe("model.a", {{"_p", 1}},
+                  [](wamp_session&, subscribed_info) {},
+                  [snapshot, first](wamp_session&, event_info info) {
+                    if (*first)
+                      snapshot->set_value(info);
+                    *first = false;
+                  });
+
+    auto fut = snapshot->get_future();
+    if (fut.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+      throw std::runtime_error("timeout waiting for snapshot");
+    event_info info = fut.get();
+    if (info.details.find("_snap") == info.details.end())
+      throw std::runtime_error("first event is not a snapshot");
+    return info.args.args_list.at(0).as_array().at(0).as_object().at("value");
+  };
+
+  REQUIRE(snapshot_image(session) ==
+          json_value(json_object({{"count", 299}, {"name", "b"}})));
+
+  /* a later subscriber shares the snapshot, until the image is next updated */
+  auto other = establish_session(the_kernel, port);
+  perform_realm_logon(other);
+  REQUIRE(snapshot_image(other) ==
+          json_value(json_object({{"count", 299}, {"name", "b"}})));
+
+  iserver.router()->publish("default_realm", "model.a", {{"_p", 1}},
+                            make_patch("replace", "/count", 300));
+
+  auto third = establish_session(the_kernel, port);
+  perform_realm_logon(third);
+  REQUIRE(snapshot_image(third) ==
+          json_value(json_object({{"count", 300}, {"name", "b"}})));
+
+  third->close().wait();
+  other->close().wait();
+  session->close().wait();
+}
+
+
+/* A patch must be an array, whether its arguments are decoded or still
+ * encoded, else the publication fails. */
+TEST_CASE("test_patch_validation")
+{
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  pubsub_man pubsub(the_kernel.get());
+
+  auto encoded = [](const json_array& items) {
+    std::string text = json_encode(items);
+    std::shared_ptr<encoded_args> ea(new encoded_args());
+    ea->serialiser = serialiser_type::json;
+    ea->bytes.assign(text.begin(), text.end());
+    ea->items_begin = 1;
+    ea->items_end = ea->bytes.size() - 1;
+    ea->count = items.size();
+    wamp_args args;
+    args.encoded = ea;
+    return args;
+  };
+
+  auto rejected = [&pubsub](wamp_args args) {
+    try {
+      pubsub.publish("default_realm", "model.v", {{"_p", 1}}, std::move(args));
+    }
+    catch (const wamp_error& e) {
+      return e.error_uri() == WAMP_ERROR_INVALID_ARGUMENT;
+    }
+    return false;
+  };
+
+  json_array patch({json_object({{"op", "add"}, {"path", "/a"}, {"value", 1}})});
+
+  REQUIRE(rejected(wamp_args()));
+  REQUIRE(rejected(wamp_args({json_array({"patch"})})));
+  REQUIRE(rejected(wamp_args({json_array({json_object()})})));
+  REQUIRE(!rejected(wamp_args({json_array({patch})})));
+
+  REQUIRE(rejected(encoded(json_array({json_array()}))));
+  REQUIRE(rejected(encoded(json_array({json_array({"patch"})}))));
+  REQUIRE(rejected(encoded(json_array({json_array({json_object()}),
+                                       json_object({{"k", 1}})}))));
+  REQUIRE(!rejected(encoded(json_array({json_array({patch})}))));
+}
+
+
+/* A conflating subscriber that stops reading is sent only the latest event of
+ * each key, rather than being disconnected once its backlog grows too large. */
+TEST_CASE("test_conflation")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  const int keys = 4;
+  const int events = 20000;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::map<std::string, std::vector<int>> received;
+
+  std::promise<subscribed_info> subscribed;
+  session->subscribe("conflate.prices", {{WAMP_CONFLATE, "symbol"}},
+                     [&subscribed](wamp_session&, subscribed_info info) {
+                       subscribed.set_value(info);
+                     },
+                     [&](wamp_session&, event_info info) {
+                       std::lock_guard<std::mutex> guard(mutex);
+                       int value = info.args.args_list[0].as_int();
+                       received[info.args.args_dict["symbol"].as_string()].push_back(value);
+                       cond.notify_all();
+                     });
+  subscribed.get_future().wait();
+
+  {
+    /* stop the subscriber reading, by blocking its IO thread */
+    std::promise<void> resume;
+    std::shared_future<void> resumed = resume.get_future().share();
+    the_kernel->get_io()->push_fn([resumed]() { resumed.wait(); });
+    scope_guard resume_guard([&resume]() { resume.set_value(); });
+
+    std::string padding(1024, 'x');
+    for (int i = 1; i <= events; i++)
+    {
+      wamp_args args;
+      args.args_list = json_array({i, padding});
+      args.args_dict = json_object({{"symbol", "s" + std::to_string(i % keys)}});
+      iserver.router()->publish("default_realm", "conflate.prices", {}, args);
+    }
+
+    /* wait for the router to have processed the publications */
+    std::promise<void> published;
+    iserver.get_kernel()->get_event_loop()->dispatch(
+      [&published]() { published.set_value(); });
+    published.get_future().wait();
+  }
+
+  /* each key ends with its latest value */
+  auto is_latest = [&]() {
+    if (received.size() != size_t(keys))
+      return false;
+    for (auto& item : received)
+      if (item.second.back() <= events - keys)
+        return false;
+    return true;
+  };
+
+  bool latest, in_order = true;
+  size_t total = 0;
+  {
+    std::unique_lock<std::mutex> guard(mutex);
+    cond.wait_for(guard, std::chrono::seconds(30), is_latest);
+    latest = is_latest();
+    for (auto& item : received)
+    {
+      in_order &= std::is_sorted(item.second.begin(), item.second.end());
+      total += item.second.size();
+    }
+  }
+
+  bool was_open = session->is_open();
+  session->close().wait();
+
+  REQUIRE(was_open);
+  REQUIRE(latest);
+  REQUIRE(in_order);
+  REQUIRE(total < size_t(events));
+}
+
+
+/* With topics sharded over threads, publications to each topic, from user
+ * threads, remote sessions and batches, arrive in order at exact and pattern
+ * subscriptions, while another subscriber closes its session. */
+TEST_CASE("test_sharded_pubsub")
+{
+  config conf;
+  conf.pubsub_shard_threads = 4;
+  internal_server iserver(logger::nolog(), conf);
+  int port = iserver.start(global_port++);
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+  auto other = establish_session(the_kernel, port);
+  perform_realm_logon(other);
+
+  const int local_topics = 8;
+  const int events = 500;
+  const int remote_events = 200;
+
+  std::vector<std::string> topics;
+  for (int i = 0; i < local_topics; i++)
+    topics.push_back("shard.t" + std::to_string(i));
+  topics.push_back("shard.remote");
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::map<t_subscription_id, std::string> subscriptions;
+  std::map<std::string, std::vector<int>> exact;
+  std::map<std::string, std::vector<int>> pattern;
+  t_subscription_id pattern_id = 0;
+
+  auto on_event = [&](wamp_session&, event_info info) {
+    std::lock_guard<std::mutex> guard(mutex);
+    int value = info.args.args_list[0].as_int();
+    if (info.subscription_id == pattern_id)
+      pattern[info.details["topic"].as_string()].push_back(value);
+    else
+      exact[subscriptions[info.subscription_id]].push_back(value);
+    cond.notify_all();
+  };
+
+  auto subscribe = [&](std::shared_ptr<wamp_session>& ws, const std::string& uri,
+                       json_object options) {
+    std::promise<subscribed_info> subscribed;
+    ws->subscribe(uri, options,
+                  [&subscribed](wamp_session&, subscribed_info info) {
+                    subscribed.set_value(info);
+                  },
+                  on_event);
+    return subscribed.get_future().get().subscription_id;
+  };
+
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto& uri : topics)
+      subscriptions[subscribe(session, uri, {})] = uri;
+    pattern_id = subscribe(session, "shard.", {{"match", "prefix"}});
+  }
+
+  for (auto& uri : topics)
+    other->subscribe(uri, {}, nullptr, [](wamp_session&, event_info) {});
+  other->subscribe("shard.", {{"match", "prefix"}}, nullptr,
+                   [](wamp_session&, event_info) {});
+
+  /* each user thread publishes to two topics, interleaved */
+  std::vector<std::thread> publishers;
+  for (int t = 0; t < local_topics / 2; t++)
+    publishers.emplace_back([&, t]() {
+      for (int i = 0; i < events; i++)
+        for (int k : {t, t + local_topics / 2})
+        {
+          wamp_args args;
+          args.args_list = json_array({i});
+          iserver.router()->publish("default_realm", topics[k], {}, args);
+        }
+    });
+
+  int acknowledged = 0;
+  for (int i = 0; i < remote_events; i++)
+  {
+    wamp_args args;
+    args.args_list = json_array({i});
+    session->publish("shard.remote", {{WAMP_ACKNOWLEDGE, true}}, args,
+                     [&](wamp_session&, published_info info) {
+                       std::lock_guard<std::mutex> guard(mutex);
+                       if (!info.was_error)
+                         acknowledged++;
+                       cond.notify_all();
+                     });
+  }
+
+  other->close().wait();
+  other.reset();
+
+  for (auto& item : publishers)
+    item.join();
+
+  /* then one more event to every local topic, as a batch over the shards */
+  std::vector<publish_item> batch;
+  for (int i = 0; i < local_topics; i++)
+  {
+    publish_item item;
+    item.uri = topics[i];
+    item.args.args_list = json_array({events});
+    batch.push_back(std::move(item));
+  }
+  iserver.router()->publish_batch("default_realm", std::move(batch));
+
+  auto expected = [&](const std::string& uri) {
+    std::vector<int> dest(uri == "shard.remote" ? remote_events : events + 1);
+    for (size_t i = 0; i < dest.size(); i++)
+      dest[i] = i;
+    return dest;
+  };
+
+  auto is_complete = [&]() {
+    if (acknowledged < remote_events)
+      return false;
+    for (auto& uri : topics)
+      if (exact[uri].size() < expected(uri).size() ||
+          pattern[uri].size() < expected(uri).size())
+        return false;
+    return true;
+  };
+
+  bool in_order = true;
+  int acks;
+  {
+    std::unique_lock<std::mutex> guard(mutex);
+    cond.wait_for(guard, std::chrono::seconds(30), is_complete);
+    acks = acknowledged;
+    for (auto& uri : topics)
+      in_order &= (exact[uri] == expected(uri)) && (pattern[uri] == expected(uri));
+  }
+
+  auto listed = sync_rpc_all(session, WAMP_REFLECTION_TOPIC_LIST, {},
+                             rpc_result_expect::success);
+  std::vector<std::string> uris;
+  for (auto& item : listed.args.args_list)
+    uris.push_back(item.as_string());
+
+  session->close().wait();
+
+  REQUIRE(in_order);
+  REQUIRE(acks == remote_events);
+  REQUIRE(uris == std::vector<std::string>({"shard.remote", "shard.t0",
+                                            "shard.t1", "shard.t2", "shard.t3",
+                                            "shard.t4", "shard.t5", "shard.t6",
+                                            "shard.t7"}));
+}
+
 int main(int argc, char** argv)
 {
   try {
@@ -125,6 +125,115 @@ TEST_CASE("test_close_of_listen_socket_bulk")
     test_close_of_listen_socket(port);
 }
 
+void test_corked_write(int port, std::chrono::microseconds window)
+{
+  kernel the_kernel;
+
+  const int msg_count = 1000;
+  std::string expected;
+  for (int i = 0; i < msg_count; i++)
+    expected += "msg" + std::to_string(i) + ";";
+
+  std::mutex mutex;
+  std::string received;
+  std::promise<void> all_received;
+  std::unique_ptr<tcp_socket> accepted;
+
+  tcp_socket listener(&the_kernel);
+  auto fut = listener.listen("127.0.0.1", std::to_string(port),
+                             [&](std::unique_ptr<tcp_socket>& sock, uverr) {
+      accepted = std::move(sock);
+      accepted->start_read(
+        [&](char* src, size_t len) {
+          std::lock_guard<std::mutex> guard(mutex);
+          received.append(src, len);
+          if (received.size() == expected.size())
+            all_received.set_value();
+        },
+        [](uverr) {});
+    });
+  REQUIRE(fut.wait_for(std::chrono::milliseconds(100)) == std::future_status::ready);
+  REQUIRE(!fut.get());
+
+  tcp_socket::options opts;
+  opts.cork_enable = true;
+  opts.cork_window = window;
+  std::unique_ptr<tcp_socket> sock{new tcp_socket(&the_kernel, opts)};
+  REQUIRE(!sock->connect("127.0.0.1", port).get());
+
+  for (int i = 0; i < msg_count; i++) {
+    std::string msg = "msg" + std::to_string(i);
+    std::pair<const char*, size_t> bufs[2] = {{msg.data(), msg.size()}, {";", 1}};
+    sock->write(bufs, 2);
+  }
+
+  auto done = all_received.get_future();
+  REQUIRE(done.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+  REQUIRE(received == expected);
+
+  sock->close().wait();
+  accepted->close().wait();
+  listener.close().wait();
+}
+
+TEST_CASE("test_corked_write")
+{
+  test_corked_write(global_port++, std::chrono::microseconds(0));
+  test_corked_write(global_port++, std::chrono::microseconds(500));
+}
+
+/* Bytes corked during a single EV batch count towards the pending write
+ * limit, so a burst of writes closes the connection rather than growing the
+ * cork buffer without bound. */
+TEST_CASE("test_corked_write_limit")
+{
+  config conf;
+  conf.socket_max_pending_write_bytes = 64 * 1024;
+  kernel the_kernel(conf, logger::nolog());
+
+  int port = global_port++;
+  std::unique_ptr<tcp_socket> accepted;
+  tcp_socket listener(&the_kernel);
+  auto fut = listener.listen("127.0.0.1", std::to_string(port),
+                             [&](std::unique_ptr<tcp_socket>& sock, uverr) {
+      accepted = std::move(sock);
+    });
+  REQUIRE(fut.wait_for(std::chrono::milliseconds(100)) == std::future_status::ready);
+  REQUIRE(!fut.get());
+
+  tcp_socket::options opts;
+  opts.cork_enable = true;
+  std::unique_ptr<tcp_socket> sock{new tcp_socket(&the_kernel, opts)};
+  REQUIRE(!sock->connect("127.0.0.1", port).get());
+
+  /* hold the EV thread, so that no deferred flush can run */
+  std::promise<void> resume;
+  std::shared_future<void> resumed = resume.get_future().share();
+  the_kernel.get_event_loop()->dispatch([resumed]() { resumed.wait(); });
+  scope_guard resume_guard([&resume]() { resume.set_value(); });
+
+  std::string chunk(1024, 'x');
+  try {
+    for (int i = 0; i < 1024; i++)
+      sock->write(chunk.data(), chunk.size());
+  } catch (tcp_socket::error&) {
+    /* closing, once the limit was reached */
+  }
+
+  bool closed = sock->closed_future().wait_for(std::chrono::seconds(5)) ==
+    std::future_status::ready;
+
+  resume_guard.dismiss();
+  resume.set_value();
+
+  REQUIRE(closed);
+
+  sock->close().wait();
+  if (accepted)
+    accepted->close().wait();
+  listener.close().wait();
+}
+
 TEST_CASE("test_all")
 {
   auto all_tests = [](int port) {
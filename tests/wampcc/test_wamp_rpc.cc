@@ -196,6 +196,121 @@ TEST_CASE("test_unsubscribe")
 }
 
 
+/* an application type, bound by specialising json_convert */
+struct quote
+{
+  std::string symbol;
+  double price;
+};
+
+namespace wampcc
+{
+template <>
+struct json_convert<quote>
+{
+  static quote from_json(const json_value& jv)
+  {
+    if (!jv.is_object())
+      throw json_convert_error("quote object");
+    const json_object& jo = jv.as_object();
+    quote q;
+    q.symbol = json_convert<std::string>::from_json(json_get_copy(jo, "symbol", ""));
+    q.price = json_convert<double>::from_json(json_get_copy(jo, "price", 0.0));
+    return q;
+  }
+  static json_value to_json(const quote& q)
+  {
+    return json_object{{"symbol", q.symbol}, {"price", q.price}};
+  }
+};
+}
+
+TEST_CASE("test_typed_binding")
+{
+  internal_server iserver;
+  int port = iserver.start(global_port++);
+
+  iserver.router()->callable<double(int, const std::string&)>(
+    "default_realm", "typed.scale",
+    [](int n, const std::string& s) { return n * 1.5 + s.size(); });
+
+  unique_ptr<kernel> the_kernel(new kernel({}, logger::nolog()));
+  auto callee = establish_session(the_kernel, port);
+  perform_realm_logon(callee);
+  auto session = establish_session(the_kernel, port);
+  perform_realm_logon(session);
+
+  /* router procedure */
+  {
+    wamp_args args;
+    args.args_list = json_array({2, "abc"});
+    auto result = sync_rpc_all(session, "typed.scale", args,
+                               rpc_result_expect::success);
+    REQUIRE(result.args.args_list.size() == 1);
+    REQUIRE(result.args.args_list[0].as_real() == 6.0);
+
+    args.args_list = json_array({"two", "abc"});
+    result = sync_rpc_all(session, "typed.scale", args, rpc_result_expect::fail);
+    REQUIRE(result.error_uri == WAMP_ERROR_INVALID_ARGUMENT);
+
+    args.args_list = json_array({2});
+    result = sync_rpc_all(session, "typed.scale", args, rpc_result_expect::fail);
+    REQUIRE(result.error_uri == WAMP_ERROR_INVALID_ARGUMENT);
+  }
+
+  /* callee procedure */
+  {
+    std::promise<void> registered;
+    callee->provide<std::string(std::vector<int>)>(
+      "typed.sum", {},
+      [&](wamp_session&, registered_info) { registered.set_value(); },
+      [](std::vector<int> v) {
+        int total = 0;
+        for (auto i : v)
+          total += i;
+        return std::to_string(total);
+      });
+    registered.get_future().wait();
+
+    wamp_args args;
+    args.args_list = json_array({json_array({1, 2, 3})});
+    auto result = sync_rpc_all(session, "typed.sum", args,
+                               rpc_result_expect::success);
+    REQUIRE(result.args.args_list[0].as_string() == "6");
+
+    args.args_list = json_array({json_array({1, "x"})});
+    result = sync_rpc_all(session, "typed.sum", args, rpc_result_expect::fail);
+    REQUIRE(result.error_uri == WAMP_ERROR_INVALID_ARGUMENT);
+  }
+
+  /* subscription */
+  {
+    std::promise<void> subscribed;
+    std::promise<std::pair<quote, int>> received;
+    session->subscribe<quote, int>(
+      "typed.quotes", {},
+      [&](wamp_session&, subscribed_info) { subscribed.set_value(); },
+      [&](quote q, int seq) { received.set_value({q, seq}); });
+    subscribed.get_future().wait();
+
+    wamp_args args;
+    args.args_list = json_array(
+      {json_convert<quote>::to_json(quote{"ABC", 9.25}), 7});
+    iserver.router()->publish("default_realm", "typed.quotes", {}, args);
+
+    auto fut = received.get_future();
+    REQUIRE(fut.wait_for(std::chrono::milliseconds(500)) ==
+            std::future_status::ready);
+    auto value = fut.get();
+    REQUIRE(value.first.symbol == "ABC");
+    REQUIRE(value.first.price == 9.25);
+    REQUIRE(value.second == 7);
+  }
+
+  session->close().wait();
+  callee->close().wait();
+}
+
 int main(int argc, char** argv)
 {
   try